@@ -16,8 +16,68 @@
 
 #define ASYNC0(/* fun, [(i, j),] empty_args */ ...) ASYNC0_IMPL(__VA_ARGS__)
 
+// ASYNCs with a priority between 0 (the default) and TASK_PRIORITY_MAX //////
+// Tasks of higher priority are popped and stolen first, splitting a task
+// preserves its priority
+
+#define ASYNC_PRIO(prio, /* fun, [(i, j),] args */ ...) ASYNC_PRIO_IMPL(prio, __VA_ARGS__)
+
+#define ASYNC0_PRIO(prio, /* fun, [(i, j),] empty_args */ ...) ASYNC0_PRIO_IMPL(prio, __VA_ARGS__)
+
+// ASYNCs with data-flow dependencies (see src/dependency.h) ////////////////
+// A task runs after the tasks its parent has created earlier that write the
+// addresses it reads, or access the addresses it writes. Dependencies are
+// listed in parentheses, for example:
+// ASYNC_DEPS ((DEP_IN(&a), DEP_INOUT(&b)), fun, (a, &b));
+// Tasks with dependencies can't be split, and must not be created by
+// splittable tasks
+
+#define DEP_IN(addr)    DEP_IMPL(addr, IN)
+#define DEP_OUT(addr)   DEP_IMPL(addr, OUT)
+#define DEP_INOUT(addr) DEP_IMPL(addr, INOUT)
+
+#define ASYNC_DEPS(deps, fun, args) ASYNC_DEPS_IMPL(deps, fun, args)
+
+#define ASYNC_DEPS_PRIO(prio, deps, fun, args) ASYNC_DEPS_PRIO_IMPL(prio, deps, fun, args)
+
 // Helper macro for executing splittable tasks ///////////////////////////////
 
 #define ASYNC_FOR(i) ASYNC_FOR_IMPL(i)
 
+// Splittable loops that reduce var with operator op /////////////////////////
+// op is an associative and commutative binary operator, such as +, *, &, |,
+// ^, &&, or ||, and identity is its neutral element. Tasks split off the loop
+// accumulate into their own var, starting from identity. When the loop ends,
+// it waits for these tasks, and var of the original task holds the result.
+// Example:
+// long sum = 0;
+// ASYNC_FOR_REDUCE (i, +, sum, 0) {
+//     sum += a[i];
+// }
+// return sum;
+// Only the original task of a splittable FUTURE sets the future
+// The loop body must not return, which would skip combining the results
+// (use break or cancellation to end the loop early)
+
+#define ASYNC_FOR_REDUCE(i, op, var, identity) ASYNC_FOR_REDUCE_IMPL(i, op, var, identity)
+
+// Splittable loops over two or three dimensions /////////////////////////////
+// Loop tasks get one range per dimension, outermost first, for example:
+// ASYNC (fun, (0, rows, 0, cols), args);
+// Running out of work, a task is split along the dimension with the most
+// iterations left, so that split-off tasks work on tiles that are roughly
+// square. Inner ranges are split in half.
+// Example:
+// void fun(args)
+// {
+//     long i, j;
+//     ASYNC_FOR2 (i, j) {
+//         ...
+//     }
+// }
+
+#define ASYNC_FOR2(i, j) ASYNC_FOR2_IMPL(i, j)
+
+#define ASYNC_FOR3(i, j, k) ASYNC_FOR3_IMPL(i, j, k)
+
 #endif // ASYNC_H
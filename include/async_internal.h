@@ -40,70 +40,104 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 
 // ASYNC /////////////////////////////////////////////////////////////////////
 
-#define ASYNC_IMPL(...) ASYNC_IMPL_2(VA_NARGS(__VA_ARGS__), __VA_ARGS__)
-#define ASYNC_IMPL_2(n, ...) ASYNC_IMPL_3(n, __VA_ARGS__)
-#define ASYNC_IMPL_3(n, ...) ASYNC_##n##_IMPL_3(__VA_ARGS__)
+#define ASYNC_IMPL(...) ASYNC_PRIO_IMPL(0, __VA_ARGS__)
+#define ASYNC_PRIO_IMPL(prio, ...) ASYNC_IMPL_2(prio, VA_NARGS(__VA_ARGS__), __VA_ARGS__)
+#define ASYNC_IMPL_2(prio, n, ...) ASYNC_IMPL_3(prio, n, __VA_ARGS__)
+#define ASYNC_IMPL_3(prio, n, ...) ASYNC_##n##_IMPL_3(prio, __VA_ARGS__)
 
 // ASYNC (two arguments) /////////////////////////////////////////////////////
 
-#define ASYNC_2_IMPL_3(fun, args) ASYNC_2_IMPL_4(fun, ARGS args)
-#define ASYNC_2_IMPL_4(fun, ...) ASYNC_2_CALL(fun, __VA_ARGS__)
-#define ASYNC_2_CALL(fun, args...) \
+#define ASYNC_2_IMPL_3(prio, fun, args) ASYNC_2_IMPL_4(prio, fun, ARGS args)
+#define ASYNC_2_IMPL_4(prio, fun, ...) ASYNC_2_CALL(prio, fun, __VA_ARGS__)
+#define ASYNC_2_CALL(prio, fun, args...) \
 do { \
 	Task *__task; \
 	struct fun##_task_data __d; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(sizeof(__d)); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->priority = TASK_PRIORITY(prio); \
 	\
 	PACK(&__d, args); \
-	memcpy(__task->data, &__d, sizeof(__d)); \
+	memcpy(task_data(__task), &__d, sizeof(__d)); \
 	RT_push(__task); \
 	} /* PROFILE */ \
 } while (0)
 
 // ASYNC (three arguments) ///////////////////////////////////////////////////
 
-#define ASYNC_3_IMPL_3(fun, bounds, args) ASYNC_3_IMPL_4(fun, ARGS bounds, ARGS args)
-#define ASYNC_3_IMPL_4(fun, lo, hi, ...) ASYNC_3_CALL(fun, lo, hi, __VA_ARGS__)
-#define ASYNC_3_CALL(fun, lo, hi, args...) \
+#define ASYNC_3_IMPL_3(prio, fun, bounds, args) ASYNC_3_IMPL_4(prio, fun, bounds, ARGS args)
+#define ASYNC_3_IMPL_4(prio, fun, bounds, ...) ASYNC_3_CALL(prio, fun, bounds, __VA_ARGS__)
+#define ASYNC_3_CALL(prio, fun, bounds, args...) \
 do { \
 	Task *__task; \
 	struct fun##_task_data __d; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(TASK_RANGES_SIZE(sizeof(__d), LOOP_DIMS(bounds))); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
-	__task->splittable = true; \
-	__task->start = (lo); \
-	__task->cur = (lo); \
-	__task->end = (hi); \
+	__task->priority = TASK_PRIORITY(prio); \
+	LOOP_BOUNDS(__task, bounds); \
 	PACK(&__d, args); \
-	memcpy(__task->data, &__d, sizeof(__d)); \
+	memcpy(task_data(__task), &__d, sizeof(__d)); \
 	RT_push(__task); \
 	} /* PROFILE */ \
 } while (0)
 
+// Loop bounds of splittable ASYNCs //////////////////////////////////////////
+
+// (lo, hi), (lo, hi, lo2, hi2), or (lo, hi, lo2, hi2, lo3, hi3)
+#define LOOP_DIMS(bounds) (VA_NARGS bounds / 2)
+
+#define LOOP_BOUNDS(task, bounds) LOOP_BOUNDS_IMPL(task, VA_NARGS bounds, ARGS bounds)
+#define LOOP_BOUNDS_IMPL(task, n, ...) LOOP_BOUNDS_IMPL_2(task, n, __VA_ARGS__)
+#define LOOP_BOUNDS_IMPL_2(task, n, ...) LOOP_BOUNDS_##n(task, __VA_ARGS__)
+
+#define LOOP_BOUNDS_2(task, lo, hi) \
+do { \
+	(task)->splittable = 1; \
+	(task)->start = (lo); \
+	(task)->cur = (lo); \
+	(task)->end = (hi); \
+} while (0)
+
+#define LOOP_BOUNDS_4(task, lo, hi, lo2, hi2) \
+do { \
+	LOOP_BOUNDS_2(task, lo, hi); \
+	(task)->splittable = 2; \
+	task_ranges(task)[0] = (struct task_range){ (lo2), (hi2) }; \
+} while (0)
+
+#define LOOP_BOUNDS_6(task, lo, hi, lo2, hi2, lo3, hi3) \
+do { \
+	LOOP_BOUNDS_2(task, lo, hi); \
+	(task)->splittable = 3; \
+	task_ranges(task)[0] = (struct task_range){ (lo2), (hi2) }; \
+	task_ranges(task)[1] = (struct task_range){ (lo3), (hi3) }; \
+} while (0)
+
 // ASYNC0 ////////////////////////////////////////////////////////////////////
 
-#define ASYNC0_IMPL(...) ASYNC0_IMPL_2(VA_NARGS(__VA_ARGS__), __VA_ARGS__)
-#define ASYNC0_IMPL_2(n, ...) ASYNC0_IMPL_3(n, __VA_ARGS__)
-#define ASYNC0_IMPL_3(n, ...) ASYNC0_##n##_IMPL_3(__VA_ARGS__)
+#define ASYNC0_IMPL(...) ASYNC0_PRIO_IMPL(0, __VA_ARGS__)
+#define ASYNC0_PRIO_IMPL(prio, ...) ASYNC0_IMPL_2(prio, VA_NARGS(__VA_ARGS__), __VA_ARGS__)
+#define ASYNC0_IMPL_2(prio, n, ...) ASYNC0_IMPL_3(prio, n, __VA_ARGS__)
+#define ASYNC0_IMPL_3(prio, n, ...) ASYNC0_##n##_IMPL_3(prio, __VA_ARGS__)
 
 // ASYNC0 (two arguments) ////////////////////////////////////////////////////
 
-#define ASYNC0_2_IMPL_3(fun, args) ASYNC0_2_CALL(fun)
-#define ASYNC0_2_CALL(fun) \
+#define ASYNC0_2_IMPL_3(prio, fun, args) ASYNC0_2_CALL(prio, fun)
+#define ASYNC0_2_CALL(prio, fun) \
 do { \
 	Task *__task; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(0); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->priority = TASK_PRIORITY(prio); \
 	\
 	RT_push(__task); \
 	} /* PROFILE */ \
@@ -111,31 +145,112 @@ do { \
 
 // ASYNC0 (three arguments) //////////////////////////////////////////////////
 
-#define ASYNC0_3_IMPL_3(fun, bounds, args) ASYNC0_3_IMPL_4(fun, ARGS bounds)
-#define ASYNC0_3_IMPL_4(fun, ...) ASYNC0_3_CALL(fun, __VA_ARGS__)
-#define ASYNC0_3_CALL(fun, lo, hi) \
+#define ASYNC0_3_IMPL_3(prio, fun, bounds, args) ASYNC0_3_CALL(prio, fun, bounds)
+#define ASYNC0_3_CALL(prio, fun, bounds) \
 do { \
 	Task *__task; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(TASK_RANGES_SIZE(0, LOOP_DIMS(bounds))); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
-	__task->splittable = true; \
-	__task->start = (lo); \
-	__task->cur = (lo); \
-	__task->end = (hi); \
+	__task->priority = TASK_PRIORITY(prio); \
+	LOOP_BOUNDS(__task, bounds); \
 	RT_push(__task); \
 	} /* PROFILE */ \
 } while (0)
 
+// ASYNC_DEPS ////////////////////////////////////////////////////////////////
+
+#define DEP_IMPL(addr, mode) ((struct dep){ (void *)(addr), DEP_MODE_##mode })
+
+#define ASYNC_DEPS_IMPL(deps, fun, args) ASYNC_DEPS_PRIO_IMPL(0, deps, fun, args)
+#define ASYNC_DEPS_PRIO_IMPL(prio, deps, fun, args) ASYNC_DEPS_IMPL_2(prio, deps, fun, ARGS args)
+#define ASYNC_DEPS_IMPL_2(prio, deps, fun, ...) ASYNC_DEPS_CALL(prio, deps, fun, __VA_ARGS__)
+#define ASYNC_DEPS_CALL(prio, deps, fun, args...) \
+do { \
+	Task *__task; \
+	struct fun##_task_data __d; \
+	struct dep __deps[] = { ARGS deps }; \
+	PROFILE(ENQ_DEQ_TASK) { \
+	\
+	__task = RT_task_alloc(sizeof(__d)); \
+	__task->parent = get_current_task(); \
+	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->priority = TASK_PRIORITY(prio); \
+	\
+	PACK(&__d, args); \
+	memcpy(task_data(__task), &__d, sizeof(__d)); \
+	RT_push_deps(__task, __deps, sizeof(__deps) / sizeof(__deps[0])); \
+	} /* PROFILE */ \
+} while (0)
+
 // ASYNC_FOR /////////////////////////////////////////////////////////////////
 
 #define ASYNC_FOR_IMPL(i) ASYNC_FOR_EACH(i)
 #define ASYNC_FOR_EACH(i) \
 	Task *this = get_current_task(); \
-	assert(this->splittable); \
+	assert(this->splittable == 1); \
+	assert(this->start == this->cur); \
+	ASYNC_FOR_EACH_2(i)
+
+// ASYNC_FOR_REDUCE //////////////////////////////////////////////////////////
+
+// The inner loop splits the task, the outer loop runs once and combines the
+// results when the inner loop ends, even through break
+#define ASYNC_FOR_REDUCE_IMPL(i, op, var, identity) \
+	Task *this = get_current_task(); \
+	typeof(var) __acc = (identity); \
+	struct reduction __red = { this->reduction, &__acc, 0, 0 }; \
+	assert(this->splittable == 1); \
+	assert(this->start == this->cur); \
+	if (__red.parent != NULL) var = (identity); \
+	this->reduction = &__red; \
+	for (int __once = 1; __once; __once = 0, REDUCE_COMBINE(op, var)) \
+		ASYNC_FOR_EACH_2(i)
+
+#define ASYNC_FOR_EACH_2(i) \
+	for (i = this->start, this->cur++; i < this->end && !task_cancelled(this); \
+		 i++, this->cur++, POLL())
+
+#define REDUCE_COMBINE(op, var) \
+({ \
+	/* The loop may have ended early, stop splitting */ \
+	if (this->cur < this->end) this->end = this->cur; \
+	RT_reduction_wait(&__red); \
+	var = var op __acc; \
+	this->reduction = __red.parent; \
+	if (__red.parent != NULL) { \
+		typeof(var) *__p = (typeof(var) *)__red.parent->acc; \
+		RT_reduction_lock(__red.parent); \
+		*__p = *__p op var; \
+		RT_reduction_unlock(__red.parent); \
+	} \
+})
+
+// ASYNC_FOR2, ASYNC_FOR3 ////////////////////////////////////////////////////
+
+#define ASYNC_FOR2_IMPL(i, j) \
+	ASYNC_FOR_DIMS(i, 2) \
+		for (j = __b[0].start; j < __b[0].end; j++)
+
+#define ASYNC_FOR3_IMPL(i, j, k) \
+	ASYNC_FOR_DIMS(i, 3) \
+		for (j = __b[0].start; j < __b[0].end; j++) \
+			for (k = __b[1].start; k < __b[1].end; k++)
+
+// Splitting an inner dimension shrinks its range for the iterations of i that
+// haven't started yet, so every iteration of i works on a snapshot (__b) of
+// the inner ranges, counts the iterations of the snapshot when it's done, and
+// polls before the next iteration starts
+#define ASYNC_FOR_DIMS(i, dims) \
+	Task *this = get_current_task(); \
+	struct task_range *__r = task_ranges(this); \
+	assert(this->splittable == (dims)); \
 	assert(this->start == this->cur); \
-	for (i = this->start, this->cur++; i < this->end; i++, this->cur++, POLL())
+	for (i = this->start, this->cur++; i < this->end && !task_cancelled(this); \
+		 POLL(), i++, this->cur++) \
+		for (struct task_range __b[(dims) - 1], *__p = memcpy(__b, __r, sizeof(__b)); \
+			 __p != NULL; num_tasks_exec += task_range_iterations(__b, (dims) - 1), __p = NULL)
 
 #endif // ASYNC_INTERNAL_H
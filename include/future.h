@@ -16,22 +16,40 @@
 
 #define FUTURE0(/* fun, empty_args [,addr] */ ...) FUTURE0_IMPL(__VA_ARGS__)
 
-// Await a future's result ///////////////////////////////////////////////////
+// FUTUREs with a priority between 0 (the default) and TASK_PRIORITY_MAX /////
+// Tasks of higher priority are popped and stolen first, splitting a task
+// preserves its priority
 
-#define AWAIT(fut, ty) AWAIT_IMPL(fut, ty)
+#define FUTURE_PRIO(prio, /* fun, args [, addr] */ ...) FUTURE_PRIO_IMPL(prio, __VA_ARGS__)
 
-// Await all scoped futures' results upon leaving a block ////////////////////
+#define FUTURE0_PRIO(prio, /* fun, empty_args [,addr] */ ...) FUTURE0_PRIO_IMPL(prio, __VA_ARGS__)
 
-#define AWAIT_ALL AWAIT_ALL_IMPL
+// Submit FUTURE functions to a pool from any thread /////////////////////////
 
-#ifdef EXPERIMENTAL
+// pool is a tasking_pool *, or NULL for the pool of tasking_init
+// Threads that are not workers can await the result with AWAIT, too
+#define SUBMIT(pool, fun, args) SUBMIT_IMPL(pool, fun, args)
 
-// Reductions for splittable tasks ///////////////////////////////////////////
+#define SUBMIT0(pool, fun, ...) SUBMIT0_IMPL(pool, fun)
 
-#warning "Reductions are experimental"
+// Await a future's result ///////////////////////////////////////////////////
 
-#define REDUCE(op, var) REDUCE_IMPL(op, var)
+// Workers run other tasks while they wait. With -DFIBERS, a task that has run
+// out of children is suspended instead, and resumed by its worker once the
+// result has arrived (see src/fiber.h).
+#define AWAIT(fut, ty) AWAIT_IMPL(fut, ty)
 
-#endif // EXPERIMENTAL
+// Await the first of n futures in array futs ///////////////////////////////
+
+// Stores the result in *ptr, sets the future to NULL, and returns its index
+// NULL entries are skipped, -1 is returned if all entries are NULL
+// The other futures remain pending and must still be awaited, with AWAIT or
+// AWAIT_ANY, before the caller returns; their tasks can return early if the
+// results are no longer needed
+#define AWAIT_ANY(futs, n, ty, ptr) AWAIT_ANY_IMPL(futs, n, ty, ptr)
+
+// Await all scoped futures' results upon leaving a block ////////////////////
+
+#define AWAIT_ALL AWAIT_ALL_IMPL
 
 #endif // FUTURE_H
@@ -46,11 +46,13 @@ do { \
 
 #define FUTURE_GET(fut, res, ty) RT_force_future(fut, res, sizeof(ty))
 
+#define FUTURE_GET_ANY(futs, n, res, ty) RT_force_future_any(futs, n, res, sizeof(ty))
+
 #define FUTURE_CONVERT(task) \
 do { \
 	/* Lazy allocation */ \
 	lazy_future *f; \
-	memcpy(&f, (task)->data, sizeof(lazy_future *)); \
+	memcpy(&f, task_data(task), sizeof(lazy_future *)); \
 	if (!f->has_channel) { \
 		assert(sizeof(f->buf) == 8); \
 		f->chan = channel_alloc(sizeof(f->buf), 0, SPSC); \
@@ -72,8 +74,24 @@ do { \
 	channel_free(fut); \
 } while (0)
 
+#define FUTURE_GET_ANY(futs, n, res, ty) \
+({ \
+	int __i = RT_force_future_any(futs, n, res, sizeof(ty)); \
+	if (__i >= 0) channel_free((futs)[__i]); \
+	__i; \
+})
+
 #endif // LAZY_FUTURES
 
+// Cancelled FUTUREs resolve to zero without running (see tasking_cancel)
+#define FUTURE_CANCEL(fut, rty) \
+do { \
+	rty __zero; \
+	memset(&__zero, 0, sizeof(__zero)); \
+	FUTURE_SET(fut, __zero); \
+	num_tasks_cancelled++; \
+} while (0)
+
 // Scoped futures are wrapped in a structure and collected in a list
 
 struct future_node {
@@ -117,6 +135,15 @@ void fun##_task_func(struct fun##_task_data *__d) \
 	Task *this = get_current_task(); \
 	assert(!is_root_task(this)); \
 	UNPACK(__d, __f, args); \
+	if (!this->has_future) { \
+		/* Split off the original task, which sets the future */ \
+		fun(args); \
+		return; \
+	} \
+	if (task_cancelled(this)) { \
+		FUTURE_CANCEL(__f, rty); \
+		return; \
+	} \
 	rty __tmp = fun(args); \
 	FUTURE_SET(__f, __tmp); \
 }
@@ -141,8 +168,17 @@ void fun##_task_func(void *__d __attribute__((unused))) \
 	Task *this = get_current_task(); \
 	assert(!is_root_task(this)); \
 	future __f; \
+	memcpy(&__f, task_data(this), sizeof(__f)); \
+	if (!this->has_future) { \
+		/* Split off the original task, which sets the future */ \
+		fun(); \
+		return; \
+	} \
+	if (task_cancelled(this)) { \
+		FUTURE_CANCEL(__f, rty); \
+		return; \
+	} \
 	rty __tmp = fun(); \
-	memcpy(&__f, this->data, sizeof(__f)); \
 	FUTURE_SET(__f, __tmp); \
 }
 
@@ -150,29 +186,31 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 
 // FUTURE ////////////////////////////////////////////////////////////////////
 
-#define FUTURE_IMPL(...) FUTURE_IMPL_2(VA_NARGS(__VA_ARGS__), __VA_ARGS__)
-#define FUTURE_IMPL_2(n, ...) FUTURE_IMPL_3(n, __VA_ARGS__)
-#define FUTURE_IMPL_3(n, ...) FUTURE_##n##_IMPL_3(__VA_ARGS__)
+#define FUTURE_IMPL(...) FUTURE_PRIO_IMPL(0, __VA_ARGS__)
+#define FUTURE_PRIO_IMPL(prio, ...) FUTURE_IMPL_2(prio, VA_NARGS(__VA_ARGS__), __VA_ARGS__)
+#define FUTURE_IMPL_2(prio, n, ...) FUTURE_IMPL_3(prio, n, __VA_ARGS__)
+#define FUTURE_IMPL_3(prio, n, ...) FUTURE_##n##_IMPL_3(prio, __VA_ARGS__)
 
 // FUTURE (two arguments) ////////////////////////////////////////////////////
 
-#define FUTURE_2_IMPL_3(fun, args) FUTURE_2_IMPL_4(fun, ARGS args)
-#define FUTURE_2_IMPL_4(fun, ...) FUTURE_2_CALL(fun, __VA_ARGS__)
-#define FUTURE_2_CALL(fun, args...) \
+#define FUTURE_2_IMPL_3(prio, fun, args) FUTURE_2_IMPL_4(prio, fun, ARGS args)
+#define FUTURE_2_IMPL_4(prio, fun, ...) FUTURE_2_CALL(prio, fun, __VA_ARGS__)
+#define FUTURE_2_CALL(prio, fun, args...) \
 ({  \
 	Task *__task; \
 	struct fun##_task_data __d; \
 	future __f; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(sizeof(__d)); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->priority = TASK_PRIORITY(prio); \
 	__task->has_future = true; \
 	\
 	__f = FUTURE_ALLOC(fun); \
 	PACK(&__d, __f, args); \
-	memcpy(__task->data, &__d, sizeof(__d)); \
+	memcpy(task_data(__task), &__d, sizeof(__d)); \
 	RT_push(__task); \
 	} /* PROFILE */ \
 	__f; \
@@ -180,26 +218,27 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 
 // FUTURE (three arguments) //////////////////////////////////////////////////
 
-#define FUTURE_3_IMPL_3(fun, args, addr) FUTURE_3_CALL(fun, args, addr)
-#define FUTURE_3_CALL(fun, args, addr) \
+#define FUTURE_3_IMPL_3(prio, fun, args, addr) FUTURE_3_CALL(prio, fun, args, addr)
+#define FUTURE_3_CALL(prio, fun, args, addr) \
 	struct future_node *CONCAT(hd_, __LINE__) = alloca(sizeof(struct future_node)); \
-	*CONCAT(hd_, __LINE__) = (struct future_node){ FUTURE_2_CALL(fun, ARGS args), addr, await_##fun, hd }; \
+	*CONCAT(hd_, __LINE__) = (struct future_node){ FUTURE_2_CALL(prio, fun, ARGS args), addr, await_##fun, hd }; \
 	hd = CONCAT(hd_, __LINE__)
 
 // FUTURE (four arguments) ///////////////////////////////////////////////////
 
-#define FUTURE_4_IMPL_3(fun, bounds, args, _) FUTURE_4_IMPL_4(fun, ARGS bounds, ARGS args)
-#define FUTURE_4_IMPL_4(fun, lo, hi, ...) FUTURE_4_CALL(fun, lo, hi, __VA_ARGS__)
-#define FUTURE_4_CALL(fun, lo, hi, args...) \
+#define FUTURE_4_IMPL_3(prio, fun, bounds, args, _) FUTURE_4_IMPL_4(prio, fun, ARGS bounds, ARGS args)
+#define FUTURE_4_IMPL_4(prio, fun, lo, hi, ...) FUTURE_4_CALL(prio, fun, lo, hi, __VA_ARGS__)
+#define FUTURE_4_CALL(prio, fun, lo, hi, args...) \
 ({ \
 	Task *__task; \
 	struct fun##_task_data __d; \
 	future __f; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(sizeof(__d)); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->priority = TASK_PRIORITY(prio); \
 	__task->splittable = true; \
 	__task->start = (lo); \
 	__task->cur = (lo); \
@@ -207,7 +246,7 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 	__task->has_future = true; \
 	__f = FUTURE_ALLOC(fun); \
 	PACK(&__d, __f, args); \
-	memcpy(__task->data, &__d, sizeof(__d)); \
+	memcpy(task_data(__task), &__d, sizeof(__d)); \
 	RT_push(__task); \
 	} /* PROFILE */ \
 	__f; \
@@ -215,26 +254,28 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 
 // FUTURE0 ///////////////////////////////////////////////////////////////////
 
-#define FUTURE0_IMPL(...) FUTURE0_IMPL_2(VA_NARGS(__VA_ARGS__), __VA_ARGS__)
-#define FUTURE0_IMPL_2(n, ...) FUTURE0_IMPL_3(n, __VA_ARGS__)
-#define FUTURE0_IMPL_3(n, ...) FUTURE0_##n##_IMPL_3(__VA_ARGS__)
+#define FUTURE0_IMPL(...) FUTURE0_PRIO_IMPL(0, __VA_ARGS__)
+#define FUTURE0_PRIO_IMPL(prio, ...) FUTURE0_IMPL_2(prio, VA_NARGS(__VA_ARGS__), __VA_ARGS__)
+#define FUTURE0_IMPL_2(prio, n, ...) FUTURE0_IMPL_3(prio, n, __VA_ARGS__)
+#define FUTURE0_IMPL_3(prio, n, ...) FUTURE0_##n##_IMPL_3(prio, __VA_ARGS__)
 
 // FUTURE0 (two arguments) ///////////////////////////////////////////////////
 
-#define FUTURE0_2_IMPL_3(fun, args) FUTURE0_2_CALL(fun)
-#define FUTURE0_2_CALL(fun) \
+#define FUTURE0_2_IMPL_3(prio, fun, args) FUTURE0_2_CALL(prio, fun)
+#define FUTURE0_2_CALL(prio, fun) \
 ({  \
 	Task *__task; \
 	future __f; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(sizeof(future)); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->priority = TASK_PRIORITY(prio); \
 	__task->has_future = true; \
 	\
 	__f = FUTURE_ALLOC(fun); \
-	memcpy(__task->data, &__f, sizeof(__f)); \
+	memcpy(task_data(__task), &__f, sizeof(__f)); \
 	RT_push(__task); \
 	} /* PROFILE */ \
 	__f; \
@@ -242,37 +283,79 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 
 // FUTURE0 (three arguments) /////////////////////////////////////////////////
 
-#define FUTURE0_3_IMPL_3(fun, args, addr) FUTURE0_3_CALL(fun, addr)
-#define FUTURE0_3_CALL(fun, addr) \
+#define FUTURE0_3_IMPL_3(prio, fun, args, addr) FUTURE0_3_CALL(prio, fun, addr)
+#define FUTURE0_3_CALL(prio, fun, addr) \
 	struct future_node *CONCAT(hd_, __LINE__) = alloca(sizeof(struct future_node)); \
-	*CONCAT(hd_, __LINE__) = (struct future_node){ FUTURE0_2_CALL(fun), addr, await_##fun, hd }; \
+	*CONCAT(hd_, __LINE__) = (struct future_node){ FUTURE0_2_CALL(prio, fun), addr, await_##fun, hd }; \
 	hd = CONCAT(hd_, __LINE__)
 
 // FUTURE0 (four arguments) //////////////////////////////////////////////////
 
-#define FUTURE0_4_IMPL_3(fun, bounds, args, _) FUTURE0_4_IMPL_4(fun, ARGS bounds)
-#define FUTURE0_4_IMPL_4(fun, ...) FUTURE0_4_CALL(fun, __VA_ARGS__)
-#define FUTURE0_4_CALL(fun, lo, hi) \
+#define FUTURE0_4_IMPL_3(prio, fun, bounds, args, _) FUTURE0_4_IMPL_4(prio, fun, ARGS bounds)
+#define FUTURE0_4_IMPL_4(prio, fun, ...) FUTURE0_4_CALL(prio, fun, __VA_ARGS__)
+#define FUTURE0_4_CALL(prio, fun, lo, hi) \
 ({ \
 	Task *__task; \
 	future __f; \
 	PROFILE(ENQ_DEQ_TASK) { \
 	\
-	__task = RT_task_alloc(); \
+	__task = RT_task_alloc(sizeof(future)); \
 	__task->parent = get_current_task(); \
 	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->priority = TASK_PRIORITY(prio); \
 	__task->splittable = true; \
 	__task->start = (lo); \
 	__task->cur = (lo); \
 	__task->end = (hi); \
 	__task->has_future = true; \
 	__f = FUTURE_ALLOC(fun); \
-	memcpy(__task->data, &__f, sizeof(__f)); \
+	memcpy(task_data(__task), &__f, sizeof(__f)); \
 	RT_push(__task); \
 	} /* PROFILE */ \
 	__f; \
 })
 
+// SUBMIT ////////////////////////////////////////////////////////////////////
+
+#define SUBMIT_IMPL(pool, fun, args) SUBMIT_IMPL_2(pool, fun, ARGS args)
+#define SUBMIT_IMPL_2(pool, fun, ...) SUBMIT_CALL(pool, fun, __VA_ARGS__)
+#define SUBMIT_CALL(pool, fun, args...) \
+({ \
+	struct tasking_pool *__pool = (pool); \
+	Task *__task; \
+	struct fun##_task_data __d; \
+	future __f; \
+	\
+	__task = RT_inject_alloc(__pool, sizeof(__d)); \
+	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->has_future = true; \
+	\
+	__f = FUTURE_ALLOC(fun); \
+	PACK(&__d, __f, args); \
+	memcpy(task_data(__task), &__d, sizeof(__d)); \
+	RT_inject(__pool, __task); \
+	__f; \
+})
+
+// SUBMIT0 ///////////////////////////////////////////////////////////////////
+
+#define SUBMIT0_IMPL(pool, fun) SUBMIT0_CALL(pool, fun)
+#define SUBMIT0_CALL(pool, fun) \
+({ \
+	struct tasking_pool *__pool = (pool); \
+	Task *__task; \
+	future __f; \
+	\
+	__task = RT_inject_alloc(__pool, sizeof(future)); \
+	__task->fn = (void (*)(void *))fun##_task_func; \
+	__task->has_future = true; \
+	\
+	__f = FUTURE_ALLOC(fun); \
+	memcpy(task_data(__task), &__f, sizeof(__f)); \
+	RT_inject(__pool, __task); \
+	__f; \
+})
+
 // AWAIT /////////////////////////////////////////////////////////////////////
 
 // Returns the result of evaluating future fut
@@ -287,6 +370,18 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 	__tmp; \
 })
 
+// AWAIT_ANY /////////////////////////////////////////////////////////////////
+
+#define AWAIT_ANY_IMPL(futs, n, ty, ptr) AWAIT_ANY_CALL(futs, n, ty, ptr)
+#define AWAIT_ANY_CALL(futs, n, ty, ptr) \
+({ \
+	future *__futs = (futs); \
+	ty *__ptr = (ptr); \
+	int __i = FUTURE_GET_ANY(__futs, n, __ptr, ty); \
+	if (__i >= 0) __futs[__i] = NULL; \
+	__i; \
+})
+
 #if 0
 // Returns the result of evaluating future fut
 // ptr is a pointer that will point to the future's result
@@ -303,41 +398,4 @@ PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
 #define AWAIT_ALL_CALL \
 	for (struct future_node *hd = NULL; hd == NULL || (await_future_nodes(hd), 0);)
 
-#ifdef EXPERIMENTAL
-
-// REDUCE ////////////////////////////////////////////////////////////////////
-
-#ifdef LAZY_FUTURES
-
-#define REDUCE_IMPL(op, var) \
-({ \
-	Task *this = get_current_task(); \
-	while (this->futures != NULL) { \
-		struct future_node *p = this->futures; \
-		this->futures = ((struct future_node *)this->futures)->next; \
-		var op##= AWAIT(p->f, typeof(var)); \
-		free(p->f); /* Allocated on the heap */ \
-		free(p); \
-	} \
-	var; \
-})
-
-#else // Regular, eagerly allocated futures
-
-#define REDUCE_IMPL(op, var) \
-({ \
-	Task *this = get_current_task(); \
-	while (this->futures != NULL) { \
-		struct future_node *p = this->futures; \
-		this->futures = ((struct future_node *)this->futures)->next; \
-		var op##= AWAIT(p->f, typeof(var)); \
-		free(p); \
-	} \
-	var; \
-})
-
-#endif // EXPERIMENTAL
-
-#endif // LAZY_FUTURES
-
 #endif // FUTURE_INTERNAL_H
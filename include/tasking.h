@@ -25,4 +25,95 @@ int tasking_init(int *, char ***);
 int tasking_exit(void);
 int tasking_barrier(void);
 
+// Cancellation //////////////////////////////////////////////////////////////
+
+// Tasks created inside WITH_TOKEN(tok) { ... } carry tok, and pass it on to
+// their children. Once tok is cancelled, tasks that carry it are skipped
+// instead of run, FUTUREs resolve to zero, and ASYNC_FOR loops stop early.
+// Running tasks can check CANCELLED() to return early. A token must outlive
+// the tasks that carry it, so await them (or use TASKING_BARRIER) before it
+// goes out of scope.
+typedef struct tasking_token tasking_token;
+
+// Cancelling the token of the calling task also cancels tok
+void tasking_token_init(tasking_token *tok);
+
+// Can be called from any thread, more than once
+void tasking_cancel(tasking_token *tok);
+
+// Leaving the block with break, goto, or return doesn't restore the token
+#define WITH_TOKEN(tok) \
+	for (tasking_token *__saved = get_current_task()->token, \
+		 *__once = (get_current_task()->token = (tok), NULL); \
+		 __once == NULL; \
+		 __once = (get_current_task()->token = __saved, (tasking_token *)1))
+
+// Has the token of the current task been cancelled?
+#define CANCELLED() task_cancelled(get_current_task())
+
+// Runtime statistics ////////////////////////////////////////////////////////
+
+typedef struct tasking_worker_stats {
+	unsigned int requests_sent;
+	unsigned int requests_handled;
+	unsigned int requests_declined;
+	unsigned int requests_steal_one;
+	unsigned int requests_steal_half;
+	unsigned long tasks_executed;
+	// Tasks that were skipped because their token was cancelled
+	unsigned int tasks_cancelled;
+	unsigned int tasks_sent;
+	unsigned int tasks_split;
+	unsigned int futures_converted;  // Zero without LAZY_FUTURES
+	unsigned int awaits_suspended;   // Zero without FIBERS
+	// Number of times the worker entered the idle state (see BACKOFF), and
+	// how often it blocked instead of resuming after a short spin
+	unsigned int idle_entered;
+	unsigned int idle_blocked;
+	// Time in microseconds spent in the idle state, measured even with NTIME
+	double time_idle_state;
+	// Percentage of steal requests that attempted steal-one/steal-half
+	double steal_one_ratio;
+	double steal_half_ratio;
+	// Time in microseconds, zero if compiled with NTIME
+	double time_run_tasks;
+	double time_send_recv_reqs;
+	double time_send_recv_tasks;
+	double time_enq_deq_tasks;
+	double time_idle;
+	double time_total;
+} tasking_worker_stats;
+
+typedef struct tasking_stats {
+	int num_workers;
+	tasking_worker_stats total;      // Sum over all workers
+	tasking_worker_stats workers[];  // One entry per worker
+} tasking_stats;
+
+// Collects the counters of all workers without stopping them, so values of
+// busy workers may be slightly out of date; exact after TASKING_BARRIER()
+// Only the master thread can take a snapshot
+// Returns NULL on failure; the result must be released with free()
+tasking_stats *tasking_stats_snapshot(void);
+
+// Task pools ////////////////////////////////////////////////////////////////
+
+// A pool is a separate set of workers with its own channels, scheduler
+// state, and statistics. Pools don't share work, so one pool can serve
+// latency-sensitive jobs while another runs batch jobs.
+typedef struct tasking_pool tasking_pool;
+
+// Creates num_workers new worker threads, bound to allowed CPUs according to
+// placement (see TASKING_PLACEMENT, NULL for the default)
+// Returns NULL on failure
+tasking_pool *tasking_pool_create(int num_workers, const char *placement);
+
+// Runs fn(arg) on the master of pool and waits until fn and all tasks it
+// spawned have finished; fn can use ASYNC, FUTURE, TASKING_BARRIER, etc.
+// Jobs submitted to the same pool run one at a time
+int tasking_pool_run(tasking_pool *pool, void (*fn)(void *), void *arg);
+
+// Stops and joins the worker threads of pool
+int tasking_pool_destroy(tasking_pool *pool);
+
 #endif // TASKING_H
@@ -48,6 +48,23 @@ static inline int cpu_count(void)
 	return CPU_COUNT(&cpuset);
 }
 
+// Store the CPUs the calling thread may run on, which respects cgroup
+// cpusets, in ascending order. Returns the number of CPUs stored, at most max.
+static inline int allowed_cpus(int *cpus, int max)
+{
+	cpu_set_t cpuset;
+	int i, n = 0;
+
+	pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+	for (i = 0; i < CPU_SETSIZE && n < max; i++) {
+		if (CPU_ISSET(i, &cpuset))
+			cpus[n++] = i;
+	}
+
+	return n;
+}
+
 static inline void print_thread_affinity(void)
 {
 	cpu_set_t cpuset;
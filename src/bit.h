@@ -1,6 +1,8 @@
 #ifndef BIT_H
 #define BIT_H
 
+#include <stdbool.h>
+
 #define BIT(n)                             (1u << (n))
 
 #define BIT_MASK_32(n)                     ((n) >= 32 ? -1u : BIT(n) - 1)
@@ -123,6 +125,109 @@ static inline unsigned int round_up_power_of_two_2(unsigned int n)
 	return n;
 }
 
+//==========================================================================//
+//                                                                          //
+//    Multi-word bit sets                                                   //
+//                                                                          //
+//    A set of n bits is stored in BITSET_WORDS(n) unsigned longs           //
+//    Functions take the number of words in use, so that a statically       //
+//    sized set needs to be processed only up to its last used word         //
+//                                                                          //
+//==========================================================================//
+
+#define BITSET_WORD_BITS                   (8 * sizeof(unsigned long))
+
+#define BITSET_WORDS(n)                    (((n) + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS)
+
+#define BITSET_WORD(n)                     ((n) / BITSET_WORD_BITS)
+
+#define BITSET_BIT(n)                      (1ul << ((n) % BITSET_WORD_BITS))
+
+static inline void bitset_set(unsigned long *set, unsigned int n)
+{
+	set[BITSET_WORD(n)] |= BITSET_BIT(n);
+}
+
+static inline void bitset_clear(unsigned long *set, unsigned int n)
+{
+	set[BITSET_WORD(n)] &= ~BITSET_BIT(n);
+}
+
+static inline bool bitset_test(const unsigned long *set, unsigned int n)
+{
+	return (set[BITSET_WORD(n)] & BITSET_BIT(n)) != 0;
+}
+
+// Set bits 0 to n-1 and clear all other bits of the first BITSET_WORDS(n) words
+static inline void bitset_fill(unsigned long *set, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n / BITSET_WORD_BITS; i++) {
+		set[i] = ~0ul;
+	}
+
+	if (n % BITSET_WORD_BITS) {
+		set[i] = BITSET_BIT(n) - 1;
+	}
+}
+
+static inline bool bitset_empty(const unsigned long *set, unsigned int words)
+{
+	unsigned int i;
+
+	for (i = 0; i < words; i++) {
+		if (set[i] != 0) return false;
+	}
+
+	return true;
+}
+
+static inline unsigned int bitset_count_one_bits(const unsigned long *set, unsigned int words)
+{
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < words; i++) {
+		count += __builtin_popcountl(set[i]);
+	}
+
+	return count;
+}
+
+static inline int bitset_rightmost_one_bit_pos(const unsigned long *set, unsigned int words)
+{
+	unsigned int i;
+
+	for (i = 0; i < words; i++) {
+		if (set[i] != 0) {
+			return i * BITSET_WORD_BITS + __builtin_ctzl(set[i]);
+		}
+	}
+
+	return -1;
+}
+
+// Position of the k-th one bit (counting from zero, starting at bit 0)
+// Returns -1 if the set has k or fewer one bits
+static inline int bitset_nth_one_bit_pos(const unsigned long *set, unsigned int words, unsigned int k)
+{
+	unsigned int i, n;
+
+	for (i = 0; i < words; i++) {
+		n = __builtin_popcountl(set[i]);
+		if (k < n) {
+			unsigned long word = set[i];
+			// Drop the k rightmost one bits
+			while (k--) word = ZERO_RIGHTMOST_ONE_BIT(word);
+			return i * BITSET_WORD_BITS + __builtin_ctzl(word);
+		}
+		k -= n;
+	}
+
+	return -1;
+}
+
 #ifdef TEST
 #include <assert.h>
 static inline void BIT_H_test(void)
@@ -181,6 +286,35 @@ static inline void BIT_H_test(void)
 	assert((all_ones & BIT_MASK_32(17)) == 0x0001FFFF);
 	assert((all_ones & BIT_MASK_32(25)) == 0x01FFFFFF);
 	assert((all_ones & BIT_MASK_32(32)) == 0xFFFFFFFF);
+
+	unsigned long set[BITSET_WORDS(200)];
+	assert(BITSET_WORDS(200) * BITSET_WORD_BITS >= 200);
+
+	bitset_fill(set, 200);
+	assert(bitset_count_one_bits(set, BITSET_WORDS(200)) == 200);
+	assert(bitset_test(set, 0) && bitset_test(set, 199));
+	assert(bitset_rightmost_one_bit_pos(set, BITSET_WORDS(200)) == 0);
+	assert(bitset_nth_one_bit_pos(set, BITSET_WORDS(200), 150) == 150);
+	assert(bitset_nth_one_bit_pos(set, BITSET_WORDS(200), 200) == -1);
+
+	bitset_fill(set, 130);
+	assert(bitset_count_one_bits(set, BITSET_WORDS(130)) == 130);
+	assert(!bitset_test(set, 130));
+
+	bitset_clear(set, 0);
+	bitset_clear(set, 64);
+	assert(!bitset_test(set, 0) && !bitset_test(set, 64));
+	assert(bitset_count_one_bits(set, BITSET_WORDS(130)) == 128);
+	assert(bitset_rightmost_one_bit_pos(set, BITSET_WORDS(130)) == 1);
+	assert(bitset_nth_one_bit_pos(set, BITSET_WORDS(130), 62) == 63);
+	assert(bitset_nth_one_bit_pos(set, BITSET_WORDS(130), 63) == 65);
+
+	assert(!bitset_empty(set, BITSET_WORDS(130)));
+	set[0] = set[1] = set[2] = 0;
+	assert(bitset_empty(set, BITSET_WORDS(130)));
+	bitset_set(set, 129);
+	assert(bitset_rightmost_one_bit_pos(set, BITSET_WORDS(130)) == 129);
+	assert(bitset_nth_one_bit_pos(set, BITSET_WORDS(130), 0) == 129);
 }
 #endif
 
@@ -17,39 +17,48 @@
 #define pthread_mutex_unlock(x)  ck_spinlock_unlock(x)
 #endif
 
+// Producers, consumers, and read-mostly metadata occupy separate cache lines
+// Aligning to two cache lines keeps the adjacent-line prefetcher from pairing
+// them up again
+#define CHANNEL_ALIGN 128
+
 struct SHM_channel {
-	pthread_mutex_t head_lock, tail_lock;
+	// Read-mostly
 	// The owner that has allocated the channel
 	int owner;
-	// Internal implementation (MPMC, MPSC, or SPSC)
+	// Internal implementation (MPMC, MPSC, SPSC, MPMC_LF, or MPSC_LF)
 	int impl;
 	int closed;
-	// A channel of size n can buffer n-1 items
-	// This allows us to distinguish between an empty channel and a full channel
-	// without needing to calculate (or maintain) the number of items
-	unsigned int size;
+	// Maximum number of buffered items (0 for unbuffered channels)
+	unsigned int capacity;
 	// Up to itemsize bytes can be exchanged over this channel
 	unsigned int itemsize;
+	// The buffer consists of mask+1 slots of slotsize bytes, a power of two
+	// no less than capacity, so that indexing requires no division
+	// Slots of lock-free channels start with a sequence number
+	unsigned int mask;
+	unsigned int slotsize;
+
+	// Consumer side
 	// Items are taken from head and new items are inserted at tail
+	// Both count items and are never wrapped around
+	pthread_mutex_t head_lock __attribute__((aligned(CHANNEL_ALIGN)));
 	unsigned int head;
-	// Separate head and tail by at least one cache line
-	char pad[64];
-	unsigned int tail;
-	// Channel buffer
-	char *buffer;
-};
 
-#define INC(i, s) \
-	(((i) + 1) % (s))
+	// Producer side
+	pthread_mutex_t tail_lock __attribute__((aligned(CHANNEL_ALIGN)));
+	unsigned int tail;
 
-#define DEC(i, s) \
-	(((i) - 1 + (s)) % (s))
+	// Channel buffer, allocated together with the channel
+	char buffer[] __attribute__((aligned(CHANNEL_ALIGN)));
+};
 
+// Only exact if the caller owns (or has locked) the tail
 #define NUM_ITEMS(chan) \
-	(((chan)->size + (chan)->tail - (chan)->head) % ((chan)->size))
+	((chan)->tail - (chan)->head)
 
 #define IS_FULL(chan) \
-	(NUM_ITEMS(chan) == (chan)->size - 1)
+	(NUM_ITEMS(chan) == (chan)->capacity)
 
 #define IS_EMPTY(chan) \
 	((chan)->head == (chan)->tail)
@@ -70,6 +79,25 @@ struct SHM_channel {
 
 #define IS_MULTIPLE(num, n) (((num) & ((n)-1)) == 0x0)
 
+#define IS_VALID_IMPL(impl) \
+	((impl) == MPMC || (impl) == MPSC || (impl) == SPSC || \
+	 (impl) == MPMC_LF || (impl) == MPSC_LF)
+
+#define IS_LOCKFREE(chan) \
+	((chan)->impl == MPMC_LF || (chan)->impl == MPSC_LF)
+
+// Slot of the i-th item
+#define SLOT(chan, i) \
+	((chan)->buffer + ((i) & (chan)->mask) * (chan)->slotsize)
+
+// Special macros for lock-free channels
+
+#define SLOT_SEQ(slot) \
+	((unsigned int *)(slot))
+
+#define SLOT_ITEM(slot) \
+	((slot) + sizeof(unsigned int))
+
 #ifdef CHANNEL_CACHE
 // The maximum number of channels of a certain type that can be cached
 #define CHANNEL_CACHE_CAPACITY CHANNEL_CACHE
@@ -95,9 +123,9 @@ bool channel_cache_alloc(unsigned int size, unsigned int n, int impl)
 {
 	struct channel_cache *p;
 
-	if (impl != MPMC && impl != MPSC && impl != SPSC) {
+	if (!IS_VALID_IMPL(impl)) {
 		fprintf(stderr, "Warning: Requested invalid channel implementation\n");
-		fprintf(stderr, "Must be either MPMC, MPSC, or SPSC\n");
+		fprintf(stderr, "Must be either MPMC, MPSC, SPSC, MPMC_LF, or MPSC_LF\n");
 		return false;
 	}
 
@@ -136,8 +164,6 @@ void channel_cache_free(void)
 		q = p->next;
 		for (i = 0; i < p->num_cached; i++) {
 			Channel *chan = p->cache[i];
-			if (chan->buffer)
-				free(chan->buffer);
 			pthread_mutex_destroy(&chan->head_lock);
 			pthread_mutex_destroy(&chan->tail_lock);
 			free(chan);
@@ -154,14 +180,15 @@ void channel_cache_free(void)
 Channel *channel_alloc(unsigned int size, unsigned int n, int impl)
 {
 	Channel *chan;
-	unsigned int bufsize;
+	unsigned int bufsize, slots, slotsize, i;
+	void *mem;
 #ifdef CHANNEL_CACHE
 	struct channel_cache *p;
 #endif
 
-	if (impl != MPMC && impl != MPSC && impl != SPSC) {
+	if (!IS_VALID_IMPL(impl)) {
 		fprintf(stderr, "Warning: Requested invalid channel implementation\n");
-		fprintf(stderr, "Must be either MPMC, MPSC, or SPSC\n");
+		fprintf(stderr, "Must be either MPMC, MPSC, SPSC, MPMC_LF, or MPSC_LF\n");
 		return NULL;
 	}
 
@@ -181,21 +208,27 @@ Channel *channel_alloc(unsigned int size, unsigned int n, int impl)
 	}
 #endif
 
-	chan = (Channel *)malloc(sizeof(Channel));
-	if (!chan) {
-		fprintf(stderr, "Warning: malloc failed\n");
-		return NULL;
+	// Round up to a power of two
+	// Unbuffered channels need space for one item
+	for (slots = 1; slots < n; slots <<= 1) ;
+
+	if ((impl == MPMC_LF || impl == MPSC_LF) && n > 0) {
+		// Keep sequence numbers aligned
+		slotsize = (sizeof(unsigned int) + size + sizeof(unsigned long) - 1)
+			& ~(sizeof(unsigned long) - 1);
+	} else {
+		slotsize = size;
 	}
 
-	// To buffer n items, we must allocate space for n + 1
-	bufsize = (n + 1) * size;
-	chan->buffer = (char *)malloc(bufsize);
-	if (!chan->buffer) {
-		fprintf(stderr, "Warning: malloc failed\n");
-		free(chan);
+	bufsize = slots * slotsize;
+
+	if (posix_memalign(&mem, CHANNEL_ALIGN, sizeof(Channel) + bufsize) != 0) {
+		fprintf(stderr, "Warning: posix_memalign failed\n");
 		return NULL;
 	}
 
+	chan = (Channel *)mem;
+
 	pthread_mutex_init(&chan->head_lock, NULL);
 	pthread_mutex_init(&chan->tail_lock, NULL);
 
@@ -203,11 +236,20 @@ Channel *channel_alloc(unsigned int size, unsigned int n, int impl)
 	chan->owner = -1;
 	chan->impl = impl;
 	chan->closed = 0;
-	chan->size = n + 1;
+	chan->capacity = n;
 	chan->itemsize = size;
+	chan->mask = slots - 1;
+	chan->slotsize = slotsize;
 	chan->head = 0;
 	chan->tail = 0;
 
+	// Slot i is ready to receive the i-th item
+	if (IS_LOCKFREE(chan) && n > 0) {
+		for (i = 0; i < slots; i++) {
+			*SLOT_SEQ(SLOT(chan, i)) = i;
+		}
+	}
+
 #ifdef CHANNEL_CACHE
 	// In addition to allocating the channel, try to allocate a cache
 	channel_cache_alloc(size, n, impl);
@@ -233,7 +275,7 @@ void channel_free(Channel *chan)
 #ifdef CHANNEL_CACHE
 	for (p = channel_cache; p != NULL; p = p->next) {
 		if (chan->itemsize == p->chan_size &&
-			chan->size-1 == p->chan_n &&
+			chan->capacity == p->chan_n &&
 			chan->impl == p->chan_impl) {
 			// Check if free list has space left
 			if (p->num_cached < CHANNEL_CACHE_CAPACITY) {
@@ -247,9 +289,6 @@ void channel_free(Channel *chan)
 	}
 #endif
 
-	if (chan->buffer)
-		free(chan->buffer);
-
 	pthread_mutex_destroy(&chan->head_lock);
 	pthread_mutex_destroy(&chan->tail_lock);
 
@@ -307,9 +346,9 @@ static bool channel_send_mpmc(Channel *chan, void *data, unsigned int size)
 
 	assert(!IS_FULL(chan));
 	assert(size <= chan->itemsize);
-	memcpy(chan->buffer + chan->tail * chan->itemsize, data, size);
+	memcpy(SLOT(chan, chan->tail), data, size);
 
-	chan->tail = INC(chan->tail, chan->size);
+	chan->tail++;
 
 	pthread_mutex_unlock(&chan->tail_lock);
 
@@ -361,9 +400,9 @@ static bool channel_recv_mpmc(Channel *chan, void *data, unsigned int size)
 
 	assert(!IS_EMPTY(chan));
 	assert(size <= chan->itemsize);
-	memcpy(data, chan->buffer + chan->head * chan->itemsize, size);
+	memcpy(data, SLOT(chan, chan->head), size);
 
-	chan->head = INC(chan->head, chan->size);
+	chan->head++;
 
 	pthread_mutex_unlock(&chan->head_lock);
 
@@ -440,9 +479,9 @@ static bool channel_recv_mpsc(Channel *chan, void *data, unsigned int size)
 
 	assert(!IS_EMPTY(chan));
 	assert(size <= chan->itemsize);
-	memcpy(data, chan->buffer + chan->head * chan->itemsize, size);
+	memcpy(data, SLOT(chan, chan->head), size);
 
-	newhead = INC(chan->head, chan->size);
+	newhead = chan->head + 1;
 	__memory_barrier(); // Compiler + memory barrier
 	chan->head = newhead;
 
@@ -514,9 +553,9 @@ static bool channel_send_spsc(Channel *chan, void *data, unsigned int size)
 
 	assert(!IS_FULL(chan));
 	assert(size <= chan->itemsize);
-	memcpy(chan->buffer + chan->tail * chan->itemsize, data, size);
+	memcpy(SLOT(chan, chan->tail), data, size);
 
-	newtail = INC(chan->tail, chan->size);
+	newtail = chan->tail + 1;
 	__memory_barrier(); // Compiler + memory barrier
 	chan->tail = newtail;
 
@@ -558,38 +597,164 @@ static bool channel_recv_spsc(Channel *chan, void *data, unsigned int size)
 	return channel_recv_mpsc(chan, data, size);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+//	Lock-free MPMC and MPSC implementation
+//
+//	Bounded ring after Dmitry Vyukov: the sequence number of a slot tells
+//	whether the slot is ready to receive the i-th item (seq == i) or holds
+//	the i-th item (seq == i + 1). Producers (and consumers in the MPMC case)
+//	claim a slot by incrementing tail (head) with a CAS, copy the item, and
+//	publish the slot by updating its sequence number.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+static bool channel_send_lf(Channel *chan, void *data, unsigned int size)
+{
+	assert(chan != NULL);
+	assert(data != NULL);
+
+	unsigned int pos, seq;
+	char *slot;
+
+	if (channel_unbuffered(chan))
+		return channel_send_unbuffered_mpmc(chan, data, size);
+
+	pos = __atomic_load_n(&chan->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		slot = SLOT(chan, pos);
+		seq = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			// Slot is free, but the channel may be full if its capacity is
+			// not a power of two
+			if (chan->capacity != chan->mask+1 &&
+				pos - __atomic_load_n(&chan->head, __ATOMIC_ACQUIRE) >= chan->capacity)
+				return false;
+			if (__atomic_compare_exchange_n(&chan->tail, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			// pos has been updated, try again
+		} else if ((int)(seq - pos) < 0) {
+			// Slot still holds an item from the previous round
+			return false;
+		} else {
+			// Someone was faster
+			pos = __atomic_load_n(&chan->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	assert(size <= chan->itemsize);
+	memcpy(SLOT_ITEM(slot), data, size);
+
+	__atomic_store_n(SLOT_SEQ(slot), pos + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool channel_recv_mpmc_lf(Channel *chan, void *data, unsigned int size)
+{
+	assert(chan != NULL);
+	assert(data != NULL);
+
+	unsigned int pos, seq;
+	char *slot;
+
+	if (channel_unbuffered(chan))
+		return channel_recv_unbuffered_mpmc(chan, data, size);
+
+	pos = __atomic_load_n(&chan->head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		slot = SLOT(chan, pos);
+		seq = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+		if (seq == pos + 1) {
+			if (__atomic_compare_exchange_n(&chan->head, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			// pos has been updated, try again
+		} else if ((int)(seq - (pos + 1)) < 0) {
+			// Slot has not been filled yet
+			return false;
+		} else {
+			// Someone was faster
+			pos = __atomic_load_n(&chan->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	assert(size <= chan->itemsize);
+	memcpy(data, SLOT_ITEM(slot), size);
+
+	// Ready for the item one round later
+	__atomic_store_n(SLOT_SEQ(slot), pos + chan->mask + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool channel_recv_mpsc_lf(Channel *chan, void *data, unsigned int size)
+{
+	assert(chan != NULL);
+	assert(data != NULL);
+
+	unsigned int pos = chan->head;
+	char *slot;
+
+	if (channel_unbuffered(chan))
+		return channel_recv_unbuffered_mpsc(chan, data, size);
+
+	slot = SLOT(chan, pos);
+	if (__atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE) != pos + 1)
+		return false;
+
+	assert(size <= chan->itemsize);
+	memcpy(data, SLOT_ITEM(slot), size);
+
+	__atomic_store_n(&chan->head, pos + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(SLOT_SEQ(slot), pos + chan->mask + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
 typedef bool (*channel_send_fn)(Channel *, void *, unsigned int);
 typedef bool (*channel_recv_fn)(Channel *, void *, unsigned int);
 typedef bool (*channel_close_fn)(Channel *);
 typedef bool (*channel_open_fn)(Channel *);
 
 // Function tables
-static channel_send_fn send_fn[3] =
+static channel_send_fn send_fn[5] =
 {
 	channel_send_mpmc,
 	channel_send_mpsc,
-	channel_send_spsc
+	channel_send_spsc,
+	channel_send_lf,
+	channel_send_lf
 };
 
-static channel_recv_fn recv_fn[3] =
+static channel_recv_fn recv_fn[5] =
 {
 	channel_recv_mpmc,
 	channel_recv_mpsc,
-	channel_recv_spsc
+	channel_recv_spsc,
+	channel_recv_mpmc_lf,
+	channel_recv_mpsc_lf
 };
 
-static channel_close_fn close_fn[3] =
+static channel_close_fn close_fn[5] =
 {
 	channel_close_mpmc,
 	channel_close_mpsc,
-	channel_close_spsc
+	channel_close_spsc,
+	channel_close_mpmc,
+	channel_close_mpsc
 };
 
-static channel_open_fn open_fn[3] =
+static channel_open_fn open_fn[5] =
 {
 	channel_open_mpmc,
 	channel_open_mpsc,
-	channel_open_spsc
+	channel_open_spsc,
+	channel_open_mpmc,
+	channel_open_mpsc
 };
 
 // Send an item to the channel
@@ -628,20 +793,27 @@ int channel_owner(Channel *chan)
 
 unsigned int channel_peek(Channel *chan)
 {
+	unsigned int head, tail;
+
 	if (channel_unbuffered(chan))
 		return NUM_ITEMS_UNBUF(chan);
 
-	return NUM_ITEMS(chan);
+	// Load head before tail so that head <= tail
+	// Lock-free channels also count items that are being sent or received
+	head = __atomic_load_n(&chan->head, __ATOMIC_ACQUIRE);
+	tail = __atomic_load_n(&chan->tail, __ATOMIC_ACQUIRE);
+
+	return tail - head < chan->capacity ? tail - head : chan->capacity;
 }
 
 unsigned int channel_capacity(Channel *chan)
 {
-	return chan->size-1;
+	return chan->capacity;
 }
 
 bool channel_buffered(Channel *chan)
 {
-	return chan->size-1 > 0;
+	return chan->capacity > 0;
 }
 
 int channel_impl(Channel *chan)
@@ -657,9 +829,9 @@ void channel_inspect(Channel *chan)
 		return;
 
 	printf("[ ");
-	for (i = chan->head, j = 0; i != chan->tail; i = INC(i, chan->size), j++)
+	for (j = 0; j < channel_peek(chan); j++)
 		printf("X ");
-	for (i = 0; i < chan->size - j; i++)
+	for (i = 0; i < chan->capacity - j; i++)
 		printf("  ");
 	printf("]\n");
 	fflush(stdout);
@@ -676,6 +848,8 @@ bool channel_closed(Channel *chan)
 
 //==========================================================================//
 
+#include <sched.h>
+#include <stddef.h>
 #include "utest.h"
 
 #define MASTER 		WORKER(0)
@@ -747,7 +921,7 @@ static void test_Channel(void)
 	Channel *chan;
 
 	// Test all channel implementations
-	for (I = MPMC; I <= SPSC; I++) {
+	for (I = MPMC; I <= MPSC_LF; I++) {
 
 	for (i = 0; i < 2; i++) {
 		switch (i) {
@@ -833,7 +1007,7 @@ static void test_Channel_close(void)
 	Channel *chan;
 
 	// Test all channel implementations
-	for (I = MPMC; I <= SPSC; I++) {
+	for (I = MPMC; I <= MPSC_LF; I++) {
 
 	for (i = 0; i < 2; i++) {
 		switch (i) {
@@ -874,6 +1048,133 @@ static void test_Channel_close(void)
 	} // Test all channel implementations
 }
 
+// Producer and consumer side do not share cache lines with each other or with
+// the read-mostly part
+static void test_Channel_layout(void)
+{
+	Channel *chan = channel_alloc(sizeof(int), 5, MPSC_LF);
+
+	check_equal(offsetof(Channel, head) / CHANNEL_ALIGN != offsetof(Channel, capacity) / CHANNEL_ALIGN, true);
+	check_equal(offsetof(Channel, tail) / CHANNEL_ALIGN != offsetof(Channel, head) / CHANNEL_ALIGN, true);
+	check_equal(offsetof(Channel, buffer) / CHANNEL_ALIGN != offsetof(Channel, tail) / CHANNEL_ALIGN, true);
+	check_equal((unsigned long)chan % CHANNEL_ALIGN, 0);
+	check_equal((unsigned long)chan->buffer % CHANNEL_ALIGN, 0);
+
+	channel_free(chan);
+}
+
+// Capacity is exact, even if the buffer is rounded up to a power of two
+static void test_Channel_capacity(void)
+{
+	int I, i, j, val;
+
+	for (I = MPMC; I <= MPSC_LF; I++) {
+		Channel *chan = channel_alloc(sizeof(int), 5, I);
+		check_equal(channel_capacity(chan), 5);
+
+		// Wrap around several times
+		for (j = 0; j < 7; j++) {
+			for (i = 0; i < 5; i++) {
+				val = j * 5 + i;
+				check_equal((channel_send)(chan, &val, sizeof(val)), true);
+				check_equal(channel_peek(chan), (unsigned int)i + 1);
+			}
+			check_equal((channel_send)(chan, &val, sizeof(val)), false);
+			for (i = 0; i < 5; i++) {
+				check_equal((channel_receive)(chan, &val, sizeof(val)), true);
+				check_equal(val, j * 5 + i);
+			}
+			check_equal((channel_receive)(chan, &val, sizeof(val)), false);
+			check_equal(channel_peek(chan), 0);
+		}
+
+		channel_free(chan);
+	}
+}
+
+#undef channel_send
+
+// Yield to make progress when threads outnumber cores
+#define channel_send(c, d, s) \
+{ \
+	while (!channel_send(c, d, s)) sched_yield(); \
+}
+
+#define channel_receive(c, d, s) \
+{ \
+	while (!channel_receive(c, d, s)) sched_yield(); \
+}
+
+#define NUM_PRODUCERS 4
+#define NUM_ITEMS_PER_PRODUCER 20000
+
+struct mp_args { int ID; Channel *chan; int num_consumers; long sum; };
+
+static void *thread_func_3(void *args)
+{
+	struct mp_args *A = (struct mp_args *)args;
+	int val, j;
+
+	if (A->ID < NUM_PRODUCERS) {
+		for (j = 0; j < NUM_ITEMS_PER_PRODUCER; j++) {
+			val = A->ID * NUM_ITEMS_PER_PRODUCER + j;
+			channel_send(A->chan, &val, sizeof(val));
+		}
+	} else {
+		// Consumers share the items evenly
+		for (j = 0; j < NUM_PRODUCERS * NUM_ITEMS_PER_PRODUCER / A->num_consumers; j++) {
+			channel_receive(A->chan, &val, sizeof(val));
+			A->sum += val;
+		}
+	}
+
+	return NULL;
+}
+
+// Multiple producers (and consumers) hammer on a small channel
+static void test_Channel_contention(void)
+{
+	int impls[2] = { MPMC_LF, MPSC_LF };
+	int I, i;
+
+	for (I = 0; I < 2; I++) {
+		int num_consumers = impls[I] == MPMC_LF ? 2 : 1;
+		int num_threads = NUM_PRODUCERS + num_consumers;
+		long n = NUM_PRODUCERS * NUM_ITEMS_PER_PRODUCER, sum = 0;
+		pthread_t threads[NUM_PRODUCERS + 2];
+		struct mp_args args[NUM_PRODUCERS + 2];
+
+		// Capacity is not a power of two
+		Channel *chan = channel_alloc(sizeof(int), 5, impls[I]);
+		check_equal(channel_capacity(chan), 5);
+
+		for (i = 0; i < num_threads; i++) {
+			args[i] = (struct mp_args){ i, chan, num_consumers, 0 };
+			pthread_create(&threads[i], NULL, thread_func_3, &args[i]);
+		}
+
+		for (i = 0; i < num_threads; i++) {
+			pthread_join(threads[i], NULL);
+			sum += args[i].sum;
+		}
+
+		// Every item has been received exactly once
+		check_equal(sum, n * (n - 1) / 2);
+		check_equal(channel_peek(chan), 0);
+
+		// Capacity is exact
+		for (i = 0; i < 5; i++) {
+			check_equal((channel_send)(chan, &i, sizeof(i)), true);
+		}
+		check_equal((channel_send)(chan, &i, sizeof(i)), false);
+		check_equal(channel_peek(chan), 5);
+
+		channel_free(chan);
+	}
+}
+
+#undef channel_receive
+
 #ifdef CHANNEL_CACHE
 static bool check_if_cached(Channel *chan)
 {
@@ -883,7 +1184,7 @@ static bool check_if_cached(Channel *chan)
 
 	for (p = channel_cache; p != NULL; p = p->next) {
 		if (chan->itemsize == p->chan_size &&
-			chan->size-1 == p->chan_n &&
+			chan->capacity == p->chan_n &&
 			chan->impl == p->chan_impl) {
 			int i;
 			for (i = 0; i < p->num_cached; i++) {
@@ -1005,6 +1306,9 @@ int main(void)
 #ifndef CHANNEL_CACHE
 	test_Channel();
 	test_Channel_close();
+	test_Channel_layout();
+	test_Channel_capacity();
+	test_Channel_contention();
 #else
 	test_Channel_cache();
 #endif
@@ -17,7 +17,11 @@ enum {
 enum {
 	MPMC, // multiple producer, multiple consumer
 	MPSC, // multiple producer, single consumer
-	SPSC  // single producer, single consumer
+	SPSC, // single producer, single consumer
+	// Lock-free implementations based on a ring of sequence-numbered slots
+	// Unbuffered channels fall back to MPMC and MPSC, respectively
+	MPMC_LF,
+	MPSC_LF
 };
 
 /*****************************************************************************
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "affinity.h"
+#include "channel.h"
+#include "wtime.h"
+
+// Several producer/consumer pairs, each of which communicates over its own
+// channel. Channels are allocated back to back, and the two threads of a pair
+// run on different cores. Ideally, throughput scales with the number of pairs;
+// false sharing between producer and consumer, or between neighboring
+// channels, shows up as a drop in per-pair throughput.
+//
+// Usage: throughput_pairs [num_pairs] [impl]
+// impl is one of MPMC, MPSC, SPSC (default), MPMC_LF, MPSC_LF
+
+#define MAX_PAIRS 64
+#define N 1000000
+
+static pthread_barrier_t barrier;
+static Channel *chans[MAX_PAIRS];
+static double throughput[MAX_PAIRS];
+static int num_pairs = 2, num_cpus;
+typedef struct data { int d[8]; } Data;
+
+static void *thread_func(void *args)
+{
+	int ID = *(int *)args, i;
+	Channel *chan = chans[ID / 2];
+	double start, end;
+
+	set_thread_affinity(ID % num_cpus);
+	pthread_barrier_wait(&barrier);
+
+	if (ID % 2 == 0) {
+		// Produce
+		for (i = 0; i < N; i++) {
+			Data d = { .d[0] = i };
+			while (!channel_send(chan, &d, sizeof(d))) pthread_yield();
+		}
+	} else {
+		// Consume
+		start = Wtime_msec();
+		for (i = 0; i < N; i++) {
+			Data d;
+			while (!channel_receive(chan, &d, sizeof(d))) pthread_yield();
+			assert(d.d[0] == i);
+		}
+		end = Wtime_msec();
+		throughput[ID / 2] = N / (end - start);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[2 * MAX_PAIRS];
+	int IDs[2 * MAX_PAIRS], impl = SPSC, i;
+	const char *impls[] = { "MPMC", "MPSC", "SPSC", "MPMC_LF", "MPSC_LF" };
+	double total = 0;
+
+	if (argc > 1) {
+		num_pairs = abs(atoi(argv[1]));
+		if (num_pairs < 1) num_pairs = 1;
+		if (num_pairs > MAX_PAIRS) num_pairs = MAX_PAIRS;
+	}
+
+	if (argc > 2) {
+		for (impl = MPMC; impl <= MPSC_LF; impl++) {
+			if (strcmp(argv[2], impls[impl]) == 0) break;
+		}
+		if (impl > MPSC_LF) {
+			fprintf(stderr, "Warning: unknown channel implementation %s\n", argv[2]);
+			impl = SPSC;
+		}
+	}
+
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_barrier_init(&barrier, NULL, 2 * num_pairs);
+
+	for (i = 0; i < num_pairs; i++) {
+		chans[i] = channel_alloc(sizeof(Data), 100, impl);
+	}
+
+	for (i = 0; i < 2 * num_pairs; i++) {
+		IDs[i] = i;
+		pthread_create(&threads[i], NULL, thread_func, &IDs[i]);
+	}
+
+	for (i = 0; i < 2 * num_pairs; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < num_pairs; i++) {
+		printf("Pair %d (CPUs %d, %d): %.2lf\n", i, (2*i) % num_cpus, (2*i+1) % num_cpus,
+				throughput[i]);
+		total += throughput[i];
+	}
+
+	printf("%s, %d pairs: total throughput %.2lf, per pair %.2lf\n",
+			impls[impl], num_pairs, total, total / num_pairs);
+
+	pthread_barrier_destroy(&barrier);
+
+	for (i = 0; i < num_pairs; i++) {
+		channel_free(chans[i]);
+	}
+
+	return 0;
+}
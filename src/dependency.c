@@ -0,0 +1,406 @@
+// gcc -Wall -Wextra -DTEST dependency.c -o dependency && ./dependency
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "dependency.h"
+
+// Successor of a task
+struct dep_edge {
+	struct dep_node *node;
+	struct dep_edge *next;
+};
+
+// Marks the list of successors of a task that has finished
+#define DEP_DONE ((struct dep_edge *)1)
+
+struct dep_entry {
+	void *addr;
+	// Last task that writes addr
+	struct dep_node *writer;
+	// Tasks that read addr since
+	struct dep_node **readers;
+	unsigned int num_readers, max_readers;
+};
+
+// Hash table with open addressing and linear probing
+struct dep_map {
+	// Power of two
+	unsigned int capacity;
+	unsigned int count;
+	struct dep_entry *entries;
+};
+
+struct dep_node {
+	Task *task;
+	// Number of predecessors that have yet to finish, plus one while the task
+	// is being registered
+	int pending;
+	// Number of references from dependency maps, plus one until the task has
+	// finished
+	int refs;
+	// Successors, DEP_DONE once the task has finished
+	struct dep_edge *succs;
+	// Dependency map of the children, NULL until the first child with
+	// dependencies is created
+	struct dep_map *map;
+};
+
+#define DEP_MAP_CAPACITY 64
+
+static struct dep_node *dep_node_new(Task *task)
+{
+	struct dep_node *node = (struct dep_node *)malloc(sizeof(struct dep_node));
+	if (!node) {
+		fprintf(stderr, "Warning: dep_node_new failed\n");
+		exit(1);
+	}
+
+	node->task = task;
+	node->pending = 0;
+	node->refs = 1;
+	node->succs = NULL;
+	node->map = NULL;
+
+	return node;
+}
+
+static inline void dep_node_ref(struct dep_node *node)
+{
+	__atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+}
+
+static inline void dep_node_unref(struct dep_node *node)
+{
+	if (__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		assert(node->map == NULL);
+		free(node);
+	}
+}
+
+static inline bool dep_node_done(struct dep_node *node)
+{
+	return __atomic_load_n(&node->succs, __ATOMIC_ACQUIRE) == DEP_DONE;
+}
+
+// succ depends on pred, unless pred has already finished
+static void dep_edge_add(struct dep_node *pred, struct dep_node *succ)
+{
+	struct dep_edge *edge, *head;
+
+	// A task that accesses the same address more than once
+	if (pred == succ)
+		return;
+
+	head = __atomic_load_n(&pred->succs, __ATOMIC_ACQUIRE);
+	if (head == DEP_DONE)
+		return;
+
+	edge = (struct dep_edge *)malloc(sizeof(struct dep_edge));
+	if (!edge) {
+		fprintf(stderr, "Warning: dep_edge_add failed\n");
+		exit(1);
+	}
+
+	edge->node = succ;
+	// Can't drop to zero while succ is being registered
+	__atomic_add_fetch(&succ->pending, 1, __ATOMIC_SEQ_CST);
+
+	do {
+		if (head == DEP_DONE) {
+			// pred has finished in the meantime
+			__atomic_sub_fetch(&succ->pending, 1, __ATOMIC_SEQ_CST);
+			free(edge);
+			return;
+		}
+		edge->next = head;
+	} while (!__atomic_compare_exchange_n(&pred->succs, &head, edge, true,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+static struct dep_map *dep_map_new(unsigned int capacity)
+{
+	struct dep_map *map = (struct dep_map *)malloc(sizeof(struct dep_map));
+	if (!map) {
+		fprintf(stderr, "Warning: dep_map_new failed\n");
+		exit(1);
+	}
+
+	assert((capacity & (capacity - 1)) == 0);
+
+	map->capacity = capacity;
+	map->count = 0;
+	map->entries = (struct dep_entry *)calloc(capacity, sizeof(struct dep_entry));
+	if (!map->entries) {
+		fprintf(stderr, "Warning: dep_map_new failed\n");
+		exit(1);
+	}
+
+	return map;
+}
+
+static void dep_map_free(struct dep_map *map)
+{
+	struct dep_entry *e;
+	unsigned int i, j;
+
+	for (i = 0; i < map->capacity; i++) {
+		e = &map->entries[i];
+		if (!e->addr) continue;
+		if (e->writer) dep_node_unref(e->writer);
+		for (j = 0; j < e->num_readers; j++) {
+			dep_node_unref(e->readers[j]);
+		}
+		free(e->readers);
+	}
+
+	free(map->entries);
+	free(map);
+}
+
+static inline unsigned int dep_hash(void *addr)
+{
+	// Fibonacci hashing
+	return (unsigned int)(((unsigned long long)(unsigned long)addr * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static struct dep_entry *dep_map_lookup(struct dep_map *map, void *addr)
+{
+	unsigned int i = dep_hash(addr) & (map->capacity - 1);
+
+	while (map->entries[i].addr && map->entries[i].addr != addr) {
+		i = (i + 1) & (map->capacity - 1);
+	}
+
+	return &map->entries[i];
+}
+
+// Doubles the capacity of map
+static void dep_map_grow(struct dep_map *map)
+{
+	struct dep_entry *entries = map->entries;
+	unsigned int capacity = map->capacity, i;
+
+	map->capacity *= 2;
+	map->entries = (struct dep_entry *)calloc(map->capacity, sizeof(struct dep_entry));
+	if (!map->entries) {
+		fprintf(stderr, "Warning: dep_map_grow failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < capacity; i++) {
+		if (entries[i].addr)
+			*dep_map_lookup(map, entries[i].addr) = entries[i];
+	}
+
+	free(entries);
+}
+
+// Returns the entry of addr, adds a new entry if there is none
+static struct dep_entry *dep_map_entry(struct dep_map *map, void *addr)
+{
+	struct dep_entry *e;
+
+	assert(addr != NULL);
+
+	e = dep_map_lookup(map, addr);
+	if (e->addr)
+		return e;
+
+	// At most half full
+	if (2 * (map->count + 1) > map->capacity) {
+		dep_map_grow(map);
+		e = dep_map_lookup(map, addr);
+	}
+
+	e->addr = addr;
+	map->count++;
+
+	return e;
+}
+
+static void dep_entry_add_reader(struct dep_entry *e, struct dep_node *node)
+{
+	unsigned int i, n = 0;
+
+	// Drop readers that have finished
+	for (i = 0; i < e->num_readers; i++) {
+		if (dep_node_done(e->readers[i])) {
+			dep_node_unref(e->readers[i]);
+		} else {
+			e->readers[n++] = e->readers[i];
+		}
+	}
+	e->num_readers = n;
+
+	if (e->num_readers == e->max_readers) {
+		e->max_readers = e->max_readers ? 2 * e->max_readers : 4;
+		e->readers = (struct dep_node **)realloc(e->readers,
+				e->max_readers * sizeof(struct dep_node *));
+		if (!e->readers) {
+			fprintf(stderr, "Warning: dep_entry_add_reader failed\n");
+			exit(1);
+		}
+	}
+
+	dep_node_ref(node);
+	e->readers[e->num_readers++] = node;
+}
+
+bool dep_register(Task *task, const struct dep *deps, int n)
+{
+	Task *parent = task->parent;
+	struct dep_node *node;
+	struct dep_map *map;
+	struct dep_entry *e;
+	unsigned int j;
+	int i;
+
+	assert(parent != NULL && !parent->splittable);
+	assert(!task->splittable && task->deps == NULL);
+
+	if (!parent->deps)
+		parent->deps = dep_node_new(parent);
+
+	if (!parent->deps->map)
+		parent->deps->map = dep_map_new(DEP_MAP_CAPACITY);
+
+	map = parent->deps->map;
+	node = dep_node_new(task);
+	node->pending = 1;
+	task->deps = node;
+
+	for (i = 0; i < n; i++) {
+		e = dep_map_entry(map, deps[i].addr);
+		if (e->writer && dep_node_done(e->writer)) {
+			dep_node_unref(e->writer);
+			e->writer = NULL;
+		}
+		if (deps[i].mode == DEP_MODE_IN) {
+			// Read after write
+			if (e->writer) dep_edge_add(e->writer, node);
+			dep_entry_add_reader(e, node);
+		} else {
+			if (e->num_readers > 0) {
+				// Write after read, readers depend on the last writer
+				for (j = 0; j < e->num_readers; j++) {
+					dep_edge_add(e->readers[j], node);
+					dep_node_unref(e->readers[j]);
+				}
+				e->num_readers = 0;
+			} else if (e->writer) {
+				// Write after write
+				dep_edge_add(e->writer, node);
+			}
+			dep_node_ref(node);
+			if (e->writer) dep_node_unref(e->writer);
+			e->writer = node;
+		}
+	}
+
+	return __atomic_sub_fetch(&node->pending, 1, __ATOMIC_SEQ_CST) == 0;
+}
+
+Task *dep_release(Task *task)
+{
+	struct dep_node *node = task->deps;
+	struct dep_edge *edge, *next;
+	Task *ready = NULL;
+
+	assert(node != NULL && node->task == task);
+
+	edge = __atomic_exchange_n(&node->succs, DEP_DONE, __ATOMIC_ACQ_REL);
+	assert(edge != DEP_DONE);
+
+	for (; edge != NULL; edge = next) {
+		next = edge->next;
+		if (__atomic_sub_fetch(&edge->node->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+			edge->node->task->next = ready;
+			ready = edge->node->task;
+		}
+		free(edge);
+	}
+
+	if (node->map) {
+		dep_map_free(node->map);
+		node->map = NULL;
+	}
+
+	task->deps = NULL;
+	dep_node_unref(node);
+
+	return ready;
+}
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include "utest.h"
+
+// Number of tasks in list
+static int count_ready(Task *list)
+{
+	int n = 0;
+
+	for (; list != NULL; list = list->next) n++;
+
+	return n;
+}
+
+int main(void)
+{
+	UTEST_INIT;
+
+	Task *parent = task_new(), *t[8];
+	long x, y, z, v[100];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		t[i] = task_new();
+		t[i]->parent = parent;
+	}
+
+	// t0 writes x, t1 and t2 read x, t3 writes x, t4 is independent
+	check_equal(dep_register(t[0], (struct dep []){ { &x, DEP_MODE_OUT } }, 1), true);
+	check_equal(dep_register(t[1], (struct dep []){ { &x, DEP_MODE_IN } }, 1), false);
+	check_equal(dep_register(t[2], (struct dep []){ { &x, DEP_MODE_IN }, { &y, DEP_MODE_IN } }, 2), false);
+	check_equal(dep_register(t[3], (struct dep []){ { &x, DEP_MODE_INOUT } }, 1), false);
+	check_equal(dep_register(t[4], (struct dep []){ { &y, DEP_MODE_IN }, { &z, DEP_MODE_OUT } }, 2), true);
+	// Reads and writes the same address
+	check_equal(dep_register(t[5], (struct dep []){ { &z, DEP_MODE_IN }, { &z, DEP_MODE_INOUT } }, 2), false);
+
+	check_equal(count_ready(dep_release(t[0])), 2);
+	check_equal(dep_release(t[1]), NULL);
+	check_equal(dep_release(t[2]), t[3]);
+	check_equal(t[3]->next, NULL);
+	check_equal(dep_release(t[4]), t[5]);
+	t[5]->next = NULL;
+	check_equal(dep_release(t[3]), NULL);
+	check_equal(dep_release(t[5]), NULL);
+
+	// Predecessors have finished
+	check_equal(dep_register(t[6], (struct dep []){ { &x, DEP_MODE_IN }, { &z, DEP_MODE_IN } }, 2), true);
+	check_equal(dep_release(t[6]), NULL);
+
+	// The map grows
+	for (i = 0; i < 100; i++) {
+		dep_register(t[7], (struct dep []){ { &v[i], DEP_MODE_OUT } }, 1);
+		check_equal(dep_release(t[7]), NULL);
+	}
+
+	check_equal(dep_release(parent), NULL);
+	check_equal(parent->deps, NULL);
+
+	for (i = 0; i < 8; i++) {
+		task_delete(t[i]);
+	}
+	task_delete(parent);
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
@@ -0,0 +1,62 @@
+#ifndef DEPENDENCY_H
+#define DEPENDENCY_H
+
+#include <stdbool.h>
+#include "task.h"
+
+//==========================================================================//
+//                                                                          //
+//    Data-flow dependencies between sibling tasks                          //
+//                                                                          //
+//    A task declares the addresses it reads (DEP_MODE_IN) and writes       //
+//    (DEP_MODE_OUT, DEP_MODE_INOUT). Every parent keeps a dependency map   //
+//    for its children, recording the last writer of each address and the  //
+//    readers since. A new task depends on                                  //
+//                                                                          //
+//    - the last writer of every address it reads                           //
+//    - the readers since the last writer, or the last writer if there are  //
+//      none, of every address it writes                                    //
+//                                                                          //
+//    in the order the parent creates its children. There is no renaming,   //
+//    so DEP_MODE_OUT is treated like DEP_MODE_INOUT. A task becomes ready  //
+//    when all of its predecessors have finished; the predecessor that      //
+//    finishes last releases it.                                            //
+//                                                                          //
+//    The map of a parent is only accessed by the parent itself, edges      //
+//    between tasks are added and released without locks.                  //
+//                                                                          //
+//==========================================================================//
+
+enum dep_mode {
+	DEP_MODE_IN,
+	DEP_MODE_OUT,
+	DEP_MODE_INOUT
+};
+
+struct dep {
+	void *addr;
+	enum dep_mode mode;
+};
+
+// Dependency record of a task (see task->deps), allocated when a task is
+// created with dependencies or creates children with dependencies
+struct dep_node;
+
+// Only tasks that can't be split have dependency records, which share space
+// with the reductions of splittable tasks
+static inline struct dep_node *task_deps(Task *task)
+{
+	return task->splittable ? NULL : task->deps;
+}
+
+// Registers the n dependencies of task in the dependency map of its parent,
+// which must not be splittable
+// Returns true if task is ready to run
+bool dep_register(Task *task, const struct dep *deps, int n);
+
+// Called when task has finished: releases its successors and frees the
+// dependency map of its children
+// Returns the tasks that have become ready, linked through task->next
+Task *dep_release(Task *task);
+
+#endif // DEPENDENCY_H
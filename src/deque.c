@@ -6,39 +6,42 @@
 #include <string.h>
 #include <unistd.h>
 #include "deque.h"
+#include "task_alloc.h"
 
-struct deque {
+// Tasks of the same priority are kept in a separate list
+struct level {
 	// List must be accessible from either end
 	Task *head, *tail;
+	// Number of tasks in the list
+	unsigned int num_tasks;
+};
+
+struct deque {
+	// One list per priority, owners pop and thieves steal from the list of
+	// the highest priority that has tasks
+	struct level levels[TASK_PRIORITIES];
 	// Number of tasks in the deque
 	unsigned int num_tasks;
 	// Record number of (successful) steals
 	unsigned int num_steals;
-	// Pool (stack) of free task objects
-	Task *freelist;
+	// Task objects are allocated from and returned to this allocator
+	TaskAllocator alloc;
 };
 
-static inline void freelist_push(Deque *dq, Task *task)
+// List of the highest priority tasks (level 0 if dq is empty)
+static inline struct level *top_level(Deque *dq)
 {
-	task->next = dq->freelist;
-	dq->freelist = task;
-}
+	int p;
 
-static inline Task *freelist_pop(Deque *dq)
-{
-	if (!dq->freelist)
-		return NULL;
+	for (p = TASK_PRIORITIES-1; p > 0 && dq->levels[p].num_tasks == 0; p--) ;
 
-	Task *task = dq->freelist;
-	dq->freelist = dq->freelist->next;
-	task->next = NULL;
-
-	return task;
+	return &dq->levels[p];
 }
 
 Deque *deque_new(void)
 {
 	Deque *dq;
+	int p;
 
 	dq = (Deque *)malloc(sizeof(Deque));
 	if (!dq) {
@@ -46,13 +49,16 @@ Deque *deque_new(void)
 		return NULL;
 	}
 
-	Task *dummy = task_new();
-	dummy->fn = (void *)0xCAFE;
-	dq->head = dummy;
-	dq->tail = dummy;
+	for (p = 0; p < TASK_PRIORITIES; p++) {
+		Task *dummy = task_new();
+		dummy->fn = (void *)0xCAFE;
+		dq->levels[p].head = dummy;
+		dq->levels[p].tail = dummy;
+		dq->levels[p].num_tasks = 0;
+	}
 	dq->num_tasks = 0;
 	dq->num_steals = 0;
-	dq->freelist = NULL;
+	task_allocator_init(&dq->alloc);
 
 	return dq;
 }
@@ -61,18 +67,20 @@ void deque_delete(Deque *dq)
 {
 	if (dq != NULL) {
 		Task *task;
+		int p;
 		// Free all remaining tasks
 		while ((task = deque_pop(dq)) != NULL) {
-			task_delete(task);
+			task_free(&dq->alloc, task);
 		}
 		assert(deque_num_tasks(dq) == 0);
 		assert(deque_empty(dq));
-		// Free dummy node
-		task_delete(dq->head);
-		// Free allocations that are still cached
-		while ((task = freelist_pop(dq)) != NULL) {
-			free(task);
+		// Free dummy nodes
+		for (p = 0; p < TASK_PRIORITIES; p++) {
+			assert(dq->levels[p].head == dq->levels[p].tail);
+			task_delete(dq->levels[p].head);
 		}
+		// Release all chunks
+		task_allocator_destroy(&dq->alloc);
 		free(dq);
 	}
 }
@@ -81,10 +89,14 @@ Task *deque_task_new(Deque *dq)
 {
 	assert(dq != NULL);
 
-	if (!dq->freelist)
-		return task_new();
+	return task_alloc(&dq->alloc, TASK_DATA_SIZE);
+}
+
+Task *deque_task_new(Deque *dq, unsigned long size)
+{
+	assert(dq != NULL);
 
-	return freelist_pop(dq);
+	return task_alloc(&dq->alloc, size);
 }
 
 void deque_task_cache(Deque *dq, Task *task)
@@ -92,23 +104,36 @@ void deque_task_cache(Deque *dq, Task *task)
 	assert(dq != NULL);
 	assert(task != NULL);
 
-	freelist_push(dq, task_zero(task));
+	task_free(&dq->alloc, task);
+}
+
+void deque_task_flush(Deque *dq)
+{
+	assert(dq != NULL);
+
+	task_allocator_flush(&dq->alloc);
 }
 
 // Add list of tasks [head, tail] of length len to the front of dq
+// All tasks must have the same priority, which is the case for stolen tasks
 Deque *deque_prepend(Deque *dq, Task *head, Task *tail, unsigned int len)
 {
 	assert(dq != NULL);
 	assert(head != NULL && tail != NULL);
 	assert(len > 0);
+	assert(head->priority < TASK_PRIORITIES);
+	assert(tail->priority == head->priority);
+
+	struct level *l = &dq->levels[head->priority];
 
-	// Link tail with dq->head
+	// Link tail with l->head
 	assert(tail->next == NULL);
-	tail->next = dq->head;
-	dq->head->prev = tail;
+	tail->next = l->head;
+	l->head->prev = tail;
 
 	// Update state of deque
-	dq->head = head;
+	l->head = head;
+	l->num_tasks += len;
 	dq->num_tasks += len;
 
 	return dq;
@@ -128,16 +153,7 @@ Deque *deque_prepend(Deque *dq, Task *head, unsigned int len)
 		tail = tail->next;
 	}
 
-	// Link tail with dq->head
-	assert(tail->next == NULL);
-	tail->next = dq->head;
-	dq->head->prev = tail;
-
-	// Update state of deque
-	dq->head = head;
-	dq->num_tasks += len;
-
-	return dq;
+	return deque_prepend(dq, head, tail, len);
 }
 
 // Add list of tasks starting with head to the front of dq
@@ -155,293 +171,195 @@ Deque *deque_prepend(Deque *dq, Task *head)
 		n++;
 	}
 
-	// Link tail with dq->head
-	assert(tail->next == NULL);
-	tail->next = dq->head;
-	dq->head->prev = tail;
-
-	// Update state of deque
-	dq->head = head;
-	dq->num_tasks += n;
-
-	return dq;
+	return deque_prepend(dq, head, tail, n);
 }
 
 void deque_push(Deque *dq, Task *task)
 {
 	assert(dq != NULL);
 	assert(task != NULL);
+	assert(task->priority < TASK_PRIORITIES);
 
-	task->next = dq->head;
-	dq->head->prev = task;
-	dq->head = task;
+	struct level *l = &dq->levels[task->priority];
 
+	task->next = l->head;
+	l->head->prev = task;
+	l->head = task;
+
+	l->num_tasks++;
 	dq->num_tasks++;
 }
 
-Task *deque_pop(Deque *dq)
+// Remove the first task of list l
+static inline Task *level_pop(Deque *dq, struct level *l)
 {
-	assert(dq != NULL);
-
 	Task *task;
 
-	if (deque_empty(dq))
-		return NULL;
+	assert(l->num_tasks > 0);
 
-	task = dq->head;
-	dq->head = dq->head->next;
-	dq->head->prev = NULL;
+	task = l->head;
+	l->head = l->head->next;
+	l->head->prev = NULL;
 	task->next = NULL;
 
+	l->num_tasks--;
 	dq->num_tasks--;
 
 	return task;
 }
 
-Task *deque_pop(Deque *dq, Task *parent)
+Task *deque_pop(Deque *dq)
 {
 	assert(dq != NULL);
-	assert(parent != NULL);
-
-	Task *task;
 
 	if (deque_empty(dq))
 		return NULL;
 
-	task = dq->head;
-	if (task->parent != parent) {
-		// Not a child of parent, don't pop it
-		return NULL;
-	}
-	dq->head = dq->head->next;
-	dq->head->prev = NULL;
-	task->next = NULL;
-
-	dq->num_tasks--;
-
-	return task;
+	return level_pop(dq, top_level(dq));
 }
 
-Task *deque_steal(Deque *dq)
+// Pops the first child of parent, trying higher priorities first
+Task *deque_pop(Deque *dq, Task *parent)
 {
 	assert(dq != NULL);
+	assert(parent != NULL);
 
-	Task *task;
+	int p;
 
 	if (deque_empty(dq))
 		return NULL;
 
-	task = dq->tail;
-	assert(task->fn == (void *)0xCAFE);
-	task = task->prev;
-	task->next = NULL;
-	dq->tail->prev = task->prev;
-	task->prev = NULL;
-	if (dq->tail->prev == NULL) {
-		// Stealing the last task in the deque
-		assert(dq->head == task);
-		dq->head = dq->tail;
-	} else {
-		dq->tail->prev->next = dq->tail;
+	for (p = TASK_PRIORITIES-1; p >= 0; p--) {
+		struct level *l = &dq->levels[p];
+		if (l->num_tasks > 0 && l->head->parent == parent)
+			return level_pop(dq, l);
 	}
 
-	dq->num_tasks--;
-	dq->num_steals++;
-
-	return task;
+	// Not a child of parent, don't pop it
+	return NULL;
 }
 
-// Steal up to half of the deque's tasks, but at most max tasks
-// tail will point to the last task in the returned list (head is returned)
-// stolen will contain the number of transferred tasks if different from NULL
-Task *deque_steal_many(Deque *dq, Task **tail, int max, int *stolen)
+// Take the n last tasks of the list of the highest priority
+// tail will point to the last task in the returned list if different from NULL
+static inline Task *deque_take(Deque *dq, struct level *l, int n, Task **tail)
 {
-	assert(dq != NULL);
-
 	Task *task;
-	int n, i;
+	int i;
 
-	if (deque_empty(dq))
-		return NULL;
+	assert(0 < n && n <= (int)l->num_tasks);
 
-	// Make sure to steal at least one task
-	n = dq->num_tasks / 2;
-	if (n == 0) n = 1;
-	if (n > max) n = max;
-
-	task = dq->tail;
-	*tail = task->prev;
+	task = l->tail;
 	assert(task->fn == (void *)0xCAFE);
 
+	if (tail != NULL) {
+		*tail = task->prev;
+	}
+
 	// Walk backwards
 	for (i = 0; i < n; i++) {
 		task = task->prev;
 	}
 
-	dq->tail->prev->next = NULL;
-	dq->tail->prev = task->prev;
+	l->tail->prev->next = NULL;
+	l->tail->prev = task->prev;
 	task->prev = NULL;
-	if (dq->tail->prev == NULL) {
-		// Stealing the last task in the deque
-		assert(dq->head == task);
-		dq->head = dq->tail;
+	if (l->tail->prev == NULL) {
+		// Stealing the last task in the list
+		assert(l->head == task);
+		l->head = l->tail;
 	} else {
-		dq->tail->prev->next = dq->tail;
+		l->tail->prev->next = l->tail;
 	}
 
+	l->num_tasks -= n;
 	dq->num_tasks -= n;
 	dq->num_steals++;
 
-	if (stolen != NULL) {
-		*stolen = n;
-	}
-
 	return task;
 }
 
-// Steal up to half of the deque's tasks, but at most max tasks
-// stolen will contain the number of transferred tasks if different from NULL
-Task *deque_steal_many(Deque *dq, int max, int *stolen)
+Task *deque_steal(Deque *dq)
 {
 	assert(dq != NULL);
 
-	Task *task;
-	int n, i;
-
 	if (deque_empty(dq))
 		return NULL;
 
-	// Make sure to steal at least one task
-	n = dq->num_tasks / 2;
-	if (n == 0) n = 1;
-	if (n > max) n = max;
-
-	task = dq->tail;
-	assert(task->fn == (void *)0xCAFE);
-
-	// Walk backwards
-	for (i = 0; i < n; i++) {
-		task = task->prev;
-	}
-
-	dq->tail->prev->next = NULL;
-	dq->tail->prev = task->prev;
-	task->prev = NULL;
-	if (dq->tail->prev == NULL) {
-		// Stealing the last task in the deque
-		assert(dq->head == task);
-		dq->head = dq->tail;
-	} else {
-		dq->tail->prev->next = dq->tail;
-	}
-
-	dq->num_tasks -= n;
-	dq->num_steals++;
-
-	if (stolen != NULL) {
-		*stolen = n;
-	}
-
-	return task;
+	return deque_take(dq, top_level(dq), 1, NULL);
 }
 
-// Steal half of the deque's tasks
+// Steal up to half of the tasks of the highest priority, but at most max tasks
 // tail will point to the last task in the returned list (head is returned)
 // stolen will contain the number of transferred tasks if different from NULL
-Task *deque_steal_half(Deque *dq, Task **tail, int *stolen)
+Task *deque_steal_many(Deque *dq, Task **tail, int max, int *stolen)
 {
 	assert(dq != NULL);
 
-	Task *task;
-	int n, i;
+	struct level *l;
+	int n;
 
 	if (deque_empty(dq))
 		return NULL;
 
+	l = top_level(dq);
+
 	// Make sure to steal at least one task
-	n = dq->num_tasks / 2;
+	n = l->num_tasks / 2;
 	if (n == 0) n = 1;
-
-	task = dq->tail;
-	*tail = task->prev;
-	assert(task->fn == (void *)0xCAFE);
-
-	// Walk backwards
-	for (i = 0; i < n; i++) {
-		task = task->prev;
-	}
-
-	dq->tail->prev->next = NULL;
-	dq->tail->prev = task->prev;
-	task->prev = NULL;
-	if (dq->tail->prev == NULL) {
-		// Stealing the last task in the deque
-		assert(dq->head == task);
-		dq->head = dq->tail;
-	} else {
-		dq->tail->prev->next = dq->tail;
-	}
-
-	dq->num_tasks -= n;
-	dq->num_steals++;
+	if (n > max) n = max;
 
 	if (stolen != NULL) {
 		*stolen = n;
 	}
 
-	return task;
+	return deque_take(dq, l, n, tail);
 }
 
-// Steal half of the deque's tasks
+// Steal up to half of the tasks of the highest priority, but at most max tasks
 // stolen will contain the number of transferred tasks if different from NULL
-Task *deque_steal_half(Deque *dq, int *stolen)
+Task *deque_steal_many(Deque *dq, int max, int *stolen)
+{
+	return deque_steal_many(dq, NULL, max, stolen);
+}
+
+// Steal half of the tasks of the highest priority
+// tail will point to the last task in the returned list (head is returned)
+// stolen will contain the number of transferred tasks if different from NULL
+Task *deque_steal_half(Deque *dq, Task **tail, int *stolen)
 {
 	assert(dq != NULL);
 
-	Task *task;
-	int n, i;
+	struct level *l;
+	int n;
 
 	if (deque_empty(dq))
 		return NULL;
 
+	l = top_level(dq);
+
 	// Make sure to steal at least one task
-	n = dq->num_tasks / 2;
+	n = l->num_tasks / 2;
 	if (n == 0) n = 1;
 
-	task = dq->tail;
-	assert(task->fn == (void *)0xCAFE);
-
-	// Walk backwards
-	for (i = 0; i < n; i++) {
-		task = task->prev;
-	}
-
-	dq->tail->prev->next = NULL;
-	dq->tail->prev = task->prev;
-	task->prev = NULL;
-	if (dq->tail->prev == NULL) {
-		// Stealing the last task in the deque
-		assert(dq->head == task);
-		dq->head = dq->tail;
-	} else {
-		dq->tail->prev->next = dq->tail;
-	}
-
-	dq->num_tasks -= n;
-	dq->num_steals++;
-
 	if (stolen != NULL) {
 		*stolen = n;
 	}
 
-	return task;
+	return deque_take(dq, l, n, tail);
+}
+
+// Steal half of the tasks of the highest priority
+// stolen will contain the number of transferred tasks if different from NULL
+Task *deque_steal_half(Deque *dq, int *stolen)
+{
+	return deque_steal_half(dq, NULL, stolen);
 }
 
 bool deque_empty(Deque *dq)
 {
 	assert(dq != NULL);
 
-	return dq->head == dq->tail && dq->num_tasks == 0;
+	return dq->num_tasks == 0;
 }
 
 unsigned int deque_num_tasks(Deque *dq)
@@ -509,7 +427,8 @@ int main(void)
 		deque_push(deq, t);
 	}
 
-	check_equal(deq->freelist, NULL);
+	// Cached task objects were reused
+	check_equal(task_allocator_num_free(&deq->alloc, TASK_CLASS_LARGE) < TASK_CHUNK_CAPACITY(TASK_CLASS_LARGE), true);
 	check_equal(deque_empty(deq), false);
 	check_equal(deque_num_tasks(deq), N);
 
@@ -552,6 +471,71 @@ int main(void)
 	check_equal(deque_empty(deq), true);
 	check_equal(deque_num_tasks(deq), 0);
 
+	// Priorities: the owner pops and thieves steal the highest priority first
+	{
+		Task *parent = (Task *)deq;
+		Task *t;
+		int n;
+
+		for (i = 0; i < 6; i++) {
+			t = deque_task_new(deq);
+			*(Data *)task_data(t) = (Data){ i, 0 };
+			t->priority = i % 2 ? TASK_PRIORITY_MAX : 0;
+			t->parent = i == 4 ? parent : NULL;
+			deque_push(deq, t);
+		}
+
+		t = deque_steal(deq);
+		check_equal(((Data *)task_data(t))->a, 1);
+		deque_task_cache(deq, t);
+		t = deque_pop(deq);
+		check_equal(((Data *)task_data(t))->a, 5);
+		deque_task_cache(deq, t);
+		t = deque_steal_half(deq, &n);
+		check_equal(((Data *)task_data(t))->a, 3);
+		check_equal(n, 1);
+		deque_task_cache(deq, t);
+		t = deque_pop(deq, parent);
+		check_equal(((Data *)task_data(t))->a, 4);
+		deque_task_cache(deq, t);
+		check_equal(deque_pop(deq, parent), NULL);
+		t = deque_pop(deq);
+		check_equal(((Data *)task_data(t))->a, 2);
+		deque_task_cache(deq, t);
+		t = deque_pop(deq);
+		check_equal(((Data *)task_data(t))->a, 0);
+		deque_task_cache(deq, t);
+		check_equal(deque_empty(deq), true);
+	}
+
+	// Task size classes
+	{
+		Task *s = deque_task_new(deq, sizeof(Data));
+		Task *l = deque_task_new(deq, TASK_DATA_SIZE);
+		Task *p = deque_task_new(deq, 1000);
+		Task *q = deque_task_new(deq, 1000);
+
+		check_equal(s->size_class, TASK_CLASS_SMALL);
+		check_equal(l->size_class, TASK_CLASS_LARGE);
+		check_equal(p->size_class, TASK_CLASS_PAYLOAD);
+		check_equal(task_data_size(s), TASK_SMALL_DATA_SIZE);
+		check_equal(task_data_size(l), TASK_DATA_SIZE);
+		check_equal(task_data_size(p), 1000);
+		check_equal((unsigned long)s % 64, 0);
+
+		memset(task_data(p), 42, 1000);
+		p->start = 7;
+		task_copy(q, p);
+		check_equal(q->start, 7);
+		check_not_equal(task_data(q), task_data(p));
+		check_equal(task_data(q)[999], 42);
+
+		deque_task_cache(deq, s);
+		deque_task_cache(deq, l);
+		deque_task_cache(deq, p);
+		deque_task_cache(deq, q);
+	}
+
 	deque_delete(deq);
 
 	UTEST_DONE;
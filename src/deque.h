@@ -6,13 +6,18 @@
 #include "overload_deque_prepend.h"
 #include "overload_deque_steal_half.h"
 #include "overload_deque_steal_many.h"
+#include "overload_deque_task_new.h"
 #include "task.h"
 
 //==========================================================================//
 //                                                                          //
-//    A list-based thread-local work-stealing deque                         //
+//    A thread-local work-stealing deque                                    //
 //                                                                          //
-//    Tasks are stored in a doubly linked list -> unbounded                 //
+//    deque.c: Tasks are stored in a doubly linked list -> unbounded        //
+//    deque_array.c: Tasks are stored in a growable circular array          //
+//                                                                          //
+//    Tasks of higher priority (see task.h) are kept apart from the rest:   //
+//    the owner pops and thieves steal tasks of the highest priority first. //
 //                                                                          //
 //==========================================================================//
 
@@ -20,8 +25,12 @@ typedef struct deque Deque;
 
 Deque *deque_new(void);
 void deque_delete(Deque *dq);
+// Allocate a task with room for TASK_DATA_SIZE or size bytes of data
 Task *deque_task_new(Deque *dq);
+Task *deque_task_new(Deque *dq, unsigned long size);
 void deque_task_cache(Deque *dq, Task *task);
+// Return cached task objects to the deques they were allocated from
+void deque_task_flush(Deque *dq);
 bool deque_empty(Deque *dq);
 unsigned int deque_num_tasks(Deque *dq);
 
@@ -0,0 +1,616 @@
+// gcc -Wall -Wextra -Wno-sign-compare -fsanitize=address,undefined -DTEST deque_array.c -o deque_array && ./deque_array
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "deque.h"
+#include "task_alloc.h"
+
+//==========================================================================//
+//                                                                          //
+//    An array-based thread-local work-stealing deque                       //
+//                                                                          //
+//    Task pointers are stored in a growable circular array. The owner      //
+//    pushes and pops at the bottom, steals take the oldest tasks from the  //
+//    top. Since steal requests are handled by the owner, no atomics or     //
+//    fences are needed, unlike in a Chase-Lev deque. Stealing half of the  //
+//    tasks is a range split in O(1); the stolen tasks are then linked      //
+//    through next in one sequential pass over the array.                   //
+//                                                                          //
+//    Build with make DEQUE=array                                           //
+//                                                                          //
+//==========================================================================//
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+// Tasks of the same priority are kept in a separate array
+struct level {
+	// Circular array of task pointers; capacity is a power of two
+	Task **buf;
+	unsigned long mask;
+	// Tasks are in [top, bottom), top being the oldest task
+	// Indices are free-running and wrap around only on overflow
+	unsigned long top, bottom;
+};
+
+struct deque {
+	// One array per priority, owners pop and thieves steal from the array of
+	// the highest priority that has tasks
+	struct level levels[TASK_PRIORITIES];
+	// Number of tasks in the deque
+	unsigned int num_tasks;
+	// Record number of (successful) steals
+	unsigned int num_steals;
+	// Task objects are allocated from and returned to this allocator
+	TaskAllocator alloc;
+};
+
+#define SLOT(l, i) ((l)->buf[(i) & (l)->mask])
+
+#define LEVEL_NUM_TASKS(l) ((l)->bottom - (l)->top)
+
+// Array of the highest priority tasks (level 0 if dq is empty)
+static inline struct level *top_level(Deque *dq)
+{
+	int p;
+
+	for (p = TASK_PRIORITIES-1; p > 0 && LEVEL_NUM_TASKS(&dq->levels[p]) == 0; p--) ;
+
+	return &dq->levels[p];
+}
+
+// Make room for at least n more tasks
+static void level_reserve(struct level *l, unsigned long n)
+{
+	unsigned long num_tasks = LEVEL_NUM_TASKS(l);
+	unsigned long capacity = l->mask + 1;
+	unsigned long i;
+
+	if (num_tasks + n <= capacity)
+		return;
+
+	while (num_tasks + n > capacity) {
+		capacity *= 2;
+	}
+
+	Task **buf = (Task **)malloc(capacity * sizeof(Task *));
+	if (!buf) {
+		fprintf(stderr, "Warning: deque_reserve failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < num_tasks; i++) {
+		buf[i] = SLOT(l, l->top + i);
+	}
+
+	free(l->buf);
+	l->buf = buf;
+	l->mask = capacity - 1;
+	l->top = 0;
+	l->bottom = num_tasks;
+}
+
+Deque *deque_new(void)
+{
+	Deque *dq;
+	int p;
+
+	dq = (Deque *)malloc(sizeof(Deque));
+	if (!dq) {
+		fprintf(stderr, "Warning: deque_new failed\n");
+		return NULL;
+	}
+
+	for (p = 0; p < TASK_PRIORITIES; p++) {
+		struct level *l = &dq->levels[p];
+		l->buf = (Task **)malloc(DEQUE_INITIAL_CAPACITY * sizeof(Task *));
+		if (!l->buf) {
+			fprintf(stderr, "Warning: deque_new failed\n");
+			while (p-- > 0) free(dq->levels[p].buf);
+			free(dq);
+			return NULL;
+		}
+		l->mask = DEQUE_INITIAL_CAPACITY - 1;
+		l->top = 0;
+		l->bottom = 0;
+	}
+
+	dq->num_tasks = 0;
+	dq->num_steals = 0;
+	task_allocator_init(&dq->alloc);
+
+	return dq;
+}
+
+void deque_delete(Deque *dq)
+{
+	if (dq != NULL) {
+		Task *task;
+		int p;
+		// Free all remaining tasks
+		while ((task = deque_pop(dq)) != NULL) {
+			task_free(&dq->alloc, task);
+		}
+		assert(deque_num_tasks(dq) == 0);
+		assert(deque_empty(dq));
+		// Release all chunks
+		task_allocator_destroy(&dq->alloc);
+		for (p = 0; p < TASK_PRIORITIES; p++) {
+			free(dq->levels[p].buf);
+		}
+		free(dq);
+	}
+}
+
+Task *deque_task_new(Deque *dq)
+{
+	assert(dq != NULL);
+
+	return task_alloc(&dq->alloc, TASK_DATA_SIZE);
+}
+
+Task *deque_task_new(Deque *dq, unsigned long size)
+{
+	assert(dq != NULL);
+
+	return task_alloc(&dq->alloc, size);
+}
+
+void deque_task_cache(Deque *dq, Task *task)
+{
+	assert(dq != NULL);
+	assert(task != NULL);
+
+	task_free(&dq->alloc, task);
+}
+
+void deque_task_flush(Deque *dq)
+{
+	assert(dq != NULL);
+
+	task_allocator_flush(&dq->alloc);
+}
+
+// Add list of tasks [head, tail] of length len to the front of dq
+// head will be popped first
+// All tasks must have the same priority, which is the case for stolen tasks
+Deque *deque_prepend(Deque *dq, Task *head, Task *tail, unsigned int len)
+{
+	assert(dq != NULL);
+	assert(head != NULL && tail != NULL);
+	assert(len > 0);
+	assert(head->priority < TASK_PRIORITIES);
+	assert(tail->priority == head->priority);
+
+	struct level *l = &dq->levels[head->priority];
+	Task *task;
+	unsigned long i;
+
+	level_reserve(l, len);
+
+	// Store the list back to front, so that head ends up at the bottom
+	for (task = head, i = l->bottom + len; task != NULL; task = task->next) {
+		SLOT(l, --i) = task;
+	}
+
+	assert(i == l->bottom);
+	assert(SLOT(l, i) == tail);
+
+	l->bottom += len;
+	dq->num_tasks += len;
+
+	return dq;
+}
+
+// Add list of tasks starting with head of length len to the front of dq
+Deque *deque_prepend(Deque *dq, Task *head, unsigned int len)
+{
+	assert(dq != NULL);
+	assert(head != NULL);
+	assert(len > 0);
+	assert(head->priority < TASK_PRIORITIES);
+
+	struct level *l = &dq->levels[head->priority];
+	Task *task;
+	unsigned long i;
+
+	level_reserve(l, len);
+
+	for (task = head, i = l->bottom + len; task != NULL; task = task->next) {
+		assert(task->priority == head->priority);
+		SLOT(l, --i) = task;
+	}
+
+	assert(i == l->bottom);
+
+	l->bottom += len;
+	dq->num_tasks += len;
+
+	return dq;
+}
+
+// Add list of tasks starting with head to the front of dq
+Deque *deque_prepend(Deque *dq, Task *head)
+{
+	assert(dq != NULL);
+	assert(head != NULL);
+
+	Task *task;
+	unsigned int n = 0;
+
+	// Find the length
+	for (task = head; task != NULL; task = task->next) {
+		n++;
+	}
+
+	return deque_prepend(dq, head, n);
+}
+
+void deque_push(Deque *dq, Task *task)
+{
+	assert(dq != NULL);
+	assert(task != NULL);
+	assert(task->priority < TASK_PRIORITIES);
+
+	struct level *l = &dq->levels[task->priority];
+
+	if (LEVEL_NUM_TASKS(l) == l->mask + 1) {
+		level_reserve(l, 1);
+	}
+
+	SLOT(l, l->bottom) = task;
+	l->bottom++;
+	dq->num_tasks++;
+}
+
+// Remove the youngest task of array l
+static inline Task *level_pop(Deque *dq, struct level *l)
+{
+	Task *task;
+
+	assert(LEVEL_NUM_TASKS(l) > 0);
+
+	l->bottom--;
+	task = SLOT(l, l->bottom);
+	task->next = NULL;
+	dq->num_tasks--;
+
+	return task;
+}
+
+Task *deque_pop(Deque *dq)
+{
+	assert(dq != NULL);
+
+	if (deque_empty(dq))
+		return NULL;
+
+	return level_pop(dq, top_level(dq));
+}
+
+// Pops the youngest child of parent, trying higher priorities first
+Task *deque_pop(Deque *dq, Task *parent)
+{
+	assert(dq != NULL);
+	assert(parent != NULL);
+
+	int p;
+
+	if (deque_empty(dq))
+		return NULL;
+
+	for (p = TASK_PRIORITIES-1; p >= 0; p--) {
+		struct level *l = &dq->levels[p];
+		if (LEVEL_NUM_TASKS(l) > 0 && SLOT(l, l->bottom - 1)->parent == parent)
+			return level_pop(dq, l);
+	}
+
+	// Not a child of parent, don't pop it
+	return NULL;
+}
+
+Task *deque_steal(Deque *dq)
+{
+	assert(dq != NULL);
+
+	struct level *l;
+	Task *task;
+
+	if (deque_empty(dq))
+		return NULL;
+
+	l = top_level(dq);
+	task = SLOT(l, l->top);
+	l->top++;
+	task->next = NULL;
+	task->prev = NULL;
+
+	dq->num_tasks--;
+	dq->num_steals++;
+
+	return task;
+}
+
+// Take the n oldest tasks of array l and return them as a list, youngest task
+// first
+// tail will point to the last (oldest) task in the list if different from NULL
+static inline Task *deque_take(Deque *dq, struct level *l, unsigned long n, Task **tail)
+{
+	unsigned long i;
+
+	assert(0 < n && n <= LEVEL_NUM_TASKS(l));
+
+	// Link the tasks in [top, top+n) through next in a single pass
+	SLOT(l, l->top)->next = NULL;
+	for (i = l->top + 1; i < l->top + n; i++) {
+		SLOT(l, i)->next = SLOT(l, i - 1);
+	}
+
+	if (tail != NULL) {
+		*tail = SLOT(l, l->top);
+	}
+
+	Task *head = SLOT(l, l->top + n - 1);
+	head->prev = NULL;
+
+	l->top += n;
+	dq->num_tasks -= n;
+	dq->num_steals++;
+
+	return head;
+}
+
+// Steal up to half of the tasks of the highest priority, but at most max tasks
+// tail will point to the last task in the returned list (head is returned)
+// stolen will contain the number of transferred tasks if different from NULL
+Task *deque_steal_many(Deque *dq, Task **tail, int max, int *stolen)
+{
+	assert(dq != NULL);
+
+	struct level *l;
+	int n;
+
+	if (deque_empty(dq))
+		return NULL;
+
+	l = top_level(dq);
+
+	// Make sure to steal at least one task
+	n = LEVEL_NUM_TASKS(l) / 2;
+	if (n == 0) n = 1;
+	if (n > max) n = max;
+
+	if (stolen != NULL) {
+		*stolen = n;
+	}
+
+	return deque_take(dq, l, n, tail);
+}
+
+// Steal up to half of the tasks of the highest priority, but at most max tasks
+// stolen will contain the number of transferred tasks if different from NULL
+Task *deque_steal_many(Deque *dq, int max, int *stolen)
+{
+	return deque_steal_many(dq, NULL, max, stolen);
+}
+
+// Steal half of the tasks of the highest priority
+// tail will point to the last task in the returned list (head is returned)
+// stolen will contain the number of transferred tasks if different from NULL
+Task *deque_steal_half(Deque *dq, Task **tail, int *stolen)
+{
+	assert(dq != NULL);
+
+	struct level *l;
+	int n;
+
+	if (deque_empty(dq))
+		return NULL;
+
+	l = top_level(dq);
+
+	// Make sure to steal at least one task
+	n = LEVEL_NUM_TASKS(l) / 2;
+	if (n == 0) n = 1;
+
+	if (stolen != NULL) {
+		*stolen = n;
+	}
+
+	return deque_take(dq, l, n, tail);
+}
+
+// Steal half of the tasks of the highest priority
+// stolen will contain the number of transferred tasks if different from NULL
+Task *deque_steal_half(Deque *dq, int *stolen)
+{
+	return deque_steal_half(dq, NULL, stolen);
+}
+
+bool deque_empty(Deque *dq)
+{
+	assert(dq != NULL);
+
+	return dq->num_tasks == 0;
+}
+
+unsigned int deque_num_tasks(Deque *dq)
+{
+	assert(dq != NULL);
+
+	return dq->num_tasks;
+}
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include "utest.h"
+
+#define N 1000000 	// Number of tasks to push/pop/steal
+#define M 100		// Max. number of tasks to steal in one swoop
+
+typedef struct {
+	int a, b;
+} Data;
+
+int main(void)
+{
+	UTEST_INIT;
+
+	Deque *deq;
+	int i, m;
+
+	deq = deque_new();
+
+	check_equal(deque_empty(deq), true);
+	check_equal(deque_num_tasks(deq), 0);
+
+	for (i = 0; i < N; i++) {
+		Task *t = deque_task_new(deq);
+		check_not_equal(t, NULL);
+		Data *d = (Data *)task_data(t);
+		*d = (Data){ i, i+1 };
+		deque_push(deq, t);
+	}
+
+	check_equal(deque_empty(deq), false);
+	check_equal(deque_num_tasks(deq), N);
+
+	for (; i > 0; i--) {
+		Task *t = deque_pop(deq);
+		Data *d = (Data *)task_data(t);
+		check_equal(d->a, i-1);
+		check_equal(d->b, i);
+		deque_task_cache(deq, t);
+	}
+
+	check_equal(deque_pop(deq), NULL);
+	check_equal(deque_empty(deq), true);
+	check_equal(deque_num_tasks(deq), 0);
+
+	for (i = 0; i < N; i++) {
+		Task *t = deque_task_new(deq);
+		check_not_equal(t, NULL);
+		Data *d = (Data *)task_data(t);
+		*d = (Data){ i+24, i+42 };
+		deque_push(deq, t);
+	}
+
+	// Cached task objects were reused
+	check_equal(task_allocator_num_free(&deq->alloc, TASK_CLASS_LARGE) < TASK_CHUNK_CAPACITY(TASK_CLASS_LARGE), true);
+	check_equal(deque_empty(deq), false);
+	check_equal(deque_num_tasks(deq), N);
+
+	for (i = 0; i < N; i += m) {
+		Deque *s;
+		Task *h, *t;
+		int a, b, j;
+
+		h = deque_steal_many(deq, &t, M, &m);
+		check_not_equal(h, NULL);
+		check_equal(m >= 1 && m <= M, true);
+
+		s = deque_prepend(deque_new(), h, t, m);
+		check_not_equal(s, NULL);
+		check_equal(deque_empty(s), false);
+		check_equal(deque_num_tasks(s), m);
+
+		t = deque_pop(s);
+		Data *d = (Data *)task_data(t);
+		deque_task_cache(s, t);
+		a = d->a;
+		b = d->b;
+
+		for (j = 1; j < m; j++) {
+			t = deque_pop(s);
+			d = (Data *)task_data(t);
+			check_equal(d->a, a-j);
+			check_equal(d->b, b-j);
+			deque_task_cache(s, t);
+		}
+
+		check_equal(deque_pop(s), NULL);
+		check_equal(deque_steal(s), NULL);
+		check_equal(deque_empty(s), true);
+		check_equal(deque_num_tasks(s), 0);
+		deque_delete(s);
+	}
+
+	check_equal(deque_steal(deq), NULL);
+	check_equal(deque_empty(deq), true);
+	check_equal(deque_num_tasks(deq), 0);
+
+	// Priorities: the owner pops and thieves steal the highest priority first
+	{
+		Task *parent = (Task *)deq;
+		Task *t;
+		int n;
+
+		for (i = 0; i < 6; i++) {
+			t = deque_task_new(deq);
+			*(Data *)task_data(t) = (Data){ i, 0 };
+			t->priority = i % 2 ? TASK_PRIORITY_MAX : 0;
+			t->parent = i == 4 ? parent : NULL;
+			deque_push(deq, t);
+		}
+
+		t = deque_steal(deq);
+		check_equal(((Data *)task_data(t))->a, 1);
+		deque_task_cache(deq, t);
+		t = deque_pop(deq);
+		check_equal(((Data *)task_data(t))->a, 5);
+		deque_task_cache(deq, t);
+		t = deque_steal_half(deq, &n);
+		check_equal(((Data *)task_data(t))->a, 3);
+		check_equal(n, 1);
+		deque_task_cache(deq, t);
+		t = deque_pop(deq, parent);
+		check_equal(((Data *)task_data(t))->a, 4);
+		deque_task_cache(deq, t);
+		check_equal(deque_pop(deq, parent), NULL);
+		t = deque_pop(deq);
+		check_equal(((Data *)task_data(t))->a, 2);
+		deque_task_cache(deq, t);
+		t = deque_pop(deq);
+		check_equal(((Data *)task_data(t))->a, 0);
+		deque_task_cache(deq, t);
+		check_equal(deque_empty(deq), true);
+	}
+
+	// Interleave pushes and steals so that the tasks wrap around the end of
+	// the array; steals must return the oldest tasks, youngest task first
+	for (i = 0, m = 0; i < 3 * DEQUE_INITIAL_CAPACITY; i++) {
+		Task *t = deque_task_new(deq);
+		*(Data *)task_data(t) = (Data){ i, 0 };
+		deque_push(deq, t);
+		if (i % 3 == 2) {
+			Task *h, *tail;
+			int n, j;
+			h = deque_steal_half(deq, &tail, &n);
+			check_not_equal(h, NULL);
+			check_equal(((Data *)task_data(tail))->a, m);
+			for (j = n-1, t = h; t != NULL; j--, t = h) {
+				check_equal(((Data *)task_data(t))->a, m + j);
+				h = t->next;
+				deque_task_cache(deq, t);
+			}
+			check_equal(j, -1);
+			m += n;
+		}
+	}
+
+	check_equal(deque_num_tasks(deq), i - m);
+
+	deque_delete(deq);
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
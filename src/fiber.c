@@ -0,0 +1,315 @@
+// gcc -Wall -Wextra -DTEST fiber.c -o fiber && ./fiber
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "fiber.h"
+
+// Entry point of every new fiber, called from assembly on x86-64
+__attribute__((used, noinline))
+static void fiber_start(Fiber *fiber)
+{
+	fiber->fn(fiber->arg);
+
+	fprintf(stderr, "Warning: fiber returned\n");
+	abort();
+}
+
+#if defined(__x86_64__)
+
+// Saves the callee-saved registers, the SSE control/status register, and the
+// x87 control word on the stack of the current fiber, stores its stack pointer
+// in *from_sp, and restores the state of the next fiber from to_sp
+void fiber_swap(void **from_sp, void *to_sp);
+
+// A new fiber starts in fiber_entry with a pointer to itself in r12
+void fiber_entry(void);
+
+__asm__(
+	".text\n"
+	".globl fiber_swap\n"
+	".hidden fiber_swap\n"
+	".type fiber_swap, @function\n"
+	"fiber_swap:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size fiber_swap, .-fiber_swap\n"
+	"\n"
+	".globl fiber_entry\n"
+	".hidden fiber_entry\n"
+	".type fiber_entry, @function\n"
+	"fiber_entry:\n"
+	"	movq %r12, %rdi\n"
+	"	call fiber_start\n"
+	"	ud2\n"
+	".size fiber_entry, .-fiber_entry\n"
+);
+
+// Prepares the initial stack of fiber, as if it had called fiber_swap from
+// the beginning of fiber_entry
+static void fiber_prepare(Fiber *fiber)
+{
+	uintptr_t top = ((uintptr_t)fiber->stack + fiber->stack_size) & ~(uintptr_t)15;
+	uint64_t *sp = (uint64_t *)top;
+
+	// After returning to fiber_entry, the stack is 16-byte aligned for the
+	// call to fiber_start
+	*--sp = (uint64_t)(uintptr_t)fiber_entry;
+	*--sp = 0;                           // rbp
+	*--sp = 0;                           // rbx
+	*--sp = (uint64_t)(uintptr_t)fiber;  // r12
+	*--sp = 0;                           // r13
+	*--sp = 0;                           // r14
+	*--sp = 0;                           // r15
+	// Default MXCSR and x87 control word
+	*--sp = (uint64_t)0x037F << 32 | 0x1F80;
+
+	fiber->sp = sp;
+}
+
+void fiber_switch(Fiber *from, Fiber *to)
+{
+	assert(from != to);
+
+	fiber_swap(&from->sp, to->sp);
+}
+
+#else // ucontext
+
+// makecontext only passes int arguments
+static void fiber_start_context(unsigned int hi, unsigned int lo)
+{
+	fiber_start((Fiber *)(((uintptr_t)hi << 16 << 16) | lo));
+}
+
+static void fiber_prepare(Fiber *fiber)
+{
+	uintptr_t p = (uintptr_t)fiber;
+
+	if (getcontext(&fiber->context) != 0) {
+		fprintf(stderr, "Warning: getcontext failed\n");
+		exit(1);
+	}
+
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = fiber->stack_size;
+	fiber->context.uc_link = NULL;
+
+	makecontext(&fiber->context, (void (*)(void))fiber_start_context, 2,
+			(unsigned int)(p >> 16 >> 16), (unsigned int)p);
+}
+
+void fiber_switch(Fiber *from, Fiber *to)
+{
+	assert(from != to);
+
+	if (swapcontext(&from->context, &to->context) != 0) {
+		fprintf(stderr, "Warning: swapcontext failed\n");
+		exit(1);
+	}
+}
+
+#endif // __x86_64__
+
+void fiber_init_thread(Fiber *fiber)
+{
+	fiber->stack = NULL;
+	fiber->stack_size = 0;
+	fiber->fn = NULL;
+	fiber->arg = NULL;
+	fiber->next = NULL;
+}
+
+Fiber *fiber_new(void (*fn)(void *), void *arg)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = (FIBER_STACK_SIZE + page - 1) & ~(page - 1);
+	Fiber *fiber;
+	void *stack;
+
+	assert(size > page);
+
+	fiber = (Fiber *)malloc(sizeof(Fiber));
+	if (!fiber) {
+		fprintf(stderr, "Warning: fiber_new failed\n");
+		return NULL;
+	}
+
+	stack = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED) {
+		fprintf(stderr, "Warning: fiber_new failed\n");
+		free(fiber);
+		return NULL;
+	}
+
+	// Guard page, stacks grow downward
+	if (mprotect(stack, page, PROT_NONE) != 0) {
+		fprintf(stderr, "Warning: fiber_new failed\n");
+		munmap(stack, size);
+		free(fiber);
+		return NULL;
+	}
+
+	fiber->stack = stack;
+	fiber->stack_size = size;
+	fiber->fn = fn;
+	fiber->arg = arg;
+	fiber->next = NULL;
+
+	fiber_prepare(fiber);
+
+	return fiber;
+}
+
+void fiber_delete(Fiber *fiber)
+{
+	assert(fiber != NULL);
+	assert(fiber->stack != NULL);
+
+	munmap(fiber->stack, fiber->stack_size);
+	free(fiber);
+}
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include "utest.h"
+
+static Fiber main_fiber;
+
+static int counter;
+
+static void count(void *arg)
+{
+	Fiber *self = (Fiber *)arg;
+
+	for (;;) {
+		counter++;
+		fiber_switch(self, &main_fiber);
+	}
+}
+
+static long sum(long n)
+{
+	volatile char pad[64];
+	pad[0] = (char)n;
+	return n == 0 ? pad[0] : n + sum(n - 1);
+}
+
+static long result;
+static bool aligned;
+
+static void recurse(void *arg)
+{
+	Fiber *self = (Fiber *)arg;
+	// The compiler relies on the ABI's stack alignment
+	char buf[16] __attribute__((aligned(16)));
+	uintptr_t addr = (uintptr_t)buf;
+
+	// Hide the address from the compiler, which assumes it is aligned
+	__asm__ volatile ("" : "+r" (addr));
+	aligned = addr % 16 == 0;
+	result = sum(1000);
+	fiber_switch(self, &main_fiber);
+}
+
+// Fibers ping-pong through main_fiber
+static void ping(void *arg)
+{
+	Fiber **fibers = (Fiber **)arg;
+	double x = 1.5;
+
+	for (;;) {
+		counter++;
+		x *= 2;
+		fiber_switch(fibers[0], fibers[1]);
+		// Floating-point state survives a switch
+		assert(x == 1.5 * (1 << counter / 2));
+	}
+}
+
+static void pong(void *arg)
+{
+	Fiber **fibers = (Fiber **)arg;
+
+	for (;;) {
+		counter++;
+		fiber_switch(fibers[1], &main_fiber);
+	}
+}
+
+int main(void)
+{
+	UTEST_INIT;
+
+	Fiber *f, *g, *fibers[2];
+	int i;
+
+	fiber_init_thread(&main_fiber);
+
+	f = fiber_new(NULL, NULL);
+	check_not_equal(f, NULL);
+	f->fn = count;
+	f->arg = f;
+
+	for (i = 0; i < 100; i++) {
+		fiber_switch(&main_fiber, f);
+	}
+	check_equal(counter, 100);
+
+	g = fiber_new(NULL, NULL);
+	check_not_equal(g, NULL);
+	g->fn = recurse;
+	g->arg = g;
+
+	fiber_switch(&main_fiber, g);
+	check_equal(result, 1000L * 1001 / 2);
+	check_equal(aligned, true);
+
+	fiber_delete(f);
+	fiber_delete(g);
+
+	fibers[0] = fiber_new(ping, fibers);
+	fibers[1] = fiber_new(pong, fibers);
+	counter = 0;
+
+	for (i = 0; i < 10; i++) {
+		fiber_switch(&main_fiber, fibers[0]);
+	}
+	check_equal(counter, 20);
+
+	fiber_delete(fibers[0]);
+	fiber_delete(fibers[1]);
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
@@ -0,0 +1,62 @@
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <stddef.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+//==========================================================================//
+//                                                                          //
+//    Fibers: user-level execution contexts with their own stacks           //
+//                                                                          //
+//    Switching between fibers saves the callee-saved registers of the      //
+//    current fiber and restores those of the next (hand-written assembly   //
+//    on x86-64, ucontext elsewhere). Stacks are mapped with a guard page   //
+//    at the low end, so that an overflow faults instead of corrupting      //
+//    neighboring memory.                                                   //
+//                                                                          //
+//    A fiber must not migrate between threads: thread-local (PRIVATE)      //
+//    state is accessed through addresses that the compiler may keep       //
+//    across a switch.                                                      //
+//                                                                          //
+//==========================================================================//
+
+// Stack size of a fiber, including the guard page
+#ifndef FIBER_STACK_SIZE
+#define FIBER_STACK_SIZE (256 * 1024)
+#endif
+
+typedef struct fiber Fiber;
+
+struct fiber {
+#if defined(__x86_64__)
+	// Saved stack pointer while the fiber is not running
+	void *sp;
+#else
+	ucontext_t context;
+#endif
+	// NULL for the fiber of a thread (see fiber_init_thread)
+	void *stack;
+	size_t stack_size;
+	void (*fn)(void *);
+	void *arg;
+	// Free for use by the owner, e.g., to keep fibers in a list
+	Fiber *next;
+};
+
+// Initializes fiber to represent the calling thread on its own stack, so that
+// the thread can switch to other fibers and back
+void fiber_init_thread(Fiber *fiber);
+
+// Creates a fiber that runs fn(arg) on a new stack when first switched to
+// fn must not return
+Fiber *fiber_new(void (*fn)(void *), void *arg);
+
+// Fiber must not be running
+void fiber_delete(Fiber *fiber);
+
+// Suspends the running fiber from and resumes fiber to
+void fiber_switch(Fiber *from, Fiber *to);
+
+#endif // FIBER_H
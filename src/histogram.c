@@ -0,0 +1,370 @@
+// gcc -c tsc.c && gcc -Wall -Wextra -DTEST histogram.c tsc.o -o histogram && ./histogram
+#ifndef NHIST
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+
+PRIVATE struct histogram *histograms;
+
+// HIST_TYPES histograms per worker, for merging at exit
+static struct histogram **buffers;
+static int num_buffers;
+
+static const struct {
+	const char *name;
+	bool ticks; // values are ticks, reported in nanoseconds
+} hist_types[HIST_TYPES] = {
+	[HIST_STEAL_RTT]   = { "steal_rtt",   true  },
+	[HIST_STEAL_TRIES] = { "steal_tries", false },
+	[HIST_RUN_TASK]    = { "run_task",    true  },
+	[HIST_IDLE]        = { "idle",        true  },
+	[HIST_PARKED]      = { "parked",      true  }
+};
+
+#define NUM_PERCENTILES 5
+static const double percentiles[NUM_PERCENTILES] = { 50, 90, 99, 99.9, 99.99 };
+
+static void histogram_init(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = ~0ULL;
+}
+
+static void histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+// Largest value in the bucket that contains the pth percentile
+static unsigned long long histogram_percentile(const struct histogram *h, double p)
+{
+	unsigned long long rank, n = 0, value;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = (unsigned long long)(p / 100 * h->count + 0.5);
+	if (rank == 0) rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		n += h->buckets[i];
+		if (n >= rank) break;
+	}
+
+	assert(i < HIST_BUCKETS);
+
+	value = hist_bucket_high(i);
+	if (value > h->max) value = h->max;
+	if (value < h->min) value = h->min;
+
+	return value;
+}
+
+// Converts value into the unit of the report
+static double hist_value(int type, unsigned long long value)
+{
+	return hist_types[type].ticks ? tsc_usec(value) * 1e3 : (double)value;
+}
+
+int hist_init(int num_workers)
+{
+	assert(num_workers > 0);
+
+	buffers = (struct histogram **)calloc(num_workers, sizeof(struct histogram *));
+	if (!buffers) {
+		fprintf(stderr, "Warning: hist_init failed\n");
+		return -1;
+	}
+
+	num_buffers = num_workers;
+
+	return 0;
+}
+
+int hist_worker_init(int ID)
+{
+	int i;
+
+	assert(buffers != NULL);
+	assert(0 <= ID && ID < num_buffers);
+
+	histograms = (struct histogram *)malloc(HIST_TYPES * sizeof(struct histogram));
+	if (!histograms) {
+		fprintf(stderr, "Warning: hist_worker_init failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < HIST_TYPES; i++) {
+		histogram_init(&histograms[i]);
+	}
+
+	buffers[ID] = histograms;
+
+	return 0;
+}
+
+// Merges the histograms of type of all workers
+static void hist_merge(int type, struct histogram *h)
+{
+	int ID;
+
+	histogram_init(h);
+
+	for (ID = 0; ID < num_buffers; ID++) {
+		if (buffers[ID]) histogram_merge(h, &buffers[ID][type]);
+	}
+}
+
+void hist_report(void)
+{
+	struct histogram *h;
+	int type, i;
+
+	assert(buffers != NULL);
+
+	h = (struct histogram *)malloc(sizeof(struct histogram));
+	if (!h) {
+		fprintf(stderr, "Warning: hist_report failed\n");
+		return;
+	}
+
+	printf("\n");
+	printf("+========================================+\n");
+	printf("|  Histograms (time in ns)               |\n");
+	printf("+========================================+\n");
+
+	for (type = 0; type < HIST_TYPES; type++) {
+		hist_merge(type, h);
+		printf("%s: %llu values", hist_types[type].name, h->count);
+		if (h->count > 0) {
+			printf(", min %.0lf, mean %.0lf", hist_value(type, h->min),
+					hist_value(type, h->sum) / h->count);
+			for (i = 0; i < NUM_PERCENTILES; i++) {
+				printf(", p%g %.0lf", percentiles[i],
+						hist_value(type, histogram_percentile(h, percentiles[i])));
+			}
+			printf(", max %.0lf", hist_value(type, h->max));
+		}
+		printf("\n");
+	}
+
+	fflush(stdout);
+	free(h);
+}
+
+// One row per non-empty bucket
+// worker is -1 for the merged histogram
+static void dump_csv(FILE *f, int type, int worker, const struct histogram *h)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (h->buckets[i] == 0) continue;
+		fprintf(f, "%s,%d,%.1lf,%.1lf,%llu\n", hist_types[type].name, worker,
+				hist_value(type, hist_bucket_low(i)),
+				hist_value(type, i == HIST_BUCKETS-1 ? h->max : hist_bucket_high(i)),
+				h->buckets[i]);
+	}
+}
+
+static void dump_json(FILE *f, int type, int worker, const struct histogram *h, bool first)
+{
+	int i;
+
+	fprintf(f, "%s\n{\"name\":\"%s\",\"unit\":\"%s\",", first ? "" : ",",
+			hist_types[type].name, hist_types[type].ticks ? "ns" : "count");
+	if (worker < 0) fprintf(f, "\"worker\":\"all\",");
+	else fprintf(f, "\"worker\":%d,", worker);
+	fprintf(f, "\"count\":%llu", h->count);
+
+	if (h->count > 0) {
+		fprintf(f, ",\"min\":%.1lf,\"mean\":%.1lf,\"max\":%.1lf", hist_value(type, h->min),
+				hist_value(type, h->sum) / h->count, hist_value(type, h->max));
+		fprintf(f, ",\"percentiles\":{");
+		for (i = 0; i < NUM_PERCENTILES; i++) {
+			fprintf(f, "%s\"%g\":%.1lf", i > 0 ? "," : "", percentiles[i],
+					hist_value(type, histogram_percentile(h, percentiles[i])));
+		}
+		fprintf(f, "}");
+	}
+
+	fprintf(f, ",\"buckets\":[");
+	for (i = 0, first = true; i < HIST_BUCKETS; i++) {
+		if (h->buckets[i] == 0) continue;
+		fprintf(f, "%s[%.1lf,%.1lf,%llu]", first ? "" : ",",
+				hist_value(type, hist_bucket_low(i)),
+				hist_value(type, i == HIST_BUCKETS-1 ? h->max : hist_bucket_high(i)),
+				h->buckets[i]);
+		first = false;
+	}
+	fprintf(f, "]}");
+}
+
+int hist_dump(const char *filename)
+{
+	struct histogram *h;
+	size_t len;
+	bool json;
+	FILE *f;
+	int type, ID;
+
+	assert(buffers != NULL);
+
+	if (!filename) return 0;
+
+	len = strlen(filename);
+	json = len >= 5 && strcmp(filename + len - 5, ".json") == 0;
+
+	h = (struct histogram *)malloc(sizeof(struct histogram));
+	if (!h) {
+		fprintf(stderr, "Warning: hist_dump failed\n");
+		return -1;
+	}
+
+	f = fopen(filename, "w");
+	if (!f) {
+		fprintf(stderr, "Warning: could not open %s\n", filename);
+		free(h);
+		return -1;
+	}
+
+	if (json) fprintf(f, "{\"histograms\":[");
+	else fprintf(f, "histogram,worker,low,high,count\n");
+
+	for (type = 0; type < HIST_TYPES; type++) {
+		hist_merge(type, h);
+		if (json) dump_json(f, type, -1, h, type == 0);
+		else dump_csv(f, type, -1, h);
+		for (ID = 0; ID < num_buffers; ID++) {
+			if (!buffers[ID]) continue;
+			if (json) dump_json(f, type, ID, &buffers[ID][type], false);
+			else dump_csv(f, type, ID, &buffers[ID][type]);
+		}
+	}
+
+	if (json) fprintf(f, "\n]}\n");
+
+	fclose(f);
+	free(h);
+
+	return 0;
+}
+
+void hist_exit(void)
+{
+	int ID;
+
+	for (ID = 0; ID < num_buffers; ID++) {
+		free(buffers[ID]);
+	}
+
+	free(buffers);
+	buffers = NULL;
+	num_buffers = 0;
+	histograms = NULL;
+}
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include "utest.h"
+
+// Number of lines in file
+static int count_lines(const char *filename)
+{
+	char line[4096];
+	int n = 0;
+	FILE *f = fopen(filename, "r");
+
+	assert(f != NULL);
+
+	while (fgets(line, sizeof(line), f)) n++;
+
+	fclose(f);
+
+	return n;
+}
+
+int main(void)
+{
+	UTEST_INIT;
+
+	const char *filename = "/tmp/histogram_test.csv";
+	struct histogram h;
+	unsigned long long v;
+	unsigned int i;
+
+	// Buckets are contiguous and cover all values
+	check_equal(hist_bucket(0), 0);
+	check_equal(hist_bucket(~0ULL), HIST_BUCKETS-1);
+	for (i = 0; i < HIST_BUCKETS-1; i++) {
+		if (hist_bucket_high(i) + 1 != hist_bucket_low(i+1)) break;
+		if (hist_bucket(hist_bucket_low(i)) != i || hist_bucket(hist_bucket_high(i)) != i) break;
+	}
+	check_equal(i, HIST_BUCKETS-1);
+
+	// Bounded relative error
+	for (v = 1; v < (1ULL << 40); v = v * 3 + 1) {
+		i = hist_bucket(v);
+		if (hist_bucket_high(i) - hist_bucket_low(i) > v / HIST_SUB_BUCKETS) break;
+	}
+	check_equal(v >= (1ULL << 40), true);
+
+	histogram_init(&h);
+	for (v = 1; v <= 1000; v++) {
+		histogram_record(&h, v);
+	}
+	check_equal(h.count, 1000);
+	check_equal(h.min, 1);
+	check_equal(h.max, 1000);
+	v = histogram_percentile(&h, 50);
+	check_equal(v >= 500 && v <= 500 + 500 / HIST_SUB_BUCKETS, true);
+	check_equal(histogram_percentile(&h, 100), 1000);
+
+	check_equal(hist_init(2), 0);
+	check_equal(hist_worker_init(0), 0);
+	HIST_RECORD(STEAL_TRIES, 1);
+	HIST_RECORD(STEAL_TRIES, 100);
+	check_equal(hist_worker_init(1), 0);
+	HIST_RECORD(STEAL_TRIES, 1);
+	HIST_RECORD(IDLE, 1000);
+
+	hist_merge(HIST_STEAL_TRIES, &h);
+	check_equal(h.count, 3);
+	check_equal(h.buckets[1], 2);
+	check_equal(histogram_percentile(&h, 50), 1);
+	check_equal(histogram_percentile(&h, 99), 100);
+
+	hist_report();
+
+	// Header, 2 buckets merged, 1 + 1 per worker, 1 idle merged, 1 per worker
+	check_equal(hist_dump(filename), 0);
+	check_equal(count_lines(filename), 1 + 2 + 2 + 1 + 1 + 1);
+	remove(filename);
+
+	hist_exit();
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
+
+#endif // NHIST
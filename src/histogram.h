@@ -0,0 +1,125 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+//==========================================================================//
+//                                                                          //
+//    Latency histograms                                                    //
+//                                                                          //
+//    Every worker records values into private, log-bucketed histograms:    //
+//    each power of two is divided into HIST_SUB_BUCKETS linear buckets,    //
+//    which bounds the relative error of a recorded value (HDR-style). At   //
+//    exit, the histograms of all workers are merged into a percentile      //
+//    report, and optionally written to a CSV or JSON file.                 //
+//                                                                          //
+//    Compile with -DNHIST to remove histograms altogether.                 //
+//                                                                          //
+//==========================================================================//
+
+enum {
+	HIST_STEAL_RTT,   // Time from sending a steal request to receiving tasks
+	HIST_STEAL_TRIES, // Number of forwards before a steal request succeeds
+	HIST_RUN_TASK,    // Time spent in run_task, including nested tasks
+	HIST_IDLE,        // Time from running out of tasks to receiving tasks
+	HIST_PARKED,      // Time spent in the idle state (see WAIT)
+	HIST_TYPES
+};
+
+#ifdef NHIST
+
+#define HIST_INIT(n)                   ((void)0)
+#define HIST_WORKER_INIT(id)           ((void)0)
+#define HIST_TICKS(var)
+#define HIST_RECORD(type, value)       ((void)0)
+#define HIST_RECORD_SINCE(type, var)   ((void)0)
+#define HIST_REPORT()                  ((void)0)
+#define HIST_DUMP(filename)            ((void)0)
+#define HIST_EXIT()                    ((void)0)
+
+#else
+
+#include "platform.h"
+#include "tsc.h"
+
+// Number of linear buckets per power of two, at most 1/HIST_SUB_BUCKETS
+// relative error
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) * HIST_SUB_BUCKETS)
+
+struct histogram {
+	unsigned long long count, sum;
+	unsigned long long min, max;
+	unsigned long long buckets[HIST_BUCKETS];
+};
+
+extern PRIVATE struct histogram *histograms;
+
+// Must be called before workers start
+int hist_init(int num_workers);
+
+// Called by every worker
+int hist_worker_init(int ID);
+
+// Must be called after all workers have finished
+void hist_report(void);
+
+// Writes JSON if filename ends in .json, CSV otherwise
+int hist_dump(const char *filename);
+
+void hist_exit(void);
+
+static inline unsigned int hist_bucket(unsigned long long value)
+{
+	int shift;
+
+	if (value < HIST_SUB_BUCKETS)
+		return value;
+
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+
+	return shift * HIST_SUB_BUCKETS + (value >> shift);
+}
+
+// Smallest value in bucket
+static inline unsigned long long hist_bucket_low(unsigned int bucket)
+{
+	int shift;
+
+	if (bucket < 2 * HIST_SUB_BUCKETS)
+		return bucket;
+
+	shift = bucket / HIST_SUB_BUCKETS - 1;
+
+	return (unsigned long long)(bucket - shift * HIST_SUB_BUCKETS) << shift;
+}
+
+// Largest value in bucket
+static inline unsigned long long hist_bucket_high(unsigned int bucket)
+{
+	return bucket == HIST_BUCKETS-1 ? ~0ULL : hist_bucket_low(bucket + 1) - 1;
+}
+
+static inline void histogram_record(struct histogram *h, unsigned long long value)
+{
+	h->buckets[hist_bucket(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value < h->min) h->min = value;
+	if (value > h->max) h->max = value;
+}
+
+#define HIST_INIT(n)                   hist_init(n)
+#define HIST_WORKER_INIT(id)           hist_worker_init(id)
+// Declares var and sets it to the current time in ticks
+#define HIST_TICKS(var)                unsigned long long var = tsc_read()
+// Workers without histograms (see hist_worker_init) don't record values
+#define HIST_RECORD(type, value) \
+	(histograms ? histogram_record(&histograms[HIST_##type], value) : (void)0)
+#define HIST_RECORD_SINCE(type, var)   HIST_RECORD(type, tsc_read() - (var))
+#define HIST_REPORT()                  hist_report()
+#define HIST_DUMP(filename)            hist_dump(filename)
+#define HIST_EXIT()                    hist_exit()
+
+#endif // NHIST
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,252 @@
+// gcc -c topology.c && gcc -Wall -Wextra -DTEST placement.c topology.o -o placement && ./placement
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "placement.h"
+#include "topology.h"
+#include "worker_tree.h"
+
+// Sort key of a CPU; CPUs are compared lexicographically by key
+struct cpu_key {
+	int key[4];
+	int cpu;
+};
+
+static int cpu_key_cmp(const void *a, const void *b)
+{
+	const struct cpu_key *x = (const struct cpu_key *)a;
+	const struct cpu_key *y = (const struct cpu_key *)b;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (x->key[i] != y->key[i]) return x->key[i] < y->key[i] ? -1 : 1;
+	}
+
+	return x->cpu - y->cpu;
+}
+
+// Number of CPUs preceding cpu that share its group at level, and, if other
+// is a level above, belong to different groups at level other. Used to rank
+// hardware threads within a core and cores within a socket.
+static int rank(const int *cpus, int num_cpus, int cpu, int level, int other)
+{
+	int i, j, n = 0;
+
+	for (i = 0; i < num_cpus && cpus[i] < cpu; i++) {
+		if (other < 0) {
+			if (topology_group(cpus[i], level) == topology_group(cpu, level)) n++;
+		} else if (topology_group(cpus[i], other) == topology_group(cpu, other)
+				&& topology_group(cpus[i], level) != topology_group(cpu, level)) {
+			// Count each group at level only once
+			for (j = 0; j < i; j++) {
+				if (topology_group(cpus[j], level) == topology_group(cpus[i], level)) break;
+			}
+			if (j == i) n++;
+		}
+	}
+
+	return n;
+}
+
+// Sort CPUs according to policy
+static void sort_cpus(int *sorted, const int *cpus, int num_cpus, int policy)
+{
+	struct cpu_key *keys = (struct cpu_key *)malloc(num_cpus * sizeof(struct cpu_key));
+	int i;
+
+	assert(keys != NULL);
+
+	for (i = 0; i < num_cpus; i++) {
+		int cpu = cpus[i];
+		int socket = topology_group(cpu, TOPO_SOCKET);
+		int llc = topology_group(cpu, TOPO_LLC);
+		int core = topology_group(cpu, TOPO_CORE);
+		int thread = rank(cpus, num_cpus, cpu, TOPO_CORE, -1);
+		struct cpu_key *k = &keys[i];
+		switch (policy) {
+		case PLACEMENT_COMPACT:
+			*k = (struct cpu_key){ { socket, llc, core, 0 }, cpu };
+			break;
+		case PLACEMENT_CORES:
+			*k = (struct cpu_key){ { thread, socket, llc, core }, cpu };
+			break;
+		case PLACEMENT_SCATTER:
+			*k = (struct cpu_key){ { thread, rank(cpus, num_cpus, cpu, TOPO_CORE, TOPO_SOCKET), socket, 0 }, cpu };
+			break;
+		default:
+			*k = (struct cpu_key){ { 0, 0, 0, 0 }, cpu };
+			break;
+		}
+	}
+
+	qsort(keys, num_cpus, sizeof(struct cpu_key), cpu_key_cmp);
+
+	for (i = 0; i < num_cpus; i++) {
+		sorted[i] = keys[i].cpu;
+	}
+
+	free(keys);
+}
+
+// Preorder traversal of the worker tree: every subtree occupies a contiguous
+// range of order
+static void preorder(int ID, int maxID, int *order, int *n)
+{
+	if (ID == -1) return;
+
+	order[(*n)++] = ID;
+	preorder(left_child(ID, maxID), maxID, order, n);
+	preorder(right_child(ID, maxID), maxID, order, n);
+}
+
+// Parse a list of CPUs such as "0,2,4-7" and keep the ones that are allowed
+// Returns the number of CPUs in list, or 0 if the list is malformed
+static int parse_cpu_list(const char *str, int *list, int max,
+		const int *cpus, int num_cpus)
+{
+	const char *s = str;
+	int n = 0;
+
+	while (*s) {
+		char *end;
+		long first = strtol(s, &end, 10), last, cpu;
+		if (end == s || first < 0) return 0;
+		last = first;
+		s = end;
+		if (*s == '-') {
+			s++;
+			last = strtol(s, &end, 10);
+			if (end == s || last < first) return 0;
+			s = end;
+		}
+		for (cpu = first; cpu <= last; cpu++) {
+			int i;
+			for (i = 0; i < num_cpus && cpus[i] != cpu; i++);
+			if (i == num_cpus) {
+				fprintf(stderr, "Warning: CPU %ld is not available\n", cpu);
+			} else if (n < max) {
+				list[n++] = cpu;
+			}
+		}
+		if (*s == ',') s++;
+		else if (*s) return 0;
+	}
+
+	return n;
+}
+
+int placement_init(int *worker_cpus, int num_workers,
+		const int *cpus, int num_cpus, const char *policy)
+{
+	int *sorted, *order;
+	int p = PLACEMENT_LINEAR, n = num_cpus, i;
+
+	assert(num_workers > 0 && num_cpus > 0);
+
+	sorted = (int *)malloc(num_cpus * sizeof(int));
+	assert(sorted != NULL);
+
+	if (!policy || strcmp(policy, "linear") == 0) {
+		p = PLACEMENT_LINEAR;
+	} else if (strcmp(policy, "compact") == 0) {
+		p = PLACEMENT_COMPACT;
+	} else if (strcmp(policy, "cores") == 0) {
+		p = PLACEMENT_CORES;
+	} else if (strcmp(policy, "scatter") == 0) {
+		p = PLACEMENT_SCATTER;
+	} else if ((n = parse_cpu_list(policy, sorted, num_cpus, cpus, num_cpus)) > 0) {
+		p = PLACEMENT_LIST;
+	} else {
+		fprintf(stderr, "Warning: unknown placement policy '%s'\n", policy);
+		p = PLACEMENT_LINEAR;
+		n = num_cpus;
+	}
+
+	if (p != PLACEMENT_LIST) {
+		sort_cpus(sorted, cpus, num_cpus, p);
+	}
+
+	if (p == PLACEMENT_COMPACT || p == PLACEMENT_CORES) {
+		order = (int *)malloc(num_workers * sizeof(int));
+		assert(order != NULL);
+		i = 0;
+		preorder(0, num_workers-1, order, &i);
+		assert(i == num_workers);
+		// The k-th worker in preorder runs on the k-th CPU
+		for (i = 0; i < num_workers; i++) {
+			worker_cpus[order[i]] = sorted[i % n];
+		}
+		free(order);
+	} else {
+		for (i = 0; i < num_workers; i++) {
+			worker_cpus[i] = sorted[i % n];
+		}
+	}
+
+	free(sorted);
+
+	return p;
+}
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include <unistd.h>
+#include "utest.h"
+
+#define N 8 // Number of workers
+
+int main(void)
+{
+	UTEST_INIT;
+
+	int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int *cpus = (int *)malloc(num_cpus * sizeof(int));
+	int worker_cpus[N];
+	int i;
+
+	for (i = 0; i < num_cpus; i++) {
+		cpus[i] = i;
+	}
+
+	topology_init(num_cpus);
+
+	check_equal(placement_init(worker_cpus, N, cpus, num_cpus, NULL), PLACEMENT_LINEAR);
+	for (i = 0; i < N; i++) {
+		check_equal(worker_cpus[i], i % num_cpus);
+	}
+
+	check_equal(placement_init(worker_cpus, N, cpus, num_cpus, "compact"), PLACEMENT_COMPACT);
+	// Worker 0 and its left child are neighbors in preorder
+	if (num_cpus > 1) {
+		check_equal(topology_group(worker_cpus[1], TOPO_SOCKET),
+				topology_group(worker_cpus[0], TOPO_SOCKET));
+	}
+
+	check_equal(placement_init(worker_cpus, N, cpus, num_cpus, "cores"), PLACEMENT_CORES);
+	check_equal(placement_init(worker_cpus, N, cpus, num_cpus, "scatter"), PLACEMENT_SCATTER);
+	for (i = 0; i < N; i++) {
+		check_equal(0 <= worker_cpus[i] && worker_cpus[i] < num_cpus, true);
+	}
+
+	check_equal(placement_init(worker_cpus, N, cpus, num_cpus, "0"), PLACEMENT_LIST);
+	for (i = 0; i < N; i++) {
+		check_equal(worker_cpus[i], 0);
+	}
+
+	check_equal(placement_init(worker_cpus, N, cpus, num_cpus, "0-"), PLACEMENT_LINEAR);
+
+	topology_exit();
+	free(cpus);
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
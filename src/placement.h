@@ -0,0 +1,38 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+//==========================================================================//
+//                                                                          //
+//    Worker placement                                                      //
+//                                                                          //
+//    Maps worker IDs to CPUs. The policy is selected with the environment  //
+//    variable TASKING_PLACEMENT:                                           //
+//                                                                          //
+//    linear   Worker i runs on the i-th allowed CPU (default)              //
+//    compact  Fill cores, then LLCs, then sockets                          //
+//    cores    Like compact, but one thread per physical core first         //
+//    scatter  Spread workers across sockets and cores                      //
+//    <list>   Explicit list of CPUs, e.g. "0,2,4-7"                        //
+//                                                                          //
+//    compact and cores follow the layout of the worker tree (see           //
+//    worker_tree.h): every subtree gets a contiguous range of CPUs, so     //
+//    that parents and children share caches where possible.                //
+//                                                                          //
+//==========================================================================//
+
+enum {
+	PLACEMENT_LINEAR,
+	PLACEMENT_COMPACT,
+	PLACEMENT_CORES,
+	PLACEMENT_SCATTER,
+	PLACEMENT_LIST
+};
+
+// Compute worker_cpus[0..num_workers-1] from the allowed CPUs
+// cpus[0..num_cpus-1] (in ascending order) according to policy, which may be
+// NULL. Requires topology_init. Returns the policy that was applied, which is
+// PLACEMENT_LINEAR if policy is not recognized.
+int placement_init(int *worker_cpus, int num_workers,
+		const int *cpus, int num_cpus, const char *policy);
+
+#endif // PLACEMENT_H
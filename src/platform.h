@@ -1,12 +1,16 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
-#define MAXWORKERS 32
+// Upper bound on the number of workers (-DMAXWORKERS=n)
+#ifndef MAXWORKERS
+#define MAXWORKERS 1024
+#endif
 
 #define PRIVATE __thread
 
 // Supported work-stealing strategies (-DSTEAL=[one|half|adaptive])
 // Default is stealing one task at a time (-DSTEAL=one)
+// Can be changed at run time with TASKING_STEAL
 #define one 3
 
 #ifndef STEAL
@@ -15,6 +19,7 @@
 
 // Supported loop-splitting strategies (-DSPLIT=[half|guided|adaptive])
 // Default is split-half (-DSPLIT=half)
+// Can be changed at run time with TASKING_SPLIT
 #define half 0
 #define guided 1
 #define adaptive 2
@@ -23,9 +28,17 @@
 #define SPLIT half
 #endif
 
-// Supported worker backoff strategies (-DBACKOFF=[sleep_exp|wait_cond])
+// Supported worker backoff strategies (-DBACKOFF=[sleep_exp|wait_cond|wait_futex])
 #define sleep_exp 4
 #define wait_cond 5
+#define wait_futex 6
+
+// Hint to the processor that we are in a spin-wait loop
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
 
 #define UNUSED(x) x __attribute__((unused))
 
@@ -25,11 +25,11 @@
 #define PROFILE_DECL_SEND_RECV_REQ     PRIVATE mytimer_t timer_send_recv_sreqs
 #define PROFILE_DECL_IDLE              PRIVATE mytimer_t timer_idle
 
-#define PROFILE_INIT_RUN_TASK()        timer_new(&timer_run_tasks, CPUFREQ)
-#define PROFILE_INIT_ENQ_DEQ_TASK()    timer_new(&timer_enq_deq_tasks, CPUFREQ)
-#define PROFILE_INIT_SEND_RECV_TASK()  timer_new(&timer_send_recv_tasks, CPUFREQ)
-#define PROFILE_INIT_SEND_RECV_REQ()   timer_new(&timer_send_recv_sreqs, CPUFREQ)
-#define PROFILE_INIT_IDLE()            timer_new(&timer_idle, CPUFREQ)
+#define PROFILE_INIT_RUN_TASK()        timer_new(&timer_run_tasks)
+#define PROFILE_INIT_ENQ_DEQ_TASK()    timer_new(&timer_enq_deq_tasks)
+#define PROFILE_INIT_SEND_RECV_TASK()  timer_new(&timer_send_recv_tasks)
+#define PROFILE_INIT_SEND_RECV_REQ()   timer_new(&timer_send_recv_sreqs)
+#define PROFILE_INIT_IDLE()            timer_new(&timer_idle)
 
 #define PROFILE_START_RUN_TASK()       timer_start(&timer_run_tasks)
 #define PROFILE_START_ENQ_DEQ_TASK()   timer_start(&timer_enq_deq_tasks)
@@ -51,28 +51,10 @@
   #define PROFILE(x)                   BLOCK(PROFILE_START(x), PROFILE_STOP(x))
   #define PROFILE_EXTERN_DECL(x)       PROFILE_EXTERN_DECL_##x
   #define PROFILE_DECL(x)              PROFILE_DECL_##x
-  #define PROFILE_RESULTS() \
-	/* Parsable format */ \
-	/* The first value should make it easy to grep for these lines, e.g. with */ \
-	/* ./a.out | grep Timer | cut -d, -f2- */ \
-	/* Worker ID, Task, Send/Recv Req, Send/Recv Task, Enq/Deq Task, Idle, Total */ \
-	printf("Timer,%d,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf\n", ID, \
-		   timer_elapsed  (&timer_run_tasks,       timer_us), \
-		   timer_elapsed  (&timer_send_recv_sreqs, timer_us), \
-		   timer_elapsed  (&timer_send_recv_tasks, timer_us), \
-		   timer_elapsed  (&timer_enq_deq_tasks,   timer_us), \
-		   timer_elapsed  (&timer_idle,            timer_us), \
-		   timers_elapsed (&timer_run_tasks,       timer_us, \
-			               &timer_send_recv_sreqs, \
-						   &timer_send_recv_tasks, \
-						   &timer_enq_deq_tasks, \
-						   &timer_idle, \
-						   NULL))
 #else
   #define PROFILE(x)                   ((void)0); // removes the loop
   #define PROFILE_EXTERN_DECL(x)
   #define PROFILE_DECL(x)
-  #define PROFILE_RESULTS()
 #endif
 
 #endif // PROFILE_H
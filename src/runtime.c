@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,18 +9,40 @@
 #include "bit.h"
 #include "channel.h"
 #include "deque.h"
+#include "fiber.h"
 #include "profile.h"
 #include "runtime.h"
+#include "task_alloc.h"
+#include "tsc.h"
 #include "worker_tree.h"
 
 // Private task deque
 static PRIVATE Deque *deque;
 
-// Worker -> worker: steal requests (MPSC)
-static Channel *chan_requests[MAXWORKERS];
+// Shared state lives in the worker's pool (see struct RT_pool), every worker
+// keeps pointers to it
+
+// Worker -> worker: steal requests (lock-free MPSC or MPMC)
+static PRIVATE Channel **chan_requests;
 
 // Worker -> worker: tasks (SPSC)
-static Channel *chan_tasks[MAXWORKERS][MAXSTEAL];
+static PRIVATE Channel *(*chan_tasks)[MAXSTEAL];
+
+// Any thread -> workers: injected tasks (see RT_inject)
+struct inject_queue {
+	pthread_mutex_t lock;
+	Task *head, *tail;
+	// Task objects of injected tasks are allocated here
+	TaskAllocator alloc;
+	// Number of injected tasks that are queued or run by detached workers
+	// (see RECV_INJECTED); termination requires that there are none
+	unsigned int pending;
+};
+
+static PRIVATE struct inject_queue *inject;
+
+// Cheap check before taking the lock
+#define INJECTED() (__atomic_load_n(&inject->head, __ATOMIC_SEQ_CST) != NULL)
 
 static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -31,6 +54,27 @@ do { \
 	pthread_mutex_unlock(&print_lock); \
 } while (0)
 
+// Idle state
+// A worker enters the idle state when it has sent its steal request to its
+// parent, after both of its subtrees have become idle. It stays there until
+// its parent sends it tasks (or a task is injected), so idle workers take no
+// part in work stealing. Time spent in the idle state is counted in ticks
+// (see tsc.h).
+PRIVATE unsigned int idle_entered, idle_blocked;
+PRIVATE unsigned long long idle_ticks;
+
+// Declares var and sets it to the time of entering the idle state
+#define IDLE_ENTER(var) \
+	unsigned long long var = tsc_read(); \
+	idle_entered++
+
+#define IDLE_EXIT(var) \
+do { \
+	unsigned long long __ticks = tsc_read() - (var); \
+	idle_ticks += __ticks; \
+	HIST_RECORD(PARKED, __ticks); \
+} while (0)
+
 #if BACKOFF == sleep_exp
 
 static PRIVATE useconds_t backoff_duration = 1;
@@ -39,22 +83,29 @@ static PRIVATE useconds_t backoff_duration = 1;
 do { \
 	PRINTF("Worker %d backing off for %d us\n", ID, backoff_duration); \
 	/* "Spurious wakeups" are handled in schedule */ \
+	TRACE(PARK, -1, 0, 0); \
+	IDLE_ENTER(__idle_start); \
+	idle_blocked++; \
 	usleep(backoff_duration); \
+	IDLE_EXIT(__idle_start); \
+	TRACE(WAKE, -1, 0, 0); \
 	/* Exponential backoff */ \
 	backoff_duration = min(backoff_duration * 2, (useconds_t)1000000); \
 } while (0)
 
 #endif // BACKOFF == sleep_exp
 
-#if BACKOFF == wait_cond
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
 
-struct backoff_t {
-	pthread_mutex_t lock;
-	pthread_cond_t signal;
-	char __[128 - sizeof(pthread_mutex_t) - sizeof(pthread_cond_t)];
-};
+// Number of microseconds a worker spins in the idle state before it blocks
+// (-DIDLE_SPIN=n), can be changed at run time with TASKING_IDLE_SPIN
+// Spinning lets a worker resume within microseconds if work arrives shortly
+// after it has become idle, blocking saves CPU time during longer gaps.
+#ifndef IDLE_SPIN
+#define IDLE_SPIN 50
+#endif
 
-static struct backoff_t backoff[MAXWORKERS];
+static unsigned int idle_spin = IDLE_SPIN;
 
 static inline bool peek(Channel *chan[])
 {
@@ -71,25 +122,145 @@ static inline bool peek(Channel *chan[])
 	return ret;
 }
 
-#define WAIT() \
+#define HAS_WORK() (peek(chan_tasks[ID]) || INJECTED())
+
+// Returns true if work arrives within idle_spin microseconds
+static inline bool idle_spin_wait(void)
+{
+	unsigned long long start, limit;
+	unsigned int i;
+
+	if (idle_spin == 0)
+		return HAS_WORK();
+
+	start = tsc_read();
+	limit = (unsigned long long)(idle_spin * tsc_ticks_per_usec);
+
+	for (i = 1; !HAS_WORK(); i++) {
+		CPU_RELAX();
+		// Reading the clock is more expensive than checking for work
+		if (i % 64 == 0 && tsc_read() - start >= limit)
+			return false;
+	}
+
+	return true;
+}
+
+#endif // BACKOFF == wait_cond || BACKOFF == wait_futex
+
+#if BACKOFF == wait_cond
+
+struct backoff_t {
+	pthread_mutex_t lock;
+	pthread_cond_t signal;
+	// True while the worker is blocked (or about to block)
+	bool parked;
+	char __[128 - sizeof(pthread_mutex_t) - sizeof(pthread_cond_t) - sizeof(bool)];
+};
+
+static PRIVATE struct backoff_t *backoff;
+
+// Announce that we are going to block before checking for work one last time.
+// Together with the fence in SIGNAL (or RT_inject), either we see the work,
+// or the signaling thread sees that we are parked and wakes us up.
+static inline void idle_block(void)
+{
+	pthread_mutex_lock(&backoff[ID].lock);
+	while (!HAS_WORK()) {
+		__atomic_store_n(&backoff[ID].parked, true, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (HAS_WORK()) break;
+		pthread_cond_wait(&backoff[ID].signal, &backoff[ID].lock);
+	}
+	__atomic_store_n(&backoff[ID].parked, false, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&backoff[ID].lock);
+}
+
+// No locking unless worker id is parked
+#define SIGNAL(id) \
 do { \
-	/* Locking happens in decline_steal_request */ \
-	PRINTF("Worker %d backing off\n", ID); \
-	while (!peek(chan_tasks[ID])) { \
-		pthread_cond_wait(&backoff[ID].signal, &backoff[ID].lock); \
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); \
+	if (__atomic_load_n(&backoff[id].parked, __ATOMIC_RELAXED) && \
+		__atomic_exchange_n(&backoff[id].parked, false, __ATOMIC_SEQ_CST)) { \
+		PRINTF("Worker %d signaling worker %d\n", ID, id); \
+		pthread_mutex_lock(&backoff[id].lock); \
+		pthread_cond_signal(&backoff[id].signal); \
+		pthread_mutex_unlock(&backoff[id].lock); \
 	} \
-	/* Unlocking happens in decline_steal_request */ \
 } while (0)
 
+#endif // BACKOFF == wait_cond
+
+#if BACKOFF == wait_futex
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+struct backoff_t {
+	// Futex word, 1 while the worker is parked (or about to park)
+	int parked;
+	char __[64 - sizeof(int)];
+};
+
+static PRIVATE struct backoff_t *backoff;
+
+static inline void futex_wait(int *addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void futex_wake(int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Announce that we are going to park before checking for work one last time.
+// Together with the fence in SIGNAL (or RT_inject), either we see the work,
+// or the signaling thread sees that we are parked and wakes us up.
+static inline void idle_block(void)
+{
+	while (!HAS_WORK()) {
+		__atomic_store_n(&backoff[ID].parked, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (HAS_WORK()) {
+			__atomic_store_n(&backoff[ID].parked, 0, __ATOMIC_RELAXED);
+			break;
+		}
+		// Returns immediately if we have been signaled in the meantime
+		futex_wait(&backoff[ID].parked, 1);
+		__atomic_store_n(&backoff[ID].parked, 0, __ATOMIC_RELAXED);
+	}
+}
+
+// No system call unless worker id is parked
 #define SIGNAL(id) \
 do { \
-	PRINTF("Worker %d signaling worker %d\n", ID, id); \
-	pthread_mutex_lock(&backoff[id].lock); \
-	pthread_cond_signal(&backoff[id].signal); \
-	pthread_mutex_unlock(&backoff[id].lock); \
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); \
+	if (__atomic_load_n(&backoff[id].parked, __ATOMIC_RELAXED) && \
+		__atomic_exchange_n(&backoff[id].parked, 0, __ATOMIC_SEQ_CST)) { \
+		PRINTF("Worker %d signaling worker %d\n", ID, id); \
+		futex_wake(&backoff[id].parked); \
+	} \
 } while (0)
 
-#endif // BACKOFF == wait_cond
+#endif // BACKOFF == wait_futex
+
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
+
+// Spin for a short while, then block until there is work
+#define WAIT() \
+do { \
+	PRINTF("Worker %d backing off\n", ID); \
+	TRACE(PARK, -1, 0, 0); \
+	IDLE_ENTER(__idle_start); \
+	if (!idle_spin_wait()) { \
+		idle_blocked++; \
+		idle_block(); \
+	} \
+	IDLE_EXIT(__idle_start); \
+	TRACE(WAKE, -1, 0, 0); \
+} while (0)
+
+#endif // BACKOFF == wait_cond || BACKOFF == wait_futex
 
 #define BOUNDED_STACK_ELEM_TYPE Channel *
 #include "bounded_stack.h"
@@ -136,47 +307,66 @@ typedef unsigned char state_t;
 #define STATE_IDLE     0x02
 #define STATE_FAILED   0x04
 
-#define INIT_VICTIMS (0xFFFFFFFF & BIT_MASK_32(num_workers))
-
 struct steal_request {
 	Channel *chan;  // channel for sending tasks
 	int ID;			// ID of requesting worker
 	int try;	   	// 0 <= try <= num_workers_rt
-	unsigned int victims; // Bit field of potential victims
+	unsigned char slot; // index of bit set of potential victims (see VICTIMS)
 	state_t state;  // state of steal request and, by extension, requesting worker
-#if STEAL == adaptive
 	bool stealhalf; // true ? attempt steal-half : attempt steal-one
-	char __[2];     // pad to cache line
-#else
-	char __[3];	    // pad to cache line
-#endif
+	char __[5];     // pad to cache line
 };
 
-#if STEAL == adaptive
-#define STEAL_REQUEST_INIT_stealhalf , .stealhalf = stealhalf
-#else
-#define STEAL_REQUEST_INIT_stealhalf
-#endif
+/*
+ * Potential victims are kept in a bit set with one bit per worker. With up to
+ * MAXWORKERS workers, the bit set is too large to travel with every steal
+ * request, so it stays behind in victim_sets: worker i owns victim_sets[i],
+ * one bit set per outstanding steal request. A steal request only carries the
+ * index (slot) of its bit set, which is accessed exclusively by the worker
+ * currently holding the steal request. Sending a steal request hands over the
+ * bit set along with it.
+ */
+
+typedef unsigned long VictimSet[BITSET_WORDS(MAXWORKERS)];
+
+static PRIVATE VictimSet (*victim_sets)[MAXSTEAL];
+
+// Number of words in use
+#define VICTIM_WORDS BITSET_WORDS(num_workers)
 
+#define VICTIMS(req) (victim_sets[(req)->ID][(req)->slot])
+
+#define INIT_VICTIMS(req) bitset_fill(VICTIMS(req), num_workers)
+
+// Requires INIT_VICTIMS to complete initialization
 #define STEAL_REQUEST_INIT \
 (struct steal_request) { \
 	.chan = CHANNEL_POP(), \
 	.ID = ID, \
 	.try = 0, \
-	.victims = INIT_VICTIMS, \
-	.state = STATE_WORKING \
-	STEAL_REQUEST_INIT_stealhalf \
+	.state = STATE_WORKING, \
+	.stealhalf = stealhalf \
+}
+
+// Each of the MAXSTEAL channels of a worker is associated with one bit set
+// of potential victims
+static inline unsigned char victims_slot(Channel *chan)
+{
+	int i;
+
+	for (i = 0; i < MAXSTEAL; i++) {
+		if (chan_tasks[ID][i] == chan) break;
+	}
+
+	assert(i < MAXSTEAL);
+
+	return i;
 }
 
 static inline void print_steal_req(struct steal_request *req)
 {
-#if STEAL == adaptive
 	PRINTF("{ .ID = %d, .try = %d, .state = %d, .stealhalf = %s }\n",
 		   req->ID, req->try, req->state, req->stealhalf ? "true" : "false");
-#else
-	PRINTF("{ .ID = %d, .try = %d, .state = %d }\n",
-		   req->ID, req->try, req->state);
-#endif
 }
 
 #define BOUNDED_QUEUE_ELEM_TYPE struct steal_request
@@ -198,9 +388,89 @@ static PRIVATE int requested;
 // requests and send the remaining one to its parent
 static PRIVATE int dropped_steal_requests;
 
+#ifndef NHIST
+// When the steal request for each of the MAXSTEAL channels was sent, to
+// measure round-trip times (see histogram.h)
+static PRIVATE unsigned long long steal_request_sent[MAXSTEAL];
+#endif
+
 // Worker tree related information is collected in this struct
 static PRIVATE WorkerTree tree;
 
+// A worker that waits for tasks from its parent can be woken up by an
+// injected task (see RT_inject). It runs injected tasks while its parent still
+// considers it idle (detached), so it must not share work with its children,
+// and counts as pending until it waits for tasks again.
+static PRIVATE bool detached;
+
+// Take the next injected task, if any
+static inline bool RECV_INJECTED(Task **task)
+{
+	Task *t;
+
+	if (!INJECTED())
+		return false;
+
+	pthread_mutex_lock(&inject->lock);
+	t = inject->head;
+	if (t) {
+		__atomic_store_n(&inject->head, t->next, __ATOMIC_SEQ_CST);
+		if (!t->next) inject->tail = NULL;
+		t->next = NULL;
+	}
+	pthread_mutex_unlock(&inject->lock);
+
+	if (!t)
+		return false;
+
+	if (tree.waiting_for_tasks && !detached) {
+		// The task stays pending until we wait for tasks again
+		detached = true;
+	} else {
+		__atomic_sub_fetch(&inject->pending, 1, __ATOMIC_SEQ_CST);
+	}
+
+	*task = t;
+
+	return true;
+}
+
+// Called when a detached worker closes its lifeline or waits again
+static inline void reattach(void)
+{
+	if (detached) {
+		detached = false;
+		__atomic_sub_fetch(&inject->pending, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+#ifndef STEAL_EARLY_THRESHOLD
+#define STEAL_EARLY_THRESHOLD 0
+#endif
+
+// Scheduling policies, chosen once before workers start (see RT_configure)
+// Compile-time settings provide the defaults
+int steal_policy = STEAL;
+static int split_policy = SPLIT;
+#ifdef STEAL_EARLY
+static bool steal_early = true;
+#else
+static bool steal_early = false;
+#endif
+// Only used if steal_early is true
+static unsigned int steal_early_threshold = STEAL_EARLY_THRESHOLD;
+
+// Number of steals after which the current strategy is reevaluated
+#ifndef STEAL_ADAPTIVE_INTERVAL
+#define STEAL_ADAPTIVE_INTERVAL 25
+#endif
+static PRIVATE unsigned int num_recent_steals;
+// Fixed unless steal_policy == adaptive
+static PRIVATE bool stealhalf;
+PRIVATE unsigned int requests_steal_one, requests_steal_half;
+
+static const char *policy_name(int policy);
+
 #ifdef STEAL_LASTVICTIM
 // ID of last victim
 static PRIVATE int last_victim = -1;
@@ -211,10 +481,36 @@ static PRIVATE int last_victim = -1;
 static PRIVATE int last_thief = -1;
 #endif
 
-static inline void print_victims(unsigned int victims, int ID)
+#ifdef STEAL_TOPOLOGY
+#include "topology.h"
+
+// Workers close to worker i at each level of the machine hierarchy, not
+// including worker i itself (see topology.h)
+static PRIVATE VictimSet (*neighbors)[MAXWORKERS];
+static PRIVATE int (*num_neighbors)[MAXWORKERS];
+
+static void init_neighbors(void)
+{
+	int level, i;
+
+	for (level = 0; level < TOPO_LEVELS; level++) {
+		int group = topology_group(worker_cpus[ID], level);
+		memset(neighbors[level][ID], 0, sizeof(VictimSet));
+		num_neighbors[level][ID] = 0;
+		for (i = 0; i < num_workers; i++) {
+			if (i != ID && topology_group(worker_cpus[i], level) == group) {
+				bitset_set(neighbors[level][ID], i);
+				num_neighbors[level][ID]++;
+			}
+		}
+	}
+}
+#endif // STEAL_TOPOLOGY
+
+static inline void print_victims(unsigned long *victims, int ID)
 {
-#define VICTIM(victims, n) (((victims) & BIT(n)) != 0 ? '1' : '0')
-	assert(1 <= num_workers && num_workers <= 32);
+#define VICTIM(victims, n) (bitset_test(victims, n) ? '1' : '0')
+	assert(1 <= num_workers && num_workers <= MAXWORKERS);
 
 	int i;
 
@@ -222,11 +518,7 @@ static inline void print_victims(unsigned int victims, int ID)
 
 	printf("victims[%2d] = ", ID);
 
-	for (i = 31; i > num_workers-1; i--) {
-		putchar('.');
-	}
-
-	for (; i > 0; i--) {
+	for (i = num_workers-1; i > 0; i--) {
 		putchar(VICTIM(victims, i));
 	}
 
@@ -236,7 +528,7 @@ static inline void print_victims(unsigned int victims, int ID)
 #undef VICTIM
 }
 
-static inline void mark_as_idle(unsigned int *victims, int n)
+static inline void mark_as_idle(unsigned long *victims, int n)
 // requires victims != NULL
 // requires -1 <= n < num_workers
 {
@@ -246,15 +538,17 @@ static inline void mark_as_idle(unsigned int *victims, int n)
 	mark_as_idle(victims, left_child(n, num_workers-1));
 	mark_as_idle(victims, right_child(n, num_workers-1));
 	// Unset worker n
-	*victims &= ~BIT(n);
+	bitset_clear(victims, n);
 }
 
 // Find the rightmost potential victim != ID
-static inline int rightmost_victim(unsigned int victims, int ID)
+static inline int rightmost_victim(unsigned long *victims, int ID)
 {
-	int victim = rightmost_one_bit_pos(victims);
+	int victim = bitset_rightmost_one_bit_pos(victims, VICTIM_WORDS);
 	if (victim == ID) {
-		victim = rightmost_one_bit_pos(ZERO_RIGHTMOST_ONE_BIT(victims));
+		bitset_clear(victims, ID);
+		victim = bitset_rightmost_one_bit_pos(victims, VICTIM_WORDS);
+		bitset_set(victims, ID);
 	}
 
 	assert(
@@ -269,18 +563,49 @@ static PRIVATE unsigned int seed;
 
 PRIVATE unsigned int random_receiver_calls, random_receiver_early_exits;
 
-// Choose a random victim != ID from the list of potential victims
-static inline int random_victim(unsigned int victims, int ID)
+#ifdef STEAL_TOPOLOGY
+static inline int random_victim(unsigned long *victims, int ID);
+
+// Choose a random victim close to the thief: first on the same core, then
+// sharing the same last-level cache, then on the same socket, and only then
+// anywhere else. A steal request widens its search when the current level
+// has no potential victims left, or when it has used up the tries of that
+// level: with k neighbors at some level, the first k tries stay within that
+// level. MAX_STEAL_ATTEMPTS still bounds the total number of tries.
+static inline int topology_victim(struct steal_request *req)
+{
+	VictimSet candidates;
+	int level, i;
+
+	for (level = 0; level < TOPO_LEVELS; level++) {
+		if (req->try >= num_neighbors[level][req->ID]) continue;
+		for (i = 0; i < (int)VICTIM_WORDS; i++) {
+			candidates[i] = VICTIMS(req)[i] & neighbors[level][req->ID][i];
+		}
+		unsigned int num_candidates = bitset_count_one_bits(candidates, VICTIM_WORDS);
+		if (num_candidates > 0) {
+			int k = rand_r(&seed) % num_candidates;
+			return bitset_nth_one_bit_pos(candidates, VICTIM_WORDS, k);
+		}
+	}
+
+	// Fall back to random victim selection
+	return random_victim(VICTIMS(req), req->ID);
+}
+#endif // STEAL_TOPOLOGY
+
+// Choose a random victim != ID from the set of potential victims
+static inline int random_victim(unsigned long *victims, int ID)
 {
-	unsigned int i, j, n;
+	unsigned int i;
 
 	random_receiver_calls++;
 	random_receiver_early_exits++;
 
 	// No eligible victim? Return message to sender.
-	if (victims == 0) return -1;
+	if (bitset_empty(victims, VICTIM_WORDS)) return -1;
 
-#define POTENTIAL_VICTIM(victims, n) ((victims) & BIT(n))
+#define POTENTIAL_VICTIM(victims, n) bitset_test(victims, n)
 
 	// Try to choose a victim at random
 	for (i = 0; i < 3; i++) {
@@ -290,26 +615,14 @@ static inline int random_victim(unsigned int victims, int ID)
 
 	random_receiver_early_exits--;
 
-	// Build list of potential victims and select one of them at random
+	// Select the k-th potential victim for a random k, without building a
+	// list of potential victims first
 
-	unsigned int num_victims = count_one_bits(victims);
+	unsigned int num_victims = bitset_count_one_bits(victims, VICTIM_WORDS);
 	assert(0 < num_victims && num_victims < (unsigned int)num_workers);
 
-	// Length of array is upper-bounded by the number of workers, but
-	// num_victims is likely less than that, or we would have found a victim
-	// above
-	int potential_victims[num_victims];
-
-	for (i = 0, j = 0, n = victims; n != 0; i++, n >>= 1) {
-		if (POTENTIAL_VICTIM(n, 0)) {
-			potential_victims[j++] = i;
-		}
-	}
-
-	assert(j == num_victims);
-	// assert(is_sorted(potential_victims, num_victims));
-
-	int victim = potential_victims[rand_r(&seed) % num_victims];
+	int k = rand_r(&seed) % num_victims;
+	int victim = bitset_nth_one_bit_pos(victims, VICTIM_WORDS, k);
 	assert(POTENTIAL_VICTIM(victims, victim));
 
 #undef POTENTIAL_VICTIM
@@ -335,6 +648,174 @@ PRIVATE unsigned int tasks_split;
 #ifdef LAZY_FUTURES
 PRIVATE unsigned int futures_converted;
 #endif
+#ifdef FIBERS
+PRIVATE unsigned int awaits_suspended;
+
+// A task that waits, for futures or for the tasks split off a reduction, is
+// suspended together with the fiber it runs on, while the worker continues
+// on a spare fiber (see fiber_await)
+struct fiber_wait {
+	Fiber *fiber;
+	Task *task;
+	// Condition to wait for (see RT_wait), NULL to wait until no other fiber
+	// is suspended
+	bool (*ready)(void *);
+	void *arg;
+	struct fiber_wait *next;
+};
+
+// The worker thread on its own stack
+static PRIVATE Fiber thread_fiber;
+static PRIVATE Fiber *running_fiber;
+// Suspended fibers
+static PRIVATE struct fiber_wait *waiting;
+static PRIVATE unsigned int num_waiting;
+// Spare fibers, kept for reuse
+static PRIVATE Fiber *spare_fibers;
+
+static void fibers_init(void);
+static void fibers_exit(void);
+#endif
+
+// State shared by the workers of a pool
+struct RT_pool {
+	Channel *chan_requests[MAXWORKERS];
+	Channel *chan_tasks[MAXWORKERS][MAXSTEAL];
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
+	struct backoff_t backoff[MAXWORKERS];
+#endif
+	VictimSet victim_sets[MAXWORKERS][MAXSTEAL] __attribute__((aligned(64)));
+#ifdef STEAL_TOPOLOGY
+	VictimSet neighbors[TOPO_LEVELS][MAXWORKERS] __attribute__((aligned(64)));
+	int num_neighbors[TOPO_LEVELS][MAXWORKERS];
+#endif
+	struct inject_queue inject __attribute__((aligned(64)));
+};
+
+struct RT_pool *RT_pool_alloc(void)
+{
+	void *rt;
+
+	if (posix_memalign(&rt, 128, sizeof(struct RT_pool)) != 0) {
+		fprintf(stderr, "Warning: RT_pool_alloc failed\n");
+		return NULL;
+	}
+
+	memset(rt, 0, sizeof(struct RT_pool));
+
+	pthread_mutex_init(&((struct RT_pool *)rt)->inject.lock, NULL);
+	task_allocator_init(&((struct RT_pool *)rt)->inject.alloc);
+
+	return (struct RT_pool *)rt;
+}
+
+// Requires that all workers have exited
+void RT_pool_free(struct RT_pool *rt)
+{
+	assert(rt->inject.head == NULL && rt->inject.pending == 0);
+
+	pthread_mutex_destroy(&rt->inject.lock);
+	task_allocator_destroy(&rt->inject.alloc);
+	free(rt);
+}
+
+// Injected tasks are children of this task, which never runs
+static Task inject_parent;
+
+Task *RT_inject_alloc(struct tasking_pool *pool, unsigned long size)
+{
+	struct inject_queue *q;
+	Task *task;
+
+	if (!pool) pool = default_pool;
+	assert(pool != NULL);
+
+	q = &pool->rt->inject;
+
+	pthread_mutex_lock(&q->lock);
+	task = task_alloc(&q->alloc, size);
+	pthread_mutex_unlock(&q->lock);
+
+	if (!task) {
+		fprintf(stderr, "Warning: RT_inject_alloc failed\n");
+		exit(1);
+	}
+
+	task->parent = &inject_parent;
+	task->victim = -1;
+
+	return task;
+}
+
+// Wake up one parked worker, if any
+static void wake_parked_worker(struct tasking_pool *pool)
+{
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
+	struct backoff_t *b = pool->rt->backoff;
+	int i;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (i = 1; i < pool->num_workers; i++) {
+		if (!__atomic_load_n(&b[i].parked, __ATOMIC_RELAXED) ||
+			!__atomic_exchange_n(&b[i].parked, 0, __ATOMIC_SEQ_CST))
+			continue;
+#if BACKOFF == wait_cond
+		pthread_mutex_lock(&b[i].lock);
+		pthread_cond_signal(&b[i].signal);
+		pthread_mutex_unlock(&b[i].lock);
+#else
+		futex_wake(&b[i].parked);
+#endif
+		break;
+	}
+#else
+	(void)pool;
+#endif
+}
+
+// Can be called from any thread
+void RT_inject(struct tasking_pool *pool, Task *task)
+{
+	struct inject_queue *q;
+
+	if (!pool) pool = default_pool;
+	assert(pool != NULL);
+	assert(task->parent == &inject_parent);
+
+	q = &pool->rt->inject;
+
+#ifdef LAZY_FUTURES
+	// The future is forced by a different thread
+	if (task->has_future) {
+		FUTURE_CONVERT(task);
+	}
+#endif
+
+	task->next = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	__atomic_add_fetch(&q->pending, 1, __ATOMIC_SEQ_CST);
+	if (q->tail) q->tail->next = task;
+	else __atomic_store_n(&q->head, task, __ATOMIC_SEQ_CST);
+	q->tail = task;
+	pthread_mutex_unlock(&q->lock);
+
+	if (pool->is_default) {
+		// The master may be busy running user code
+		wake_parked_worker(pool);
+	} else {
+		// The master of a dedicated pool waits for jobs and injected tasks
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+bool RT_injected(struct tasking_pool *pool)
+{
+	return __atomic_load_n(&pool->rt->inject.head, __ATOMIC_SEQ_CST) != NULL;
+}
 
 int RT_init(void)
 {
@@ -342,12 +823,32 @@ int RT_init(void)
 	assert(sizeof(struct steal_request) == 24);
 	assert(sizeof(Task) == 192);
 
+	struct RT_pool *rt = current_pool->rt;
 	int i;
 
+	chan_requests = rt->chan_requests;
+	chan_tasks = rt->chan_tasks;
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
+	backoff = rt->backoff;
+#endif
+	victim_sets = rt->victim_sets;
+#ifdef STEAL_TOPOLOGY
+	neighbors = rt->neighbors;
+	num_neighbors = rt->num_neighbors;
+#endif
+	inject = &rt->inject;
+	detached = false;
+
 	deque = deque_new();
 
 	// At most MAXSTEAL steal requests per worker
-	chan_requests[ID] = channel_alloc(sizeof(struct steal_request), MAXSTEAL * num_workers, MPSC);
+	// With BACKOFF, workers also receive steal requests on behalf of idle
+	// workers in their subtree, so there may be more than one consumer
+#ifdef BACKOFF
+	chan_requests[ID] = channel_alloc(sizeof(struct steal_request), MAXSTEAL * num_workers, MPMC_LF);
+#else
+	chan_requests[ID] = channel_alloc(sizeof(struct steal_request), MAXSTEAL * num_workers, MPSC_LF);
+#endif
 
 	// At most MAXSTEAL steal requests and thus different channels
 	channel_stack = bounded_stack_alloc(MAXSTEAL);
@@ -367,15 +868,36 @@ int RT_init(void)
 	// The worker tree is a complete binary tree with worker 0 at the root
 	worker_tree_init(&tree, ID, num_workers-1);
 
+#ifdef STEAL_TOPOLOGY
+	init_neighbors();
+#endif
+
 #if BACKOFF == wait_cond
 	pthread_mutex_init(&backoff[ID].lock, NULL);
 	pthread_cond_init(&backoff[ID].signal, NULL);
+#elif BACKOFF == wait_futex
+	backoff[ID].parked = 0;
 #endif
 
+	// Tracing and histograms cover the pool created by tasking_init
+	if (current_pool->is_default) {
+		TRACE_WORKER_INIT(ID);
+		HIST_WORKER_INIT(ID);
+	}
+
 	requested = 0;
 	seed = ID;
-
-	MASTER PRINTF("Number of workers: %d\n", num_workers);
+	// Adaptive stealing starts out with steal-one
+	stealhalf = steal_policy == half;
+	num_recent_steals = 0;
+
+	MASTER {
+		PRINTF("Number of workers: %d\n", num_workers);
+		PRINTF("Steal policy: %s, split policy: %s, steal early: ", policy_name(steal_policy),
+				policy_name(split_policy));
+		if (steal_early) PRINTF("%u\n", steal_early_threshold);
+		else PRINTF("off\n");
+	}
 
 	PROFILE_INIT(RUN_TASK);
 	PROFILE_INIT(ENQ_DEQ_TASK);
@@ -383,6 +905,10 @@ int RT_init(void)
 	PROFILE_INIT(SEND_RECV_REQ);
 	PROFILE_INIT(IDLE);
 
+#ifdef FIBERS
+	fibers_init();
+#endif
+
 	return 0;
 }
 
@@ -390,6 +916,10 @@ int RT_exit(void)
 {
 	int i;
 
+#ifdef FIBERS
+	fibers_exit();
+#endif
+
 	deque_delete(deque);
 
 	channel_free(chan_requests[ID]);
@@ -419,11 +949,23 @@ int RT_exit(void)
 	return 0;
 }
 
-Task *RT_task_alloc(void)
+Task *RT_task_alloc(unsigned long size)
 {
-	return deque_task_new(deque);
+	Task *task = deque_task_new(deque, size);
+
+	// Cancelling the parent cancels its children
+	task->token = get_current_task()->token;
+
+	return task;
 }
 
+// Cancelled tasks that can be dropped without running them: there is no
+// future to set and nobody waiting for them to finish (see run_task)
+// Tasks split off a reduction run anyway to combine their results
+// Only the owner drops tasks, stolen tasks are skipped by the thief
+#define DROPPABLE(t) (task_cancelled(t) && !(t)->has_future && !task_deps(t) && \
+					  !((t)->splittable && (t)->reduction))
+
 // Number of steal attempts before a steal request is sent back to the thief
 // Default value is the number of workers minus one
 #ifndef MAX_STEAL_ATTEMPTS
@@ -434,9 +976,9 @@ static int next_victim(struct steal_request *req)
 {
 	int victim = -1;
 
-	req->victims &= ~BIT(ID);
+	bitset_clear(VICTIMS(req), ID);
 
-#define POTENTIAL_VICTIM(n) ((req->victims) & BIT(n))
+#define POTENTIAL_VICTIM(n) bitset_test(VICTIMS(req), n)
 
 	if (req->try == MAX_STEAL_ATTEMPTS) {
 		// Return steal request to thief
@@ -445,11 +987,11 @@ static int next_victim(struct steal_request *req)
 		assert((req->try == 0 && req->ID == ID) || (req->try > 0 && req->ID != ID));
 		// Forward steal request to different worker != ID, if possible
 		if (tree.left_subtree_is_idle && tree.right_subtree_is_idle) {
-			mark_as_idle(&req->victims, ID);
+			mark_as_idle(VICTIMS(req), ID);
 		} else if (tree.left_subtree_is_idle) {
-			mark_as_idle(&req->victims, tree.left_child);
+			mark_as_idle(VICTIMS(req), tree.left_child);
 		} else if (tree.right_subtree_is_idle) {
-			mark_as_idle(&req->victims, tree.right_child);
+			mark_as_idle(VICTIMS(req), tree.right_child);
 		}
 		assert(!POTENTIAL_VICTIM(ID));
 #ifdef STEAL_LASTVICTIM
@@ -457,25 +999,27 @@ static int next_victim(struct steal_request *req)
 			victim = last_victim;
 		} else {
 			// Fall back to random victim selection
-			victim = random_victim(req->victims, req->ID);
+			victim = random_victim(VICTIMS(req), req->ID);
 		}
 #elif defined STEAL_LASTTHIEF
 		if (last_thief != -1 && POTENTIAL_VICTIM(last_thief)) {
 			victim = last_thief;
 		} else {
 			// Fall back to random victim selection
-			victim = random_victim(req->victims, req->ID);
+			victim = random_victim(VICTIMS(req), req->ID);
 		}
+#elif defined STEAL_TOPOLOGY
+		victim = topology_victim(req);
 #else
-		victim = random_victim(req->victims, req->ID);
-#endif // STEAL_LASTVICTIM || STEAL_LASTTHIEF
+		victim = random_victim(VICTIMS(req), req->ID);
+#endif // STEAL_LASTVICTIM || STEAL_LASTTHIEF || STEAL_TOPOLOGY
 	}
 
 #undef POTENTIAL_VICTIM
 
 	if (victim == -1) {
 		// Couldn't find victim; return steal request to thief
-		assert(req->victims == 0);
+		assert(bitset_empty(VICTIMS(req), VICTIM_WORDS));
 		victim = req->ID;
 		assert(victim != ID || (victim == ID && ID == MASTER_ID));
 	}
@@ -483,7 +1027,7 @@ static int next_victim(struct steal_request *req)
 #if 0
 	if (victim == req->ID) {
 		PRINTF("%d -{%d}-> %d after %d tries (%u ones)\n",
-			   ID, req->ID, victim, req->try, count_one_bits(req->victims));
+			   ID, req->ID, victim, req->try, bitset_count_one_bits(VICTIMS(req), VICTIM_WORDS));
 	}
 #endif
 
@@ -515,7 +1059,7 @@ do { \
 
 #define SEND_REQ_WORKER(ID, req)	SEND_REQ(chan_requests[ID], req)
 
-#if BACKOFF == sleep_exp || BACKOFF == wait_cond
+#if BACKOFF == sleep_exp || BACKOFF == wait_cond || BACKOFF == wait_futex
 #include "overload_RECV_REQ.h"
 
 static inline bool RECV_REQ(struct steal_request *req, int worker, int lvl)
@@ -582,7 +1126,7 @@ static inline bool PEEK_REQ(int worker, int lvl)
 		if (ret) return ret;
 	}
 
-#if BACKOFF == sleep_exp || BACKOFF == wait_cond
+#if BACKOFF == sleep_exp || BACKOFF == wait_cond || BACKOFF == wait_futex
 	return PEEK_REQ(left_child(worker, num_workers-1), lvl+1);
 #else
 	return ret;
@@ -615,7 +1159,7 @@ static inline bool RECV_REQ(struct steal_request *req)
 		assert((ret && req->state != STATE_FAILED) || !ret);
 	} // PROFILE
 
-#if BACKOFF == sleep_exp || BACKOFF == wait_cond
+#if BACKOFF == sleep_exp || BACKOFF == wait_cond || BACKOFF == wait_futex
 	// Check if we should handle steal requests on behalf of workers that have
 	// backed off. A worker backs off after sending a work-sharing request,
 	// which means it might stop responding to messages.
@@ -644,6 +1188,8 @@ static inline bool RECV_TASK(Task **task, bool idle)
 			ret = channel_receive(chan_tasks[ID][i], (void *)task, sizeof(Task *));
 			if (ret) {
 				CHANNEL_PUSH(chan_tasks[ID][i]);
+				TRACE(TASK_RECV, -1, *task, 0);
+				HIST_RECORD_SINCE(STEAL_RTT, steal_request_sent[i]);
 				break;
 			}
 		}
@@ -661,7 +1207,9 @@ static inline bool RECV_TASK(Task **task, bool idle)
 			//           = MAXSTEAL - MAXSTEAL + 1 = 1
 			requested = 1;
 			tree.waiting_for_tasks = false;
+			TRACE(LIFELINE_CLOSE, tree.parent, 0, 0);
 			dropped_steal_requests = 0;
+			reattach();
 #if MAXSTEAL > 1
 		} else {
 			// If we have dropped one or more steal requests before receiving
@@ -720,7 +1268,7 @@ static void async_action(void (*fn)(void), Channel *chan)
 	// Package up and send a dummy task
 	PROFILE(SEND_RECV_TASK) {
 
-	Task *dummy = RT_task_alloc();
+	Task *dummy = RT_task_alloc(0);
 	dummy->fn = (void (*)(void *))fn;
 #ifdef STEAL_LASTVICTIM
 	dummy->victim = -1;
@@ -746,14 +1294,14 @@ static ASYNC_ACTION(RT_EXIT_FN)
 
 	if (tree.left_child != -1) {
 		async_action(RT_EXIT_FN, chan_tasks[tree.left_child][0]);
-#if BACKOFF == wait_cond
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
 		SIGNAL(tree.left_child);
 #endif
 	}
 
 	if (tree.right_child != -1) {
 		async_action(RT_EXIT_FN, chan_tasks[tree.right_child][0]);
-#if BACKOFF == wait_cond
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
 		SIGNAL(tree.right_child);
 #endif
 	}
@@ -768,22 +1316,14 @@ void RT_async_action(enum RT_async_action_t action)
 	switch (action) {
 	case RT_EXIT:
 		RT_EXIT_FN();
+		// Return task objects to their owners before anyone can exit
+		deque_task_flush(deque);
 		break;
 	default:
 		break;
 	}
 }
 
-#if STEAL == adaptive
-// Number of steals after which the current strategy is reevaluated
-#ifndef STEAL_ADAPTIVE_INTERVAL
-#define STEAL_ADAPTIVE_INTERVAL 25
-#endif
-static PRIVATE int num_recent_steals;
-static PRIVATE bool stealhalf;
-PRIVATE unsigned int requests_steal_one, requests_steal_half;
-#endif
-
 // Try to send a steal request
 // Every worker can have at most MAXSTEAL pending steal requests. A steal
 // request with idle == false indicates that the requesting worker is still
@@ -791,40 +1331,41 @@ PRIVATE unsigned int requests_steal_one, requests_steal_half;
 // the requesting worker is in fact idle and has nothing to work on.
 static void try_send_steal_request(bool idle)
 {
-#if STEAL == adaptive
 	// If checkpoint is the total number of tasks that a worker has executed at
 	// the beginning of an evaluation interval, subtracting checkpoint from
 	// num_tasks_exec measures the worker's recent throughput.
-	static PRIVATE int checkpoint = 0;
-#endif
+	static PRIVATE long checkpoint = 0;
 
 	PROFILE(SEND_RECV_REQ) {
 
 	if (requested < MAXSTEAL) {
-#if STEAL == adaptive
 		// Estimate work-stealing efficiency during the last interval
 		// If the value is below a threshold, switch strategies
-		if (num_recent_steals == STEAL_ADAPTIVE_INTERVAL) {
+		if (steal_policy == adaptive && num_recent_steals == STEAL_ADAPTIVE_INTERVAL) {
 			double ratio = ((double)(num_tasks_exec - checkpoint)) / STEAL_ADAPTIVE_INTERVAL;
 			if (stealhalf && ratio < 2) stealhalf = false;
 			else if (!stealhalf && ratio == 1) stealhalf = true;
 			num_recent_steals = 0;
 			checkpoint = num_tasks_exec;
 		}
-#endif
 		// The following assertion no longer holds because we may increment
 		// channel_stack->top without decrementing requested
 		// (see decline_steal_request):
 		// assert(requested + channel_stack->top == MAXSTEAL);
 		struct steal_request req = STEAL_REQUEST_INIT;
+		req.slot = victims_slot(req.chan);
 		req.state = idle ? STATE_IDLE : STATE_WORKING;
+		INIT_VICTIMS(&req);
 		assert(req.try == 0);
-		SEND_REQ_WORKER(next_victim(&req), &req);
+		int victim = next_victim(&req);
+		TRACE(REQ_SEND, victim, 0, 0);
+#ifndef NHIST
+		steal_request_sent[req.slot] = tsc_read();
+#endif
+		SEND_REQ_WORKER(victim, &req);
 		requested++;
 		requests_sent++;
-#if STEAL == adaptive
 		stealhalf == true ?  requests_steal_half++ : requests_steal_one++;
-#endif
 	}
 
 	} // PROFILE
@@ -842,10 +1383,14 @@ static void decline_steal_request(struct steal_request *req)
 	requests_declined++;
 
 	if (req->ID == ID) {
+		Task *task;
 		// Steal request was either returned by another worker OR picked up by
 		// us. Thus, the following assertion no longer holds:
-		// assert(req->victims == 0);
-		if (req->state == STATE_IDLE && tree.left_subtree_is_idle && tree.right_subtree_is_idle) {
+		// assert(bitset_empty(VICTIMS(req), VICTIM_WORDS));
+		if (req->state == STATE_IDLE && RECV_INJECTED(&task)) {
+			// Answer our own steal request with an injected task
+			channel_send(req->chan, (void *)&task, sizeof(Task *));
+		} else if (req->state == STATE_IDLE && tree.left_subtree_is_idle && tree.right_subtree_is_idle) {
 #if MAXSTEAL > 1
 			// Is this the last of MAXSTEAL steal requests? If so, we can
 			// either detect termination, knowing that all workers are idle (ID
@@ -858,22 +1403,21 @@ static void decline_steal_request(struct steal_request *req)
 				// the number of channels stashed away in channel_stack.
 				assert(dropped_steal_requests == MAXSTEAL-1);
 				MASTER {
-					detect_termination();
+					// Detached workers may still run injected tasks
+					if (__atomic_load_n(&inject->pending, __ATOMIC_SEQ_CST) == 0)
+						detect_termination();
 					FORGET_REQ(req);
 				} else {
 					req->state = STATE_FAILED;
 #ifdef DEBUG_TD
 					PRINTF("Worker %d sends STATE_FAILED to worker %d\n", ID, tree.parent);
 #endif
-#if BACKOFF == wait_cond
-					pthread_mutex_lock(&backoff[ID].lock);
-#endif
+					TRACE(REQ_DECLINE, tree.parent, 0, req->ID);
 					SEND_REQ_WORKER(tree.parent, req);
 					assert(!tree.waiting_for_tasks);
 					tree.waiting_for_tasks = true;
-#if BACKOFF == wait_cond
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
 					WAIT();
-					pthread_mutex_unlock(&backoff[ID].lock);
 #endif
 				}
 			} else {
@@ -892,22 +1436,21 @@ static void decline_steal_request(struct steal_request *req)
 #else // MAXSTEAL == 1
 
 			MASTER {
-				detect_termination();
+				// Detached workers may still run injected tasks
+				if (__atomic_load_n(&inject->pending, __ATOMIC_SEQ_CST) == 0)
+					detect_termination();
 				FORGET_REQ(req);
 			} else {
 				req->state = STATE_FAILED;
 #ifdef DEBUG_TD
 				PRINTF("Worker %d sends STATE_FAILED to worker %d\n", ID, tree.parent);
 #endif
-#if BACKOFF == wait_cond
-				pthread_mutex_lock(&backoff[ID].lock);
-#endif
+				TRACE(REQ_DECLINE, tree.parent, 0, req->ID);
 				SEND_REQ_WORKER(tree.parent, req);
 				assert(!tree.waiting_for_tasks);
 				tree.waiting_for_tasks = true;
-#if BACKOFF == wait_cond
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
 				WAIT();
-				pthread_mutex_unlock(&backoff[ID].lock);
 #endif
 			}
 
@@ -916,9 +1459,10 @@ static void decline_steal_request(struct steal_request *req)
 		} else {
 			// Continue circulating the steal request if it makes sense
 			req->try = 0;
-			req->victims = INIT_VICTIMS;
+			INIT_VICTIMS(req);
 			int victim = next_victim(req);
 			if (victim != ID) {
+				TRACE(REQ_SEND, victim, 0, 0);
 				SEND_REQ_WORKER(victim, req);
 			} else {
 				assert(req->state == STATE_WORKING);
@@ -930,7 +1474,9 @@ static void decline_steal_request(struct steal_request *req)
 			}
 		}
 	} else {
-		SEND_REQ_WORKER(next_victim(req), req);
+		int victim = next_victim(req);
+		TRACE(REQ_FORWARD, victim, 0, req->ID);
+		SEND_REQ_WORKER(victim, req);
 	}
 
 	} // PROFILE
@@ -954,12 +1500,6 @@ static void decline_all_steal_requests(void)
 	PROFILE_START(IDLE);
 }
 
-#ifdef STEAL_EARLY
-#ifndef STEAL_EARLY_THRESHOLD
-#define STEAL_EARLY_THRESHOLD 0
-#endif
-#endif
-
 // Handle a steal request by sending tasks in return or passing it on to
 // another worker
 static void handle_steal_request(struct steal_request *req)
@@ -973,12 +1513,8 @@ static void handle_steal_request(struct steal_request *req)
 		long tasks_left = task && task->splittable ? labs(task->end - task->cur) : 0;
 		// Got own steal request
 		// Forget about it if we have more tasks than previously
-#ifdef STEAL_EARLY
-		if (deque_num_tasks(deque) > STEAL_EARLY_THRESHOLD ||
-			tasks_left > STEAL_EARLY_THRESHOLD) {
-#else
-		if (deque_num_tasks(deque) > 0 || tasks_left > 0) {
-#endif
+		unsigned int threshold = steal_early ? steal_early_threshold : 0;
+		if (deque_num_tasks(deque) > threshold || tasks_left > threshold) {
 			FORGET_REQ(req);
 			return;
 		} else {
@@ -991,17 +1527,12 @@ static void handle_steal_request(struct steal_request *req)
 
 	PROFILE(ENQ_DEQ_TASK) {
 
-#if STEAL == adaptive
+	// Unless steal_policy == adaptive, all steal requests agree on stealhalf
 	if (req->stealhalf) {
 		task = deque_steal_half(deque, &loot);
 	} else {
 		task = deque_steal(deque);
 	}
-#elif STEAL == half
-	task = deque_steal_half(deque, &loot);
-#else // Default is steal-one
-	task = deque_steal(deque);
-#endif
 
 	} // PROFILE
 
@@ -1019,6 +1550,8 @@ static void handle_steal_request(struct steal_request *req)
 			}
 		}
 #endif
+		TRACE(TASK_SEND, req->ID, task, loot);
+		HIST_RECORD(STEAL_TRIES, req->try);
 		channel_send(req->chan, (void *)&task, sizeof(Task *));
 		//PRINTF("Worker %2d: sending %d task%s to worker %d\n",
 		//	ID, loot, loot > 1 ? "s" : "", req->ID);
@@ -1037,9 +1570,45 @@ static void handle_steal_request(struct steal_request *req)
 	}
 }
 
+// Inner dimension of a loop task to split next, -1 for the outer dimension
+// [start, end), which is split as long as it has the most iterations left
+// Only iterations that haven't started yet can be split off: a task split along
+// an inner dimension keeps the iterations of its outer dimension before cur
+static inline int split_dim(Task *t)
+{
+	long n = labs(t->end - t->cur);
+	int d, dim = -1;
+
+	if (t->splittable == 1 || n == 0)
+		return -1;
+
+	for (d = 0; d < t->splittable - 1; d++) {
+		long m = labs(task_ranges(t)[d].end - task_ranges(t)[d].start);
+		if (m > n || (m > 1 && n <= 1)) {
+			n = m;
+			dim = d;
+		}
+	}
+
+	return dim;
+}
+
 // Loop task with iterations left for splitting?
-#define SPLITTABLE(t) \
-	((bool)((t) != NULL && (t)->splittable && labs((t)->end - (t)->cur) > 1))
+static inline bool loop_splittable(Task *t)
+{
+	int d;
+
+	if (t == NULL || !t->splittable)
+		return false;
+
+	d = split_dim(t);
+	if (d >= 0)
+		return labs(task_ranges(t)[d].end - task_ranges(t)[d].start) > 1;
+
+	return labs(t->end - t->cur) > 1;
+}
+
+#define SPLITTABLE(t) loop_splittable(t)
 
 // Convenience function for handling a steal request
 // Returns true if work is available, false otherwise
@@ -1075,15 +1644,38 @@ static inline bool handle(struct steal_request *req)
 	return false;
 }
 
+// Answer a work sharing request with an injected task, if any
+static inline bool send_injected(struct steal_request *req)
+{
+	Task *task;
+
+	if (tree.waiting_for_tasks || !RECV_INJECTED(&task))
+		return false;
+
+	// MASTER: the task is new work, as in RT_push
+	quiescent = false;
+
+	TRACE(TASK_SEND, req->ID, task, 1);
+	channel_send(req->chan, (void *)&task, sizeof(Task *));
+	requests_handled++;
+	tasks_sent++;
+
+	return true;
+}
+
 // Handle as many work sharing requests as possible; leave work sharing
 // requests that cannot be answered with tasks enqueued
 static inline void share_work(void)
 {
+	// Our parent considers our subtree idle
+	if (detached)
+		return;
+
 	while (!bounded_queue_empty(work_sharing_requests)) {
 		// Don't dequeue yet
 		struct steal_request *req = NEXT_WORK_SHARING_REQUEST();
 		assert(req->ID == tree.left_child || req->ID == tree.right_child);
-		if (handle(req)) {
+		if (handle(req) || send_injected(req)) {
 			if (req->ID == tree.left_child) {
 				assert(tree.left_subtree_is_idle);
 				tree.left_subtree_is_idle = false;
@@ -1091,7 +1683,7 @@ static inline void share_work(void)
 				assert(tree.right_subtree_is_idle);
 				tree.right_subtree_is_idle = false;
 			}
-#if BACKOFF == wait_cond
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
 			// Wake up worker
 			SIGNAL(req->ID);
 #endif
@@ -1119,6 +1711,23 @@ void RT_poll(void)
 
 static Task *RT_pop(bool children);
 
+#ifdef FIBERS
+static void fiber_drain(void);
+#endif
+
+// Wait for tasks from our parent (again)
+static void park(void)
+{
+	assert(tree.waiting_for_tasks);
+	assert(tree.left_subtree_is_idle && tree.right_subtree_is_idle);
+
+	reattach();
+
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
+	WAIT();
+#endif
+}
+
 // Executed by worker threads
 void *schedule(UNUSED(void *args))
 {
@@ -1132,7 +1741,16 @@ void *schedule(UNUSED(void *args))
 			PROFILE(ENQ_DEQ_TASK) deque_task_cache(deque, task);
 		}
 
+#ifdef FIBERS
+		// Not idle as long as tasks are suspended
+		if (waiting) {
+			fiber_drain();
+			continue;
+		}
+#endif
+
 		// (2) Work-stealing request
+		HIST_TICKS(idle_start);
 		try_send_steal_request(/* idle = */ true);
 		assert(requested);
 
@@ -1150,6 +1768,11 @@ void *schedule(UNUSED(void *args))
 #else
 			decline_all_steal_requests();
 #endif
+			if (tree.waiting_for_tasks) {
+				// Woken up by an injected task?
+				if (RECV_INJECTED(&task)) break;
+				park();
+			}
 		}
 
 #if BACKOFF == sleep_exp
@@ -1157,6 +1780,7 @@ void *schedule(UNUSED(void *args))
 #endif
 
 		} // PROFILE
+		HIST_RECORD_SINCE(IDLE, idle_start);
 #ifdef STEAL_LASTVICTIM
 		if (task->victim != -1) {
 			last_victim = task->victim;
@@ -1166,9 +1790,7 @@ void *schedule(UNUSED(void *args))
 		if (task->next != NULL) {
 			PROFILE(ENQ_DEQ_TASK) task = deque_pop(deque_prepend(deque, task));
 		}
-#if STEAL == adaptive
 		num_recent_steals++;
-#endif
 
 		share_work();
 
@@ -1186,6 +1808,9 @@ int RT_schedule(void)
 {
 	schedule(NULL);
 
+	// Return task objects to their owners before anyone can exit
+	deque_task_flush(deque);
+
 	return 0;
 }
 
@@ -1207,15 +1832,33 @@ empty_local_queue:
 		PROFILE(ENQ_DEQ_TASK) deque_task_cache(deque, task);
 	}
 
+#ifdef FIBERS
+	// Suspended tasks have yet to finish
+	if (waiting) {
+		fiber_drain();
+		goto empty_local_queue;
+	}
+#endif
+
 	if (num_workers == 1) {
+		// Nobody else takes injected tasks
+		if (RECV_INJECTED(&task)) {
+			PROFILE(RUN_TASK) run_task(task);
+			PROFILE(ENQ_DEQ_TASK) deque_task_cache(deque, task);
+			goto empty_local_queue;
+		}
 		quiescent = true;
 		goto RT_barrier_exit;
 	}
 
 	if (quiescent) {
-		goto RT_barrier_exit;
+		// Unless injected tasks have arrived in the meantime
+		if (__atomic_load_n(&inject->pending, __ATOMIC_SEQ_CST) == 0)
+			goto RT_barrier_exit;
+		quiescent = false;
 	}
 
+	HIST_TICKS(idle_start);
 	try_send_steal_request(/* idle = */ true);
 	assert(requested);
 
@@ -1231,6 +1874,7 @@ empty_local_queue:
 	}
 
 	} // PROFILE
+	HIST_RECORD_SINCE(IDLE, idle_start);
 #ifdef STEAL_LASTVICTIM
 	if (task->victim != -1) {
 		last_victim = task->victim;
@@ -1240,9 +1884,7 @@ empty_local_queue:
 	if (task->next != NULL) {
 		PROFILE(ENQ_DEQ_TASK) task = deque_pop(deque_prepend(deque, task));
 	}
-#if STEAL == adaptive
 	num_recent_steals++;
-#endif
 
 	share_work();
 
@@ -1254,6 +1896,12 @@ RT_barrier_exit:
 	// Execution continues, but quiescent remains true until new tasks are created
 	assert(quiescent);
 
+	// All children have finished, their dependencies can be forgotten
+	if (task_deps(get_current_task())) {
+		task = dep_release(get_current_task());
+		assert(task == NULL);
+	}
+
 #ifdef DEBUG_TD
 	PRINTF(">>> Worker %d leaves barrier <<<\n", ID);
 #endif
@@ -1261,41 +1909,291 @@ RT_barrier_exit:
 	return 0;
 }
 
+// Receive the result of future f if it is available
 #ifdef LAZY_FUTURES
 
-#define READY ((f->has_channel && channel_receive(f->chan, data, size)) || f->set)
-
-void RT_force_future(lazy_future *f, void *data, unsigned int size)
+static inline bool future_ready(lazy_future *f, void *data, unsigned int size)
+{
+	return (f->has_channel && channel_receive(f->chan, data, size)) || f->set;
+}
 
 #else // Regular, eagerly allocated futures
 
-#define READY (channel_receive(chan, data, size))
+static inline bool future_ready(Channel *chan, void *data, unsigned int size)
+{
+	assert(channel_impl(chan) == SPSC);
+
+	return channel_receive(chan, data, size);
+}
+
+#endif
+
+// Index of the first future in futs whose result is available, -1 if none
+// Futures that are NULL are skipped
+static inline int futures_ready(future *futs, int n, void *data, unsigned int size)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (futs[i] && future_ready(futs[i], data, size))
+			return i;
+	}
+
+	return -1;
+}
+
+// Arguments and result of futures_ready
+struct futures_wait {
+	future *futs;
+	int n;
+	void *data;
+	unsigned int size;
+	int i;
+};
+
+static bool futures_wait_ready(void *arg)
+{
+	struct futures_wait *w = (struct futures_wait *)arg;
+
+	w->i = futures_ready(w->futs, w->n, w->data, w->size);
+
+	return w->i >= 0;
+}
+
+static bool reduction_ready(void *arg)
+{
+	struct reduction *red = (struct reduction *)arg;
+
+	return __atomic_load_n(&red->pending, __ATOMIC_ACQUIRE) == 0;
+}
+
+#ifdef FIBERS
+
+static void fiber_schedule(void *);
+
+static void fibers_init(void)
+{
+	fiber_init_thread(&thread_fiber);
+	running_fiber = &thread_fiber;
+	waiting = NULL;
+	num_waiting = 0;
+	spare_fibers = NULL;
+	awaits_suspended = 0;
+}
+
+static void fibers_exit(void)
+{
+	Fiber *fiber;
+
+	assert(waiting == NULL);
+	assert(running_fiber == &thread_fiber);
+
+	while ((fiber = spare_fibers) != NULL) {
+		spare_fibers = fiber->next;
+		fiber_delete(fiber);
+	}
+}
+
+// Can the fiber of w be resumed?
+static inline bool fiber_ready(struct fiber_wait *w)
+{
+	if (w->ready)
+		return w->ready(w->arg);
+
+	// The last fiber to be resumed
+	return num_waiting == 1;
+}
+
+// Suspends the running fiber until w is ready, and switches to a spare fiber
+// Returns false if there is no spare fiber and no stack for a new one
+static bool fiber_suspend(struct fiber_wait *w)
+{
+	Fiber *spare = spare_fibers;
+
+	if (spare) {
+		spare_fibers = spare->next;
+	} else {
+		spare = fiber_new(fiber_schedule, NULL);
+		if (!spare) return false;
+	}
+
+	w->fiber = running_fiber;
+	w->task = get_current_task();
+	w->next = waiting;
+	waiting = w;
+	num_waiting++;
+
+	running_fiber = spare;
+	fiber_switch(w->fiber, spare);
+
+	// Resumed by fiber_resume
+	assert(running_fiber == w->fiber);
+	set_current_task(w->task);
+
+	return true;
+}
+
+// Resumes a suspended fiber that is ready, if any, and makes the running
+// (spare) fiber available for reuse
+// Returns false if no suspended fiber is ready
+static bool fiber_resume(void)
+{
+	struct fiber_wait **p, *w;
+	Fiber *self = running_fiber;
+
+	for (p = &waiting; (w = *p) != NULL; p = &w->next) {
+		if (fiber_ready(w)) {
+			*p = w->next;
+			num_waiting--;
+			self->next = spare_fibers;
+			spare_fibers = self;
+			running_fiber = w->fiber;
+			fiber_switch(self, w->fiber);
+			// Reused by fiber_suspend
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Waits until ready(arg) on a spare fiber
+// Returns false if the task can't be suspended
+static bool fiber_await(bool (*ready)(void *), void *arg)
+{
+	struct fiber_wait w;
+
+	w.ready = ready;
+	w.arg = arg;
+
+	if (!fiber_suspend(&w))
+		return false;
+
+	awaits_suspended++;
+
+	return true;
+}
+
+// Waits until all suspended fibers have been resumed, which is the case
+// when their tasks have finished or have been suspended again by someone else
+static void fiber_drain(void)
+{
+	struct fiber_wait w;
+
+	assert(waiting != NULL);
+
+	w.ready = NULL;
+
+	if (!fiber_suspend(&w)) {
+		fprintf(stderr, "Warning: fiber_drain failed\n");
+		exit(1);
+	}
+
+	assert(waiting == NULL);
+}
+
+// Scheduling loop of spare fibers, which run only while other fibers are
+// suspended; their tasks are not finished, so the worker isn't idle
+static void fiber_schedule(UNUSED(void *args))
+{
+	struct steal_request req;
+	Task *task;
+
+	for (;;) {
+		// Suspended tasks that can continue have priority
+		set_current_task(NULL);
+		if (fiber_resume())
+			continue;
+
+		assert(waiting != NULL);
+
+		if ((task = RT_pop(/* children = */ false)) != NULL) {
+			PROFILE(RUN_TASK) run_task(task);
+			PROFILE(ENQ_DEQ_TASK) deque_task_cache(deque, task);
+			continue;
+		}
 
-void RT_force_future(Channel *chan, void *data, unsigned int size)
+		try_send_steal_request(/* idle = */ false);
 
+		PROFILE(IDLE) {
+
+		while (!RECV_TASK(&task, /* idle = */ false)) {
+			PROFILE_STOP(IDLE);
+			try_send_steal_request(/* idle = */ false);
+			// Check if someone requested to steal from us
+			while (RECV_REQ(&req))
+				handle_steal_request(&req);
+			PROFILE_START(IDLE);
+			if (fiber_resume()) {
+				PROFILE_STOP(IDLE);
+				goto fiber_schedule_continue;
+			}
+			// Make progress on injected tasks while waiting
+			if (RECV_INJECTED(&task)) break;
+		}
+
+		} // PROFILE
+#ifdef STEAL_LASTVICTIM
+		if (task->victim != -1) {
+			last_victim = task->victim;
+			assert(last_victim != ID);
+		}
 #endif
+		if (task->next != NULL) {
+			PROFILE(ENQ_DEQ_TASK) task = deque_pop(deque_prepend(deque, task));
+		}
+		num_recent_steals++;
+
+		share_work();
+
+		PROFILE(RUN_TASK) run_task(task);
+		PROFILE(ENQ_DEQ_TASK) deque_task_cache(deque, task);
+
+fiber_schedule_continue:
+		;
+	}
+}
+
+#endif // FIBERS
+
+// Runs other tasks until ready(arg), which is called repeatedly
+// Inlined into its callers, so that ready is known at compile time
+static inline __attribute__((always_inline)) void RT_wait(bool (*ready)(void *), void *arg)
 {
 	Task *task;
 	Task *this = get_current_task();
 	struct steal_request req;
 
-#ifndef LAZY_FUTURES
-	assert(channel_impl(chan) == SPSC);
-#endif
+	if (ready(arg))
+		return;
 
-	if (READY)
-		goto RT_force_future_return;
+	if (!current_pool) {
+		// Not a worker, e.g., waiting for an injected task (see RT_inject)
+		useconds_t delay = 1;
+		while (!ready(arg)) {
+			usleep(delay);
+			delay = min(delay * 2, (useconds_t)100);
+		}
+		return;
+	}
 
 	while ((task = RT_pop(/* children = */ true)) != NULL) {
 		PROFILE(RUN_TASK) run_task(task);
 		PROFILE(ENQ_DEQ_TASK) deque_task_cache(deque, task);
-		if (READY)
-			goto RT_force_future_return;
+		if (ready(arg))
+			return;
 	}
 
 	assert(get_current_task() == this);
 
-	while (!READY) {
+#ifdef FIBERS
+	// Rather than running other tasks on top of this one, suspend this task
+	// until it can continue
+	if (fiber_await(ready, arg))
+		return;
+#endif
+
+	while (!ready(arg)) {
 		try_send_steal_request(/* idle = */ false);
 		PROFILE(IDLE) {
 
@@ -1308,10 +2206,12 @@ void RT_force_future(Channel *chan, void *data, unsigned int size)
 			while (RECV_REQ(&req))
 				handle_steal_request(&req);
 			PROFILE_START(IDLE);
-			if (READY) {
+			if (ready(arg)) {
 				PROFILE_STOP(IDLE);
-				goto RT_force_future_return;
+				return;
 			}
+			// Make progress on injected tasks while waiting
+			if (RECV_INJECTED(&task)) break;
 		}
 
 		} // PROFILE
@@ -1324,30 +2224,60 @@ void RT_force_future(Channel *chan, void *data, unsigned int size)
 		if (task->next != NULL) {
 			PROFILE(ENQ_DEQ_TASK) task = deque_pop(deque_prepend(deque, task));
 		}
-#if STEAL == adaptive
 		num_recent_steals++;
-#endif
 
 		share_work();
 
 		PROFILE(RUN_TASK) run_task(task);
 		PROFILE(ENQ_DEQ_TASK) deque_task_cache(deque, task);
 	}
+}
+
+int RT_force_future_any(future *futs, int n, void *data, unsigned int size)
+{
+	struct futures_wait w;
+	int i;
+
+	for (i = 0; i < n && !futs[i]; i++)
+		;
 
-#undef READY
+	// Nothing to wait for
+	if (i == n)
+		return -1;
+
+	w.futs = futs;
+	w.n = n;
+	w.data = data;
+	w.size = size;
+	w.i = -1;
+
+	RT_wait(futures_wait_ready, &w);
+	i = w.i;
 
-RT_force_future_return:
 #ifdef LAZY_FUTURES
-	if (!f->has_channel) {
-		assert(f->set);
-		memcpy(data, f->buf, size);
-	} else {
-		assert(f->chan != NULL);
-		assert(channel_impl(f->chan) == SPSC);
-		channel_free(f->chan);
+	{
+		lazy_future *f = futs[i];
+		if (!f->has_channel) {
+			assert(f->set);
+			memcpy(data, f->buf, size);
+		} else {
+			assert(f->chan != NULL);
+			assert(channel_impl(f->chan) == SPSC);
+			channel_free(f->chan);
+		}
 	}
 #endif
-	return;
+	return i;
+}
+
+void RT_force_future(future f, void *data, unsigned int size)
+{
+	RT_force_future_any(&f, 1, data, size);
+}
+
+void RT_reduction_wait(struct reduction *red)
+{
+	RT_wait(reduction_ready, red);
 }
 
 void RT_push(Task *task)
@@ -1377,22 +2307,46 @@ void RT_push(Task *task)
 	PROFILE_START(ENQ_DEQ_TASK);
 }
 
-#ifdef STEAL_EARLY
+void RT_push_deps(Task *task, const struct dep *deps, int n)
+{
+	if (dep_register(task, deps, n)) {
+		RT_push(task);
+	}
+
+	// Otherwise, the last predecessor to finish pushes task
+}
+
+// Called by run_task
+void RT_release_deps(Task *task)
+{
+	Task *ready = dep_release(task), *next;
+
+	if (!ready)
+		return;
+
+	PROFILE(ENQ_DEQ_TASK) {
 
-// Try to send a steal request when number of local tasks <= STEAL_EARLY_THRESHOLD
+	for (; ready != NULL; ready = next) {
+		next = ready->next;
+		ready->next = NULL;
+		RT_push(ready);
+	}
+
+	} // PROFILE
+}
+
+// Try to send a steal request when number of local tasks <= steal_early_threshold
 static inline void try_steal(void)
 {
 	if (num_workers == 1)
 		return;
 
-	if (deque_num_tasks(deque) <= STEAL_EARLY_THRESHOLD) {
+	if (deque_num_tasks(deque) <= steal_early_threshold) {
 		// By definition not yet idle
 		try_send_steal_request(/* idle = */ false);
 	}
 }
 
-#endif // STEAL_EARLY
-
 static Task *RT_pop(bool children)
 {
 	struct steal_request req;
@@ -1400,48 +2354,36 @@ static Task *RT_pop(bool children)
 
 	PROFILE(ENQ_DEQ_TASK) {
 		task = children ? deque_pop(deque, get_current_task()) : deque_pop(deque);
+		while (task && DROPPABLE(task)) {
+			num_tasks_cancelled++;
+			deque_task_cache(deque, task);
+			task = children ? deque_pop(deque, get_current_task()) : deque_pop(deque);
+		}
 	}
 
 	// TODO: Is this comment still accurate?
 	// Sending an idle steal request at this point may lead to termination
 	// detection when we're about to quit! Steal requests with idle == false are okay.
 
-#ifdef STEAL_EARLY
-	if (task && !task->splittable) {
+	if (steal_early && task && !task->splittable) {
 		try_steal();
 	}
-#endif
 
 	share_work();
 
+	// If we just popped a loop task, it will split itself once it runs its
+	// loop and polls for steal requests (see ASYNC_FOR): only then do split-off
+	// tasks know which reduction to combine their results into
+	if (deque_empty(deque) && SPLITTABLE(task))
+		return task;
+
 	// Check if someone requested to steal from us
-	while (RECV_REQ(&req)) {
-		// If we just popped a loop task, we may split right here
-		// Makes handle_steal_request simpler
-		if (deque_empty(deque) && SPLITTABLE(task)) {
-			if (req.ID != ID) {
-				split_loop(task, &req);
-			} else {
-				FORGET_REQ(&req);
-			}
-		} else {
-			handle_steal_request(&req);
-		}
-	}
+	while (RECV_REQ(&req))
+		handle_steal_request(&req);
 
 	return task;
 }
 
-#if SPLIT == half
-	#define SPLIT_FUNC split_half
-#elif SPLIT == guided
-	#define SPLIT_FUNC split_guided
-#elif SPLIT == adaptive
-	#define SPLIT_FUNC split_adaptive
-#else // Default is split-half
-	#define SPLIT_FUNC split_half
-#endif
-
 // Split iteration range in half
 static inline long split_half(Task *task)
 {
@@ -1480,7 +2422,7 @@ static inline long split_adaptive(Task *task)
 	// We have already removed one steal request
 	num_idle = channel_peek(chan_requests[ID]) + 1;
 
-#if BACKOFF == sleep_exp || BACKOFF == wait_cond
+#if BACKOFF == sleep_exp || BACKOFF == wait_cond || BACKOFF == wait_futex
 	if (tree.left_subtree_is_idle) {
 		num_idle += COUNT_REQ(left_child(ID, num_workers-1), /* lvl = */ 0);
 	}
@@ -1502,28 +2444,128 @@ static inline long split_adaptive(Task *task)
 	return task->end - chunk;
 }
 
+static long (*split_fn)(Task *) = SPLIT == guided ? split_guided :
+                                  SPLIT == adaptive ? split_adaptive :
+                                  split_half;
+
+static const char *policy_name(int policy)
+{
+	switch (policy) {
+	case one:      return "one";
+	case half:     return "half";
+	case guided:   return "guided";
+	case adaptive: return "adaptive";
+	default:       return "unknown";
+	}
+}
+
+// Select scheduling policies through environment variables:
+// TASKING_STEAL=[one|half|adaptive]
+// TASKING_SPLIT=[half|guided|adaptive]
+// TASKING_STEAL_EARLY=[off|<threshold>]
+// Must be called before workers start
+int RT_configure(void)
+{
+	char *envval;
+	int ret = 0;
+
+	envval = getenv("TASKING_STEAL");
+	if (envval) {
+		if (strcmp(envval, "one") == 0) steal_policy = one;
+		else if (strcmp(envval, "half") == 0) steal_policy = half;
+		else if (strcmp(envval, "adaptive") == 0) steal_policy = adaptive;
+		else {
+			fprintf(stderr, "Warning: unknown steal policy '%s'\n", envval);
+			ret = -1;
+		}
+	}
+
+	envval = getenv("TASKING_SPLIT");
+	if (envval) {
+		if (strcmp(envval, "half") == 0) split_policy = half;
+		else if (strcmp(envval, "guided") == 0) split_policy = guided;
+		else if (strcmp(envval, "adaptive") == 0) split_policy = adaptive;
+		else {
+			fprintf(stderr, "Warning: unknown split policy '%s'\n", envval);
+			ret = -1;
+		}
+	}
+
+	envval = getenv("TASKING_STEAL_EARLY");
+	if (envval) {
+		char *end;
+		long threshold = strtol(envval, &end, 10);
+		if (strcmp(envval, "off") == 0) {
+			steal_early = false;
+		} else if (end != envval && *end == '\0' && threshold >= 0 && threshold <= UINT_MAX) {
+			steal_early = true;
+			steal_early_threshold = threshold;
+		} else {
+			fprintf(stderr, "Warning: invalid steal-early threshold '%s'\n", envval);
+			ret = -1;
+		}
+	}
+
+#if BACKOFF == wait_cond || BACKOFF == wait_futex
+	envval = getenv("TASKING_IDLE_SPIN");
+	if (envval) {
+		char *end;
+		long usec = strtol(envval, &end, 10);
+		if (end != envval && *end == '\0' && usec >= 0 && usec <= UINT_MAX) {
+			idle_spin = usec;
+		} else {
+			fprintf(stderr, "Warning: invalid idle spin time '%s'\n", envval);
+			ret = -1;
+		}
+	}
+#endif
+
+	switch (split_policy) {
+	case guided:   split_fn = split_guided; break;
+	case adaptive: split_fn = split_adaptive; break;
+	default:       split_fn = split_half; break;
+	}
+
+	return ret;
+}
+
 static void split_loop(Task *task, struct steal_request *req)
 {
 	assert(req->ID != ID);
 
 	Task *dup;
 	long split;
+	int d;
 
 	PROFILE(ENQ_DEQ_TASK) {
 
-	dup = RT_task_alloc();
+	dup = RT_task_alloc(task_data_size(task));
 
 	// dup is a copy of the current task
-	*dup = *task;
+	task_copy(dup, task);
+
+	d = split_dim(task);
 
-	// Split iteration range according to given strategy
-    // [start, end) => [start, split) + [split, end)
-	split = SPLIT_FUNC(task);
+	if (d < 0) {
+		// Split iteration range according to given strategy
+		// [start, end) => [start, split) + [split, end)
+		split = split_fn(task);
+
+		// New task gets upper half of iterations
+		dup->start = split;
+		dup->cur = split;
+		dup->end = task->end;
+	} else {
+		struct task_range *r = &task_ranges(task)[d];
 
-	// New task gets upper half of iterations
-	dup->start = split;
-	dup->cur = split;
-	dup->end = task->end;
+		// Split inner range in half, for the remaining iterations of the
+		// outer dimension
+		split = r->start + (r->end - r->start) / 2;
+
+		dup->start = task->cur;
+		dup->end = task->end;
+		task_ranges(dup)[d].start = split;
+	}
 
 	} // PROFILE
 
@@ -1535,28 +2577,16 @@ static void split_loop(Task *task, struct steal_request *req)
 	dup->victim = ID;
 #endif
 
-	if (dup->has_future) {
-		// Patch the task with a new future for the result
-		// Problematic: We don't know the result type, that is, what kind of
-		// values will be sent over the channel
-		struct future_node *p = malloc(sizeof(struct future_node));
-		p->r = p->await = NULL;
-#ifdef LAZY_FUTURES
-		p->f = malloc(sizeof(lazy_future));
-		p->f->chan = channel_alloc(32, 0, SPSC);
-		p->f->has_channel = true;
-		p->f->set = false;
-		futures_converted++;
-#else
-		p->f = channel_alloc(32, 0, SPSC);
-#endif
-		memcpy(dup->data, &p->f, sizeof(future));
-		p->next = get_current_task()->futures;
-		get_current_task()->futures = p;
-		// The list of futures required by the current task must not be shared!
-		dup->futures = NULL;
+	// Only the original task sets the future
+	dup->has_future = false;
+
+	// dup combines its result into the reduction of the current task
+	if (dup->reduction != NULL) {
+		__atomic_add_fetch(&dup->reduction->pending, 1, __ATOMIC_RELAXED);
 	}
 
+	TRACE(LOOP_SPLIT, req->ID, dup, labs(dup->end - dup->start));
+	HIST_RECORD(STEAL_TRIES, req->try);
 	channel_send(req->chan, (void *)&dup, sizeof(dup));
 	requests_handled++;
 	tasks_sent++;
@@ -1565,7 +2595,11 @@ static void split_loop(Task *task, struct steal_request *req)
 #endif
 
 	// Current task continues with lower half of iterations
-	task->end = split;
+	if (d < 0) {
+		task->end = split;
+	} else {
+		task_ranges(task)[d].end = split;
+	}
 
 	tasks_split++;
 
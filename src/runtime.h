@@ -1,7 +1,9 @@
 #ifndef RUNTIME_H
 #define RUNTIME_H
 
+#include "dependency.h"
 #include "future.h"
+#include "platform.h"
 #include "task.h"
 
 #ifndef max
@@ -22,6 +24,12 @@
 })
 #endif
 
+// Select scheduling policies (see runtime.c)
+int RT_configure(void);
+// State shared by the workers of a pool
+struct RT_pool;
+struct RT_pool *RT_pool_alloc(void);
+void RT_pool_free(struct RT_pool *);
 int RT_init();
 int RT_exit(void);
 int RT_schedule(void);
@@ -33,9 +41,57 @@ enum RT_async_action_t {
 
 void RT_async_action(enum RT_async_action_t);
 
-Task *RT_task_alloc(void);
+// Allocate a task with room for size bytes of data (see task_data)
+Task *RT_task_alloc(unsigned long size);
 void RT_push(Task *task);
+// Push a task that must wait for the tasks it depends on (see dependency.h)
+void RT_push_deps(Task *task, const struct dep *deps, int n);
+// Push the tasks that depend on task, which has finished
+void RT_release_deps(Task *task);
 void RT_force_future(future f, void *data, unsigned int size);
+// Wait for the first of n futures, returns its index (-1 if all are NULL)
+int RT_force_future_any(future *futs, int n, void *data, unsigned int size);
+
+// Reduction of a splittable task, on the stack of the task while it runs its
+// loop (see ASYNC_FOR_REDUCE). Tasks split off the loop have reductions of
+// their own, so partial results are combined up the tree of splits.
+struct reduction {
+	// Reduction of the task that the current task was split off, NULL if
+	// the current task hasn't been split off another task
+	struct reduction *parent;
+	// Accumulator for the results of split-off tasks
+	void *acc;
+	// Number of split-off tasks that have yet to combine their results
+	int pending;
+	int lock;
+};
+
+// Wait until all tasks split off a reduction have combined their results
+void RT_reduction_wait(struct reduction *red);
+
+static inline void RT_reduction_lock(struct reduction *red)
+{
+	while (__atomic_exchange_n(&red->lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&red->lock, __ATOMIC_RELAXED))
+			CPU_RELAX();
+	}
+}
+
+// Unlocks red after a split-off task has combined its result
+// red must not be accessed afterwards: its task may have finished its loop
+static inline void RT_reduction_unlock(struct reduction *red)
+{
+	__atomic_store_n(&red->lock, 0, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&red->pending, 1, __ATOMIC_RELEASE);
+}
+
+// Injection queue: any thread can submit tasks to a pool (NULL for the pool
+// of tasking_init)
+struct tasking_pool;
+Task *RT_inject_alloc(struct tasking_pool *pool, unsigned long size);
+void RT_inject(struct tasking_pool *pool, Task *task);
+// Are injected tasks waiting to be picked up?
+bool RT_injected(struct tasking_pool *pool);
 
 // Poll for incoming steal requests and handle them if possible
 // Example: Polling on loop back edges with
@@ -1,15 +1,64 @@
 #ifndef TASK_H
 #define TASK_H
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define TASK_DATA_SIZE (192 - 72)
+#define TASK_DATA_SIZE (192 - 80)
 #define TASK_SIZE sizeof(Task)
 
+// Task objects come in different sizes (classes) to reduce the cache footprint
+// of tasks with little data. Data that exceeds TASK_DATA_SIZE is stored out of
+// line in a separate payload, with a small task object pointing to it.
+#define TASK_CLASS_SMALL   0 // 128-byte task object
+#define TASK_CLASS_LARGE   1 // 192-byte task object
+#define TASK_CLASS_PAYLOAD 2 // 128-byte task object + out-of-line payload
+
+// Number of different object sizes
+#define TASK_CLASSES 2
+
+#define TASK_SMALL_SIZE 128
+#define TASK_SMALL_DATA_SIZE (TASK_SMALL_SIZE - 80)
+
+// Class of a task that carries size bytes of data
+#define TASK_CLASS(size) \
+	((size) <= TASK_SMALL_DATA_SIZE ? TASK_CLASS_SMALL : \
+	 (size) <= TASK_DATA_SIZE ? TASK_CLASS_LARGE : TASK_CLASS_PAYLOAD)
+
+// Size of the task object of a given class
+#define TASK_OBJECT_SIZE(cls) ((cls) == TASK_CLASS_LARGE ? sizeof(Task) : TASK_SMALL_SIZE)
+
+// Number of task priorities (-DTASK_PRIORITIES=n), from 0 (the default) to
+// TASK_PRIORITY_MAX, at most 256
+#ifndef TASK_PRIORITIES
+#define TASK_PRIORITIES 3
+#endif
+
+#define TASK_PRIORITY_MAX (TASK_PRIORITIES-1)
+
+// Checks that prio is a valid priority
+#define TASK_PRIORITY(prio) \
+({ \
+	assert((unsigned int)(prio) < TASK_PRIORITIES); \
+	(unsigned char)(prio); \
+})
+
 typedef struct task Task;
 
+// Reduction of a splittable task (see runtime.h)
+struct reduction;
+
+// Cancellation token (see tasking_cancel)
+struct tasking_token {
+	// Token of the task that initialized this token, cancelling it cancels
+	// this token, too
+	struct tasking_token *parent;
+	bool cancelled;
+};
+
 struct task {
 	// Required to pop child tasks:
 	// if (child->parent == this) ...
@@ -24,16 +73,48 @@ struct task {
 	long cur;
 	long end;
 	int victim;
-	bool splittable;
+	// Number of loop dimensions (see task_ranges), 0 if the task can't be
+	// split
+	unsigned char splittable;
 	bool has_future;
+	unsigned char size_class;
+	// Tasks of higher priority are popped and stolen first
+	unsigned char priority;
 	// --- 64 bytes ---
-	// List of futures required by the current task
-	void *futures;
+	union {
+		// Reduction that tasks split off the current task combine their
+		// results into (splittable tasks)
+		struct reduction *reduction;
+		// Dependencies of the current task and its children (other tasks,
+		// see dependency.h)
+		struct dep_node *deps;
+	};
 	// --- 72 bytes ---
+	// Inherited from the parent, unless set with WITH_TOKEN
+	struct tasking_token *token;
+	// --- 80 bytes ---
 	// Task body carrying user data
+	// Tasks of class TASK_CLASS_SMALL have only TASK_SMALL_DATA_SIZE bytes
 	char data[TASK_DATA_SIZE] __attribute__((aligned(8)));
 };
 
+// Stored in data for tasks of class TASK_CLASS_PAYLOAD
+struct task_payload {
+	void *ptr;
+	unsigned long size;
+};
+
+// Range of an inner loop dimension
+struct task_range {
+	long start;
+	long end;
+};
+
+// Size of the data of a loop task with dims dimensions, given the size of its
+// arguments
+#define TASK_RANGES_SIZE(size, dims) \
+	((dims) > 1 ? (((size) + 7) & ~7UL) + ((dims) - 1) * sizeof(struct task_range) : (size))
+
 static inline Task *task_zero(Task *task)
 {
 	task->parent = NULL;
@@ -48,11 +129,27 @@ static inline Task *task_zero(Task *task)
 	task->victim = 0;
 	task->splittable = false;
 	task->has_future = false;
-	task->futures = NULL;
+	task->size_class = TASK_CLASS_LARGE;
+	task->priority = 0;
+	task->reduction = NULL;
+	task->token = NULL;
 
 	return task;
 }
 
+// Has the token of task, or one of its parent tokens, been cancelled?
+static inline bool task_cancelled(Task *task)
+{
+	struct tasking_token *tok;
+
+	for (tok = task->token; tok != NULL; tok = tok->parent) {
+		if (__atomic_load_n(&tok->cancelled, __ATOMIC_RELAXED))
+			return true;
+	}
+
+	return false;
+}
+
 static inline Task *task_new(void)
 {
 	Task *task = (Task *)malloc(sizeof(Task));
@@ -71,7 +168,64 @@ static inline void task_delete(Task *task)
 
 static inline char *task_data(Task *task)
 {
+	if (task->size_class == TASK_CLASS_PAYLOAD)
+		return ((struct task_payload *)task->data)->ptr;
+
 	return task->data;
 }
 
+// Number of bytes available in task_data(task)
+static inline unsigned long task_data_size(Task *task)
+{
+	switch (task->size_class) {
+	case TASK_CLASS_SMALL:
+		return TASK_SMALL_DATA_SIZE;
+	case TASK_CLASS_PAYLOAD:
+		return ((struct task_payload *)task->data)->size;
+	default:
+		return TASK_DATA_SIZE;
+	}
+}
+
+// Loop tasks with more than one dimension store the ranges of their inner
+// dimensions at the end of their data, behind their arguments; the outer
+// dimension is [start, end)
+static inline struct task_range *task_ranges(Task *task)
+{
+	assert(task->splittable > 1);
+
+	return (struct task_range *)(task_data(task) + task_data_size(task)) - (task->splittable - 1);
+}
+
+// Number of iterations of n nested ranges
+static inline long task_range_iterations(struct task_range *ranges, int n)
+{
+	long iters = 1;
+	int d;
+
+	for (d = 0; d < n; d++)
+		iters *= labs(ranges[d].end - ranges[d].start);
+
+	return iters;
+}
+
+// Copy task src to task dst, which must be of the same class and size
+// dst keeps its own payload, if any
+static inline Task *task_copy(Task *dst, Task *src)
+{
+	assert(dst->size_class == src->size_class);
+	assert(task_data_size(dst) == task_data_size(src));
+
+	if (src->size_class == TASK_CLASS_PAYLOAD) {
+		struct task_payload payload = *(struct task_payload *)dst->data;
+		memcpy(dst, src, TASK_SMALL_SIZE);
+		*(struct task_payload *)dst->data = payload;
+		memcpy(payload.ptr, task_data(src), payload.size);
+	} else {
+		memcpy(dst, src, TASK_OBJECT_SIZE(src->size_class));
+	}
+
+	return dst;
+}
+
 #endif // TASK_H
@@ -0,0 +1,356 @@
+#ifndef TASK_ALLOC_H
+#define TASK_ALLOC_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "task.h"
+
+//==========================================================================//
+//                                                                          //
+//    A slab allocator for task objects                                     //
+//                                                                          //
+//    Tasks are carved out of aligned chunks, each of which belongs to      //
+//    exactly one allocator (owner) and holds objects of one size class     //
+//    (see task.h). Stolen tasks are usually freed by another worker; such  //
+//    remote frees are collected in batches and returned to the owner in    //
+//    one go. The owner reclaims them before it needs to allocate a new     //
+//    chunk. Completely free chunks are retained up to a limit, and         //
+//    released to the system beyond that.                                   //
+//                                                                          //
+//    An allocator is not thread-safe, except for returning batches.        //
+//                                                                          //
+//==========================================================================//
+
+// Size and alignment of a chunk
+#ifndef TASK_CHUNK_SIZE
+#define TASK_CHUNK_SIZE 16384
+#endif
+
+// Chunk header occupies one cache line, so that tasks are cache-line aligned
+#define TASK_CHUNK_HEADER 64
+#define TASK_CHUNK_CAPACITY(cls) ((TASK_CHUNK_SIZE - TASK_CHUNK_HEADER) / TASK_OBJECT_SIZE(cls))
+
+// Maximum number of completely free chunks to retain per size class
+#ifndef TASK_ALLOC_MAX_EMPTY
+#define TASK_ALLOC_MAX_EMPTY 4
+#endif
+
+// Number of remote frees to collect before returning them to their owner
+#ifndef TASK_ALLOC_BATCH
+#define TASK_ALLOC_BATCH 32
+#endif
+
+// Number of owners for which remote frees are collected at the same time
+#define TASK_ALLOC_PENDING 4
+
+typedef struct task_allocator TaskAllocator;
+
+struct task_chunk {
+	// List of chunks with free tasks
+	struct task_chunk *prev, *next;
+	// List of all chunks
+	struct task_chunk *all_prev, *all_next;
+	TaskAllocator *owner;
+	Task *freelist;
+	unsigned int num_free;
+	unsigned int size_class;
+};
+
+struct task_batch {
+	TaskAllocator *owner;
+	Task *head, *tail;
+	unsigned int len;
+};
+
+struct task_allocator {
+	// Tasks returned by other allocators, linked through next
+	// Written by other workers, so keep it apart from the rest
+	Task *remote;
+	char __[64 - sizeof(Task *)];
+	struct {
+		// Chunks with free tasks
+		struct task_chunk *chunks;
+		// Number of chunks whose tasks are all free
+		unsigned int num_empty;
+	} classes[TASK_CLASSES];
+	struct task_chunk *all_chunks;
+	struct task_batch pending[TASK_ALLOC_PENDING];
+};
+
+// Chunk that task was carved out of
+#define TASK_CHUNK(task) \
+	((struct task_chunk *)((unsigned long)(task) & ~(unsigned long)(TASK_CHUNK_SIZE-1)))
+
+static inline void task_allocator_init(TaskAllocator *a)
+{
+	assert(sizeof(struct task_chunk) <= TASK_CHUNK_HEADER);
+	assert(TASK_CHUNK_HEADER % 64 == 0 && sizeof(Task) % 64 == 0);
+	assert(TASK_SMALL_SIZE % 64 == 0);
+
+	int i;
+
+	a->remote = NULL;
+	a->all_chunks = NULL;
+
+	for (i = 0; i < TASK_CLASSES; i++) {
+		a->classes[i].chunks = NULL;
+		a->classes[i].num_empty = 0;
+	}
+
+	for (i = 0; i < TASK_ALLOC_PENDING; i++) {
+		a->pending[i] = (struct task_batch){ NULL, NULL, NULL, 0 };
+	}
+}
+
+static inline void task_chunk_link(TaskAllocator *a, struct task_chunk *c)
+{
+	struct task_chunk **chunks = &a->classes[c->size_class].chunks;
+
+	c->prev = NULL;
+	c->next = *chunks;
+	if (*chunks) (*chunks)->prev = c;
+	*chunks = c;
+}
+
+static inline void task_chunk_unlink(TaskAllocator *a, struct task_chunk *c)
+{
+	if (c->prev) c->prev->next = c->next;
+	else a->classes[c->size_class].chunks = c->next;
+	if (c->next) c->next->prev = c->prev;
+	c->prev = c->next = NULL;
+}
+
+static inline struct task_chunk *task_chunk_new(TaskAllocator *a, unsigned int cls)
+{
+	struct task_chunk *c;
+	void *mem;
+	unsigned int i;
+
+	if (posix_memalign(&mem, TASK_CHUNK_SIZE, TASK_CHUNK_SIZE) != 0) {
+		fprintf(stderr, "Warning: task_chunk_new failed\n");
+		return NULL;
+	}
+
+	c = (struct task_chunk *)mem;
+
+	c->owner = a;
+	c->freelist = NULL;
+	c->num_free = TASK_CHUNK_CAPACITY(cls);
+	c->size_class = cls;
+
+	// Lowest addresses first
+	for (i = TASK_CHUNK_CAPACITY(cls); i > 0; i--) {
+		Task *task = (Task *)((char *)c + TASK_CHUNK_HEADER + (i-1) * TASK_OBJECT_SIZE(cls));
+		task->next = c->freelist;
+		c->freelist = task;
+	}
+
+	c->all_prev = NULL;
+	c->all_next = a->all_chunks;
+	if (a->all_chunks) a->all_chunks->all_prev = c;
+	a->all_chunks = c;
+
+	task_chunk_link(a, c);
+	a->classes[cls].num_empty++;
+
+	return c;
+}
+
+static inline void task_chunk_delete(TaskAllocator *a, struct task_chunk *c)
+{
+	if (c->all_prev) c->all_prev->all_next = c->all_next;
+	else a->all_chunks = c->all_next;
+	if (c->all_next) c->all_next->all_prev = c->all_prev;
+
+	free(c);
+}
+
+// Return task to its own chunk
+static inline void task_free_local(TaskAllocator *a, Task *task)
+{
+	struct task_chunk *c = TASK_CHUNK(task);
+	unsigned int cls = c->size_class;
+
+	assert(c->owner == a);
+	assert(c->num_free < TASK_CHUNK_CAPACITY(cls));
+
+	task->next = c->freelist;
+	c->freelist = task;
+
+	if (c->num_free++ == 0) {
+		// Chunk was full
+		task_chunk_link(a, c);
+	}
+
+	if (c->num_free == TASK_CHUNK_CAPACITY(cls)) {
+		if (a->classes[cls].num_empty == TASK_ALLOC_MAX_EMPTY) {
+			task_chunk_unlink(a, c);
+			task_chunk_delete(a, c);
+		} else {
+			a->classes[cls].num_empty++;
+		}
+	}
+}
+
+// Take all tasks returned by other allocators
+static inline void task_allocator_reclaim(TaskAllocator *a)
+{
+	Task *task, *next;
+
+	if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) == NULL)
+		return;
+
+	task = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+
+	for (; task != NULL; task = next) {
+		next = task->next;
+		task_free_local(a, task);
+	}
+}
+
+// Return a batch of tasks to its owner
+static inline void task_batch_flush(struct task_batch *b)
+{
+	TaskAllocator *owner = b->owner;
+	Task *old;
+
+	if (b->len == 0)
+		return;
+
+	old = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+	do {
+		b->tail->next = old;
+	} while (!__atomic_compare_exchange_n(&owner->remote, &old, b->head, true,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	*b = (struct task_batch){ NULL, NULL, NULL, 0 };
+}
+
+// Return all collected remote frees to their owners
+static inline void task_allocator_flush(TaskAllocator *a)
+{
+	int i;
+
+	for (i = 0; i < TASK_ALLOC_PENDING; i++) {
+		task_batch_flush(&a->pending[i]);
+	}
+}
+
+// Allocate a task that can hold size bytes of data
+// Data that does not fit into the largest task object goes into a payload
+static inline Task *task_alloc(TaskAllocator *a, unsigned long size)
+{
+	unsigned int cls = TASK_CLASS(size);
+	unsigned int obj = cls == TASK_CLASS_PAYLOAD ? TASK_CLASS_SMALL : cls;
+	struct task_chunk *c;
+	Task *task;
+
+	if (!a->classes[obj].chunks) {
+		task_allocator_reclaim(a);
+		if (!a->classes[obj].chunks && !task_chunk_new(a, obj))
+			return NULL;
+	}
+
+	c = a->classes[obj].chunks;
+	task = c->freelist;
+	c->freelist = task->next;
+
+	if (c->num_free-- == TASK_CHUNK_CAPACITY(obj)) {
+		a->classes[obj].num_empty--;
+	}
+
+	if (c->num_free == 0) {
+		task_chunk_unlink(a, c);
+	}
+
+	task_zero(task);
+	task->size_class = cls;
+
+	if (cls == TASK_CLASS_PAYLOAD) {
+		struct task_payload *payload = (struct task_payload *)task->data;
+		payload->ptr = malloc(size);
+		payload->size = size;
+		if (!payload->ptr) {
+			fprintf(stderr, "Warning: task_alloc failed\n");
+			task_free_local(a, task);
+			return NULL;
+		}
+	}
+
+	return task;
+}
+
+static inline void task_free(TaskAllocator *a, Task *task)
+{
+	TaskAllocator *owner = TASK_CHUNK(task)->owner;
+	struct task_batch *b = NULL;
+	int i;
+
+	if (task->size_class == TASK_CLASS_PAYLOAD) {
+		free(((struct task_payload *)task->data)->ptr);
+		task->size_class = TASK_CLASS_SMALL;
+	}
+
+	if (owner == a) {
+		task_free_local(a, task);
+		return;
+	}
+
+	// Find the batch for owner, or an unused one
+	for (i = 0; i < TASK_ALLOC_PENDING; i++) {
+		if (a->pending[i].owner == owner) {
+			b = &a->pending[i];
+			break;
+		}
+		if (!b && a->pending[i].len == 0) {
+			b = &a->pending[i];
+		}
+	}
+
+	if (!b) {
+		// Make room
+		b = &a->pending[0];
+		task_batch_flush(b);
+	}
+
+	b->owner = owner;
+	task->next = b->head;
+	b->head = task;
+	if (b->len++ == 0) {
+		b->tail = task;
+	}
+
+	if (b->len == TASK_ALLOC_BATCH) {
+		task_batch_flush(b);
+	}
+}
+
+// Requires that no other allocator returns tasks to a, and that all tasks
+// have been freed
+static inline void task_allocator_destroy(TaskAllocator *a)
+{
+	task_allocator_flush(a);
+	task_allocator_reclaim(a);
+
+	while (a->all_chunks) {
+		task_chunk_delete(a, a->all_chunks);
+	}
+
+	task_allocator_init(a);
+}
+
+// Number of free tasks of class cls in the chunks of a
+static inline unsigned int task_allocator_num_free(TaskAllocator *a, unsigned int cls)
+{
+	struct task_chunk *c;
+	unsigned int n = 0;
+
+	for (c = a->classes[cls].chunks; c != NULL; c = c->next) {
+		n += c->num_free;
+	}
+
+	return n;
+}
+
+#endif // TASK_ALLOC_H
@@ -2,45 +2,284 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "affinity.h"
+#include "placement.h"
 #include "profile.h"
 #include "runtime.h"
+#include "tasking.h"
 #include "tasking_internal.h"
+#include "topology.h"
+#include "tsc.h"
 
 // Shared state
-int num_workers;
+struct tasking_pool *default_pool;
 
 // Private state
+PRIVATE struct tasking_pool *current_pool;
+PRIVATE int num_workers;
+PRIVATE int *worker_cpus;
 PRIVATE int ID;
-PRIVATE int num_tasks_exec;
+PRIVATE long num_tasks_exec;
+PRIVATE unsigned int num_tasks_cancelled;
 PRIVATE bool tasking_finished;
 
 // Pointer to the task that is currently running
 PRIVATE Task *current_task;
 
-static int *IDs;
-static pthread_t *worker_threads;
-static pthread_barrier_t global_barrier;
+// Allowed CPUs and machine topology, shared by all pools
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static int num_pools;
+static int num_cpus;
+static int *cpus;
 
+// To profile different parts of the runtime
+PROFILE_EXTERN_DECL(RUN_TASK);
+PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
+PROFILE_EXTERN_DECL(SEND_RECV_TASK);
+PROFILE_EXTERN_DECL(SEND_RECV_REQ);
+PROFILE_EXTERN_DECL(IDLE);
+
+extern PRIVATE unsigned int requests_sent, requests_handled;
+extern PRIVATE unsigned int requests_declined, tasks_sent;
+extern PRIVATE unsigned int tasks_split;
+extern PRIVATE unsigned int requests_steal_one, requests_steal_half;
+extern PRIVATE unsigned int idle_entered, idle_blocked;
+extern PRIVATE unsigned long long idle_ticks;
+extern int steal_policy;
+#ifdef LAZY_FUTURES
+extern PRIVATE unsigned int futures_converted;
+#endif
+#ifdef FIBERS
+extern PRIVATE unsigned int awaits_suspended;
+#endif
+
+// Addresses of the private counters of every worker, so that the master can
+// read them while workers are running
+struct worker_counters {
+	unsigned int *requests_sent, *requests_handled;
+	unsigned int *requests_declined, *tasks_sent;
+	unsigned int *tasks_split;
+	unsigned int *requests_steal_one, *requests_steal_half;
+	unsigned int *futures_converted;
+	unsigned int *awaits_suspended;
+	unsigned int *idle_entered, *idle_blocked;
+	unsigned long long *idle_ticks;
+	long *tasks_executed;
+	unsigned int *tasks_cancelled;
+#ifndef NTIME
+	mytimer_t *timer_run_tasks, *timer_send_recv_sreqs;
+	mytimer_t *timer_send_recv_tasks, *timer_enq_deq_tasks;
+	mytimer_t *timer_idle;
+#endif
+};
+
+static void register_counters(void);
 static int tasking_statistics(void);
 
-static void *worker_entry_fn(void *args)
+// Called when the first pool is created
+static void pools_init(void)
 {
-	ID = *(int *)args;
-	set_current_task(NULL);
+	// Call cpu_count() and allowed_cpus() only once, before changing the
+	// affinity of thread 0! After set_thread_affinity(0), cpu_count() would
+	// return 1, and every thread would end up being pinned to processor 0.
+	if (num_cpus == 0) {
+		num_cpus = cpu_count();
+		cpus = (int *)malloc(num_cpus * sizeof(int));
+		num_cpus = allowed_cpus(cpus, num_cpus);
+
+#if !defined(NTIME) || !defined(NHIST) || !defined(NTRACE)
+		// Calibrate the time stamp counter for timers, histograms, and traces
+		// (see tsc.h)
+		if (tsc_init() == 0) {
+			printf("TSC frequency: %.3lf GHz\n", tsc_ticks_per_usec / 1e3);
+		}
+#endif
+
+		// Override default scheduling policies with TASKING_STEAL, TASKING_SPLIT,
+		// and TASKING_STEAL_EARLY
+		RT_configure();
+	}
+
+	// CPUs are numbered from 0 to the highest allowed CPU
+	topology_init(cpus[num_cpus-1] + 1);
+}
+
+// Called when the last pool is destroyed
+static void pools_exit(void)
+{
+	topology_exit();
+}
+
+static struct tasking_pool *pool_alloc(int n, const char *placement)
+{
+	struct tasking_pool *pool;
+	int i;
+
+	pool = (struct tasking_pool *)calloc(1, sizeof(struct tasking_pool));
+	if (!pool) {
+		fprintf(stderr, "Warning: pool_alloc failed\n");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pools_lock);
+	if (num_pools++ == 0) pools_init();
+	pthread_mutex_unlock(&pools_lock);
+
+	pool->num_workers = n;
+	pool->args = (struct worker_args *)malloc(n * sizeof(struct worker_args));
+	pool->worker_threads = (pthread_t *)malloc(n * sizeof(pthread_t));
+	pool->worker_cpus = (int *)malloc(n * sizeof(int));
+	pool->counters = (struct worker_counters *)calloc(n, sizeof(struct worker_counters));
+	pool->rt = RT_pool_alloc();
+
+	if (!pool->args || !pool->worker_threads || !pool->worker_cpus ||
+		!pool->counters || !pool->rt) {
+		fprintf(stderr, "Warning: pool_alloc failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++) {
+		pool->args[i] = (struct worker_args){ pool, i };
+	}
+
+	// Bind worker threads to allowed CPUs according to placement (see
+	// placement.h)
+	placement_init(pool->worker_cpus, n, cpus, num_cpus, placement);
+
+	pthread_barrier_init(&pool->barrier, NULL, n);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	return pool;
+}
+
+static void pool_free(struct tasking_pool *pool)
+{
+	pthread_barrier_destroy(&pool->barrier);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	RT_pool_free(pool->rt);
+	free(pool->counters);
+	free(pool->worker_cpus);
+	free(pool->worker_threads);
+	free(pool->args);
+	free(pool);
+
+	pthread_mutex_lock(&pools_lock);
+	if (--num_pools == 0) pools_exit();
+	pthread_mutex_unlock(&pools_lock);
+}
+
+static void worker_init(struct worker_args *args)
+{
+	current_pool = args->pool;
+	num_workers = current_pool->num_workers;
+	worker_cpus = current_pool->worker_cpus;
+	ID = args->ID;
 	num_tasks_exec = 0;
+	num_tasks_cancelled = 0;
 	tasking_finished = false;
+}
+
+static void master_init(void)
+{
+	set_current_task((Task *)malloc(sizeof(Task)));
+	current_task->parent = NULL;
+	current_task->fn = NULL;
+	current_task->start = 0;
+	current_task->cur = 0;
+	current_task->end = 0;
+	current_task->splittable = false;
+	current_task->deps = NULL;
+	current_task->token = NULL;
 
 	RT_init();
-	pthread_barrier_wait(&global_barrier);
+	register_counters();
+	pthread_barrier_wait(&current_pool->barrier);
 	// -----------------------------------
+}
 
-	RT_schedule();
-	pthread_barrier_wait(&global_barrier);
+// Requires a preceding barrier
+static void master_exit(void)
+{
+	RT_async_action(RT_EXIT);
+	pthread_barrier_wait(&current_pool->barrier);
 	// -----------------------------------
 
 	tasking_statistics();
+	pthread_barrier_wait(&current_pool->barrier);
+	// -----------------------------------
+
+	RT_exit();
+
+	// Deallocate root task
+	assert(is_root_task(current_task));
+	free(current_task);
+	set_current_task(NULL);
+}
+
+// Master of a dedicated pool: runs jobs submitted with tasking_pool_run, and
+// helps with injected tasks (see RT_inject)
+static void pool_master(void)
+{
+	struct tasking_pool *pool = current_pool;
+	void (*job)(void *);
+
+	master_init();
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (!pool->job && !pool->shutdown && !RT_injected(pool)) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (!pool->job && !RT_injected(pool)) break;
+		job = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (job) job(pool->job_arg);
+		// Also waits for injected tasks
+		RT_barrier();
+
+		pthread_mutex_lock(&pool->lock);
+		if (job) {
+			pool->job = NULL;
+			pool->jobs_done++;
+			pthread_cond_broadcast(&pool->cond);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	// master_exit requires a preceding barrier, even without any jobs
+	RT_barrier();
+	master_exit();
+}
+
+static void *worker_entry_fn(void *args)
+{
+	worker_init((struct worker_args *)args);
+
+	MASTER {
+		pool_master();
+		return NULL;
+	}
+
+	set_current_task(NULL);
+
+	RT_init();
+	register_counters();
+	pthread_barrier_wait(&current_pool->barrier);
+	// -----------------------------------
+
+	RT_schedule();
+	pthread_barrier_wait(&current_pool->barrier);
+	// -----------------------------------
+
+	// Wait until the master has collected statistics
+	pthread_barrier_wait(&current_pool->barrier);
 	// -----------------------------------
 
 	RT_exit();
@@ -50,103 +289,156 @@ static void *worker_entry_fn(void *args)
 
 int tasking_init(UNUSED(int *argc), UNUSED(char ***argv))
 {
-	static int num_cpus;
-
+	struct tasking_pool *pool;
 	char *envval;
-	int i;
+	int n, i;
 
 	envval = getenv("NUM_THREADS");
 	if (envval) {
-		num_workers = atoi(envval);
-		if (num_workers <= 0) {
+		n = atoi(envval);
+		if (n <= 0) {
 			printf("NUM_THREADS must be > 0\n");
 			exit(0);
-		} else if (num_workers > MAXWORKERS) {
+		} else if (n > MAXWORKERS) {
 			printf("NUM_THREADS is truncated to %d\n", MAXWORKERS);
-			num_workers = MAXWORKERS;
+			n = MAXWORKERS;
 		}
 	} else {
 		// May not be standard
-		num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+		n = sysconf(_SC_NPROCESSORS_ONLN);
 	}
 
-	// Call cpu_count() only once, before changing the affinity of thread 0!
-	// After set_thread_affinity(0), cpu_count() would return 1, and every
-	// thread would end up being pinned to processor 0.
-	num_cpus = (num_cpus == 0) ? cpu_count() : num_cpus;
+	// Bind worker threads to allowed CPUs according to TASKING_PLACEMENT
+	pool = pool_alloc(n, getenv("TASKING_PLACEMENT"));
+	if (!pool) exit(1);
+	pool->is_default = true;
+	default_pool = pool;
 	printf("Number of CPUs: %d\n", num_cpus);
 
 	// Beware of false sharing!
 	// int *shared_var_a = (int *)malloc(sizeof(int));
 	// int *shared_var_b = (int *)malloc(sizeof(int));
 
-	IDs = (int *)malloc(num_workers * sizeof(int));
-	worker_threads = (pthread_t *)malloc(num_workers * sizeof(pthread_t));
+	// Record scheduler events (see trace.h)
+	TRACE_INIT(n);
 
-	pthread_barrier_init(&global_barrier, NULL, num_workers);
+	// Record latency histograms (see histogram.h)
+	HIST_INIT(n);
 
 	// Master thread
-	ID = IDs[0] = 0;
+	worker_init(&pool->args[0]);
 
-	// Bind master thread to CPU 0
-	set_thread_affinity(0);
+	// Bind master thread
+	set_thread_affinity(worker_cpus[0]);
 
 	// Create num_workers-1 worker threads
 	for (i = 1; i < num_workers; i++) {
-		IDs[i] = i;
-		pthread_create(&worker_threads[i], NULL, worker_entry_fn, &IDs[i]);
-		// Bind worker threads to available CPUs in a round-robin fashion
-#ifdef __MIC__
-		// Take four-way hyper-threading into account (our MIC has 60 cores)
-		set_thread_affinity(worker_threads[i], (i * 4) % num_cpus + (i / 60));
-#else
-		set_thread_affinity(worker_threads[i], i % num_cpus);
-#endif
+		pthread_create(&pool->worker_threads[i], NULL, worker_entry_fn, &pool->args[i]);
+		set_thread_affinity(pool->worker_threads[i], worker_cpus[i]);
 	}
 
-	set_current_task((Task *)malloc(sizeof(Task)));
-	current_task->parent = NULL;
-	current_task->fn = NULL;
-	current_task->start = 0;
-	current_task->cur = 0;
-	current_task->end = 0;
-	current_task->splittable = false;
-
-	num_tasks_exec = 0;
-	tasking_finished = false;
-
-	RT_init();
-	pthread_barrier_wait(&global_barrier);
-	// -----------------------------------
+	master_init();
 
 	return 0;
 }
 
 int tasking_exit(void)
 {
+	struct tasking_pool *pool = current_pool;
 	int i;
 
-	RT_async_action(RT_EXIT);
-	pthread_barrier_wait(&global_barrier);
-	// -----------------------------------
-
-	tasking_statistics();
-	// -----------------------------------
+	assert(pool != NULL && pool->is_default);
 
-	RT_exit();
+	master_exit();
 
 	// Join worker threads
 	for (i = 1; i < num_workers; i++) {
-		pthread_join(worker_threads[i], NULL);
+		pthread_join(pool->worker_threads[i], NULL);
 	}
 
-	pthread_barrier_destroy(&global_barrier);
-	free(worker_threads);
-	free(IDs);
+	// Write trace to TASKING_TRACE, or trace.json by default
+	TRACE_DUMP(getenv("TASKING_TRACE"));
+	TRACE_EXIT();
 
-	// Deallocate root task
-	assert(is_root_task(current_task));
-	free(current_task);
+	// Print percentiles, and write histograms to TASKING_HIST if set
+	HIST_REPORT();
+	HIST_DUMP(getenv("TASKING_HIST"));
+	HIST_EXIT();
+
+	current_pool = NULL;
+	default_pool = NULL;
+	pool_free(pool);
+
+	return 0;
+}
+
+tasking_pool *tasking_pool_create(int n, const char *placement)
+{
+	struct tasking_pool *pool;
+	int i;
+
+	if (n <= 0 || n > MAXWORKERS) {
+		fprintf(stderr, "Warning: invalid number of workers %d\n", n);
+		return NULL;
+	}
+
+	pool = pool_alloc(n, placement);
+	if (!pool) return NULL;
+
+	// All workers, including the master, are new threads
+	for (i = 0; i < n; i++) {
+		pthread_create(&pool->worker_threads[i], NULL, worker_entry_fn, &pool->args[i]);
+		set_thread_affinity(pool->worker_threads[i], pool->worker_cpus[i]);
+	}
+
+	return pool;
+}
+
+int tasking_pool_run(tasking_pool *pool, void (*fn)(void *), void *arg)
+{
+	unsigned long job;
+
+	// The master of pool would wait for itself
+	assert(current_pool != pool);
+	assert(fn != NULL);
+
+	pthread_mutex_lock(&pool->lock);
+
+	// One job at a time
+	while (pool->job) {
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	}
+
+	pool->job = fn;
+	pool->job_arg = arg;
+	job = pool->jobs_submitted++;
+	pthread_cond_broadcast(&pool->cond);
+
+	while (pool->jobs_done <= job) {
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+int tasking_pool_destroy(tasking_pool *pool)
+{
+	int i;
+
+	assert(current_pool != pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->num_workers; i++) {
+		pthread_join(pool->worker_threads[i], NULL);
+	}
+
+	pool_free(pool);
 
 	return 0;
 }
@@ -156,57 +448,209 @@ int tasking_barrier(void)
 	return RT_barrier();
 }
 
-// To profile different parts of the runtime
-PROFILE_EXTERN_DECL(RUN_TASK);
-PROFILE_EXTERN_DECL(ENQ_DEQ_TASK);
-PROFILE_EXTERN_DECL(SEND_RECV_TASK);
-PROFILE_EXTERN_DECL(SEND_RECV_REQ);
-PROFILE_EXTERN_DECL(IDLE);
+void tasking_token_init(tasking_token *tok)
+{
+	Task *this = get_current_task();
 
-extern PRIVATE unsigned int requests_sent, requests_handled;
-extern PRIVATE unsigned int requests_declined, tasks_sent;
-extern PRIVATE unsigned int tasks_split;
-#if STEAL == adaptive
-extern PRIVATE unsigned int requests_steal_one, requests_steal_half;
-#endif
+	tok->parent = this ? this->token : NULL;
+	tok->cancelled = false;
+}
+
+void tasking_cancel(tasking_token *tok)
+{
+	__atomic_store_n(&tok->cancelled, true, __ATOMIC_RELAXED);
+}
+
+// Called by every worker before it starts running tasks
+static void register_counters(void)
+{
+	struct worker_counters *c = &current_pool->counters[ID];
+
+	c->requests_sent = &requests_sent;
+	c->requests_handled = &requests_handled;
+	c->requests_declined = &requests_declined;
+	c->tasks_sent = &tasks_sent;
+	c->tasks_split = &tasks_split;
+	c->requests_steal_one = &requests_steal_one;
+	c->requests_steal_half = &requests_steal_half;
 #ifdef LAZY_FUTURES
-extern PRIVATE unsigned int futures_converted;
+	c->futures_converted = &futures_converted;
+#else
+	c->futures_converted = NULL;
 #endif
+#ifdef FIBERS
+	c->awaits_suspended = &awaits_suspended;
+#else
+	c->awaits_suspended = NULL;
+#endif
+	c->tasks_executed = &num_tasks_exec;
+	c->tasks_cancelled = &num_tasks_cancelled;
+	c->idle_entered = &idle_entered;
+	c->idle_blocked = &idle_blocked;
+	c->idle_ticks = &idle_ticks;
+#ifndef NTIME
+	c->timer_run_tasks = &timer_run_tasks;
+	c->timer_send_recv_sreqs = &timer_send_recv_sreqs;
+	c->timer_send_recv_tasks = &timer_send_recv_tasks;
+	c->timer_enq_deq_tasks = &timer_enq_deq_tasks;
+	c->timer_idle = &timer_idle;
+#endif
+}
 
-static int tasking_statistics(void)
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+
+#ifndef NTIME
+// Elapsed time of a timer owned by another worker
+static double timer_load(mytimer_t *timer)
 {
-	MASTER {
-		printf("\n");
-		printf("+========================================+\n");
-		printf("|  Per-worker statistics                 |\n");
-		printf("+========================================+\n");
-	}
+	mytimer_t t = { .elapsed = LOAD(&timer->elapsed) };
+	return timer_elapsed(&t, timer_us);
+}
+#endif
 
-	pthread_barrier_wait(&global_barrier);
-	// -----------------------------------
+static void compute_ratios(tasking_worker_stats *s)
+{
+	s->steal_one_ratio = s->requests_sent > 0
+		? ((double)s->requests_steal_one/s->requests_sent) * 100
+		: 0;
+	s->steal_half_ratio = s->requests_sent > 0
+		? ((double)s->requests_steal_half/s->requests_sent) * 100
+		: 0;
+}
+
+tasking_stats *tasking_stats_snapshot(void)
+{
+	tasking_stats *stats;
+	tasking_worker_stats *s, *t;
+	struct worker_counters *c;
+	int i;
+
+	assert(current_pool != NULL && ID == MASTER_ID);
 
-	printf("Worker %d: %u steal requests sent\n", ID, requests_sent);
-	printf("Worker %d: %u steal requests handled\n", ID, requests_handled);
-	printf("Worker %d: %u steal requests declined\n", ID, requests_declined);
-	printf("Worker %d: %u tasks executed\n", ID, num_tasks_exec);
-	printf("Worker %d: %u tasks sent\n", ID, tasks_sent);
-	printf("Worker %d: %u tasks split\n", ID, tasks_split);
-#if STEAL == adaptive
-	assert(requests_steal_one + requests_steal_half == requests_sent);
-	printf("Worker %d: %.2f %% steal-one\n", ID, requests_sent > 0
-			? ((double)requests_steal_one/requests_sent) * 100
-			: 0);
-	printf("Worker %d: %.2f %% steal-half\n", ID, requests_sent > 0
-			? ((double)requests_steal_half/requests_sent) * 100
-			: 0);
+	stats = (tasking_stats *)calloc(1, sizeof(tasking_stats) +
+			num_workers * sizeof(tasking_worker_stats));
+	if (!stats) {
+		fprintf(stderr, "Warning: tasking_stats_snapshot failed\n");
+		return NULL;
+	}
+
+	stats->num_workers = num_workers;
+	t = &stats->total;
+
+	for (i = 0; i < num_workers; i++) {
+		s = &stats->workers[i];
+		c = &current_pool->counters[i];
+		s->requests_sent = LOAD(c->requests_sent);
+		s->requests_handled = LOAD(c->requests_handled);
+		s->requests_declined = LOAD(c->requests_declined);
+		s->requests_steal_one = LOAD(c->requests_steal_one);
+		s->requests_steal_half = LOAD(c->requests_steal_half);
+		s->tasks_executed = LOAD(c->tasks_executed);
+		s->tasks_cancelled = LOAD(c->tasks_cancelled);
+		s->tasks_sent = LOAD(c->tasks_sent);
+		s->tasks_split = LOAD(c->tasks_split);
+		s->futures_converted = c->futures_converted ? LOAD(c->futures_converted) : 0;
+		s->awaits_suspended = c->awaits_suspended ? LOAD(c->awaits_suspended) : 0;
+		s->idle_entered = LOAD(c->idle_entered);
+		s->idle_blocked = LOAD(c->idle_blocked);
+		s->time_idle_state = tsc_usec(LOAD(c->idle_ticks));
+		compute_ratios(s);
+#ifndef NTIME
+		s->time_run_tasks = timer_load(c->timer_run_tasks);
+		s->time_send_recv_reqs = timer_load(c->timer_send_recv_sreqs);
+		s->time_send_recv_tasks = timer_load(c->timer_send_recv_tasks);
+		s->time_enq_deq_tasks = timer_load(c->timer_enq_deq_tasks);
+		s->time_idle = timer_load(c->timer_idle);
+		s->time_total = s->time_run_tasks + s->time_send_recv_reqs +
+			s->time_send_recv_tasks + s->time_enq_deq_tasks + s->time_idle;
 #endif
+
+		t->requests_sent += s->requests_sent;
+		t->requests_handled += s->requests_handled;
+		t->requests_declined += s->requests_declined;
+		t->requests_steal_one += s->requests_steal_one;
+		t->requests_steal_half += s->requests_steal_half;
+		t->tasks_executed += s->tasks_executed;
+		t->tasks_cancelled += s->tasks_cancelled;
+		t->tasks_sent += s->tasks_sent;
+		t->tasks_split += s->tasks_split;
+		t->futures_converted += s->futures_converted;
+		t->awaits_suspended += s->awaits_suspended;
+		t->idle_entered += s->idle_entered;
+		t->idle_blocked += s->idle_blocked;
+		t->time_idle_state += s->time_idle_state;
+		t->time_run_tasks += s->time_run_tasks;
+		t->time_send_recv_reqs += s->time_send_recv_reqs;
+		t->time_send_recv_tasks += s->time_send_recv_tasks;
+		t->time_enq_deq_tasks += s->time_enq_deq_tasks;
+		t->time_idle += s->time_idle;
+		t->time_total += s->time_total;
+	}
+
+	compute_ratios(t);
+
+	return stats;
+}
+
+// Prints per-worker statistics unless TASKING_STATS=off
+// Must be called by the master after all workers have stopped
+static int tasking_statistics(void)
+{
+	tasking_stats *stats;
+	tasking_worker_stats *s;
+	char *envval;
+	int i;
+
+	envval = getenv("TASKING_STATS");
+	if (envval && strcmp(envval, "off") == 0)
+		return 0;
+
+	stats = tasking_stats_snapshot();
+	if (!stats)
+		return -1;
+
+	printf("\n");
+	printf("+========================================+\n");
+	printf("|  Per-worker statistics                 |\n");
+	printf("+========================================+\n");
+
+	for (i = 0; i < stats->num_workers; i++) {
+		s = &stats->workers[i];
+		printf("Worker %d: %u steal requests sent\n", i, s->requests_sent);
+		printf("Worker %d: %u steal requests handled\n", i, s->requests_handled);
+		printf("Worker %d: %u steal requests declined\n", i, s->requests_declined);
+		printf("Worker %d: %lu tasks executed\n", i, s->tasks_executed);
+		printf("Worker %d: %u tasks cancelled\n", i, s->tasks_cancelled);
+		printf("Worker %d: %u tasks sent\n", i, s->tasks_sent);
+		printf("Worker %d: %u tasks split\n", i, s->tasks_split);
+		assert(s->requests_steal_one + s->requests_steal_half == s->requests_sent);
+		if (steal_policy == adaptive) {
+			printf("Worker %d: %.2f %% steal-one\n", i, s->steal_one_ratio);
+			printf("Worker %d: %.2f %% steal-half\n", i, s->steal_half_ratio);
+		}
 #ifdef LAZY_FUTURES
-	printf("Worker %d: %u futures converted\n", ID, futures_converted);
+		printf("Worker %d: %u futures converted\n", i, s->futures_converted);
 #endif
-
-	PROFILE_RESULTS();
+#ifdef FIBERS
+		printf("Worker %d: %u awaits suspended\n", i, s->awaits_suspended);
+#endif
+#ifdef BACKOFF
+		printf("Worker %d: %u times idle (%u blocked), %.3lf ms\n", i,
+				s->idle_entered, s->idle_blocked, s->time_idle_state / 1000);
+#endif
+#ifndef NTIME
+		// Parsable format
+		// The first value should make it easy to grep for these lines, e.g. with
+		// ./a.out | grep Timer | cut -d, -f2-
+		// Worker ID, Task, Send/Recv Req, Send/Recv Task, Enq/Deq Task, Idle, Total
+		printf("Timer,%d,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf\n", i,
+				s->time_run_tasks, s->time_send_recv_reqs, s->time_send_recv_tasks,
+				s->time_enq_deq_tasks, s->time_idle, s->time_total);
+#endif
+	}
 
 	fflush(stdout);
+	free(stats);
 
 	return 0;
 }
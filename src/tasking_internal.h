@@ -1,10 +1,14 @@
 #ifndef TASKING_INTERNAL_H
 #define TASKING_INTERNAL_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include "atomic.h"
+#include "dependency.h"
 #include "platform.h"
+#include "histogram.h"
 #include "task.h"
+#include "trace.h"
 #ifdef USE_COZ
 #include "coz.h"
 #endif
@@ -13,12 +17,45 @@
 #define MASTER if (ID == MASTER_ID)
 #define WORKER if (ID != MASTER_ID)
 
-// Shared state
-extern int num_workers;
+struct worker_args {
+	struct tasking_pool *pool;
+	int ID;
+};
+
+// A pool of workers, created by tasking_init or tasking_pool_create
+struct tasking_pool {
+	int num_workers;
+	// CPU that worker i is pinned to
+	int *worker_cpus;
+	struct worker_args *args;
+	pthread_t *worker_threads;
+	pthread_barrier_t barrier;
+	// Runtime state shared by the workers (see runtime.c)
+	struct RT_pool *rt;
+	// Addresses of the counters of every worker (see tasking_stats_snapshot)
+	struct worker_counters *counters;
+	// The pool of tasking_init, whose master is the calling thread
+	bool is_default;
+	// Dedicated pools: jobs for the master (see tasking_pool_run)
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	void (*job)(void *);
+	void *job_arg;
+	unsigned long jobs_submitted, jobs_done;
+	bool shutdown;
+};
+
+// The pool of tasking_init
+extern struct tasking_pool *default_pool;
 
 // Private state
+extern PRIVATE struct tasking_pool *current_pool;
+// Copies of current_pool->num_workers and current_pool->worker_cpus
+extern PRIVATE int num_workers;
+extern PRIVATE int *worker_cpus;
 extern PRIVATE int ID;
-extern PRIVATE int num_tasks_exec;
+extern PRIVATE long num_tasks_exec;
+extern PRIVATE unsigned int num_tasks_cancelled;
 extern PRIVATE bool tasking_finished;
 
 // Pointer to the task that is currently running
@@ -39,23 +76,49 @@ static inline bool is_root_task(Task *task)
 	return task->parent == NULL ? true : false;
 }
 
+// Push the tasks that depend on task (see runtime.c)
+void RT_release_deps(Task *task);
+
 // Wrapper function for running a new task
 static inline void run_task(Task *task)
 {
 	//if (task->splittable)
 	//	fprintf(stderr, "%2d: Running [%2ld,%2ld)\n", ID, task->start, task->end);
 
+	// Tasks split off a reduction run, their loops end early, but they must
+	// still combine their results (see ASYNC_FOR_REDUCE)
+	if (task_cancelled(task) && !task->has_future &&
+		!(task->splittable && task->reduction)) {
+		// Skip the task, but release the tasks that depend on it
+		num_tasks_cancelled++;
+		if (task_deps(task)) {
+			RT_release_deps(task);
+		}
+		return;
+	}
+
 	Task *this_ = get_current_task();
 	set_current_task(task);
-	task->fn(task->data);
+	TRACE(TASK_START, -1, task, 0);
+	HIST_TICKS(start);
+	task->fn(task_data(task));
+	HIST_RECORD_SINCE(RUN_TASK, start);
+	TRACE(TASK_END, -1, task, 0);
 	set_current_task(this_);
-	if (task->splittable) {
+	// Tasks with dependencies, and tasks that have created children with
+	// dependencies, have dependency records
+	if (task_deps(task)) {
+		RT_release_deps(task);
+	}
+	if (task->splittable == 1) {
 		// We have executed |end-start| iterations
-		int n = labs(task->end - task->start);
-		num_tasks_exec += n;
-	} else {
+		num_tasks_exec += labs(task->end - task->start);
+	} else if (!task->splittable) {
 		num_tasks_exec++;
 	}
+	// Multi-dimensional loops count their iterations as they run, because
+	// splitting an inner dimension changes the ranges of later iterations
+	// (see ASYNC_FOR_DIMS)
 
 #ifdef USE_COZ
 	COZ_PROGRESS_NAMED("task executed");
@@ -12,37 +12,31 @@
 #else
 
 #include <stdarg.h>
-
-#define CYCLES_PER_SEC(t)	((t) * 1e9)
-#define CYCLES_PER_MSEC(t)	((t) * 1e6)
-#define CYCLES_PER_USEC(t)	((t) * 1e3)
+#include "tsc.h"
 
 typedef struct timer {
 	unsigned long long start, end;
 	unsigned long long elapsed;
-	double GHZ;
 } mytimer_t;
 
 enum {
 	timer_us, timer_ms, timer_s
 };
 
+// Ticks are converted into time using the calibration done by tsc_init
+// (see tsc.h)
 static inline unsigned long long getticks(void)
 {
-	unsigned int lo, hi;
-	// RDTSC copies contents of 64-bit TSC into EDX:EAX
-	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
-	return (unsigned long long)hi << 32 | lo;
+	return tsc_read_serialized();
 }
 
 // Resets the timer
-static inline void timer_new(mytimer_t *timer, double GHZ)
+static inline void timer_new(mytimer_t *timer)
 {
 	timer->elapsed = 0;
-	timer->GHZ = GHZ;
 }
 
-#define timer_reset(t, f) timer_new(t, f)
+#define timer_reset(t) timer_new(t)
 
 static inline void timer_start(mytimer_t *timer)
 {
@@ -61,14 +55,14 @@ static inline double timer_elapsed(mytimer_t *timer, int opt)
 	double elapsed = -1.0;
 
 	switch (opt) {
-	case timer_us: // cycles -> microseconds
-		elapsed = timer->elapsed / CYCLES_PER_USEC(timer->GHZ);
+	case timer_us: // ticks -> microseconds
+		elapsed = tsc_usec(timer->elapsed);
 		break;
-	case timer_ms: // cycles -> milliseconds
-		elapsed = timer->elapsed / CYCLES_PER_MSEC(timer->GHZ);
+	case timer_ms: // ticks -> milliseconds
+		elapsed = tsc_usec(timer->elapsed) / 1e3;
 		break;
-	case timer_s:  // cycles -> seconds
-		elapsed = timer->elapsed / CYCLES_PER_SEC(timer->GHZ);
+	case timer_s:  // ticks -> seconds
+		elapsed = tsc_usec(timer->elapsed) / 1e6;
 		break;
 	default:
 		break;
@@ -97,7 +91,7 @@ static inline double timers_elapsed(mytimer_t *timer, int opt, ...)
 	return elapsed;
 }
 
-// Returns elapsed time in number of clock cycles
+// Returns elapsed time in number of ticks
 static inline unsigned long long timer_cycles(mytimer_t *timer)
 {
 	return timer->elapsed;
@@ -0,0 +1,154 @@
+// gcc -Wall -Wextra -fsanitize=address,undefined -DTEST topology.c -o topology && ./topology
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "topology.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu/cpu%d/"
+
+// groups[cpu * TOPO_LEVELS + level]
+static int *groups;
+static int num_cpus;
+
+// Read the first integer of a sysfs file
+// This also works for CPU lists like "0-3,8-11", in which case the first CPU
+// is returned. The first CPU of a list of sibling CPUs makes for a group ID.
+static int sysfs_read_int(const char *fmt, int cpu, int index, int *val)
+{
+	char path[128];
+	FILE *f;
+	int n;
+
+	snprintf(path, sizeof(path), fmt, cpu, index);
+
+	f = fopen(path, "r");
+	if (!f) return -1;
+
+	n = fscanf(f, "%d", val);
+	fclose(f);
+
+	return n == 1 ? 0 : -1;
+}
+
+// Group ID of the cache with the highest level, usually the L3 cache
+static int llc_group(int cpu)
+{
+	int i, level, llc_level = -1, group = -1;
+
+	for (i = 0; sysfs_read_int(SYSFS_CPU "cache/index%d/level", cpu, i, &level) == 0; i++) {
+		int first;
+		if (level <= llc_level) continue;
+		if (sysfs_read_int(SYSFS_CPU "cache/index%d/shared_cpu_list", cpu, i, &first) == 0) {
+			llc_level = level;
+			group = first;
+		}
+	}
+
+	return group;
+}
+
+int topology_init(int n)
+{
+	int cpu, ret = 0;
+
+	assert(n > 0);
+
+	num_cpus = n;
+	groups = (int *)malloc(num_cpus * TOPO_LEVELS * sizeof(int));
+	if (!groups) {
+		fprintf(stderr, "Warning: topology_init failed\n");
+		return -1;
+	}
+
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		int *g = &groups[cpu * TOPO_LEVELS];
+		if (sysfs_read_int(SYSFS_CPU "topology/thread_siblings_list", cpu, 0, &g[TOPO_CORE]) != 0) {
+			// No sysfs: separate cores in a single socket
+			g[TOPO_CORE] = cpu;
+			g[TOPO_LLC] = 0;
+			g[TOPO_SOCKET] = 0;
+			ret = -1;
+			continue;
+		}
+		if (sysfs_read_int(SYSFS_CPU "topology/physical_package_id", cpu, 0, &g[TOPO_SOCKET]) != 0
+			|| g[TOPO_SOCKET] < 0) {
+			g[TOPO_SOCKET] = 0;
+		}
+		g[TOPO_LLC] = llc_group(cpu);
+		if (g[TOPO_LLC] < 0) {
+			// Assume one last-level cache per socket
+			g[TOPO_LLC] = num_cpus + g[TOPO_SOCKET];
+		}
+	}
+
+	return ret;
+}
+
+void topology_exit(void)
+{
+	free(groups);
+	groups = NULL;
+	num_cpus = 0;
+}
+
+int topology_group(int cpu, int level)
+{
+	assert(groups != NULL);
+	assert(0 <= cpu && cpu < num_cpus);
+	assert(0 <= level && level < TOPO_LEVELS);
+
+	return groups[cpu * TOPO_LEVELS + level];
+}
+
+void topology_print(void)
+{
+	int cpu, level;
+
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		printf("CPU %2d:", cpu);
+		for (level = 0; level < TOPO_LEVELS; level++) {
+			printf(" %s %d", topology_level_name(level), topology_group(cpu, level));
+		}
+		printf("\n");
+	}
+}
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include <unistd.h>
+#include "utest.h"
+
+int main(void)
+{
+	UTEST_INIT;
+
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+	int cpu, other, level;
+
+	topology_init(n);
+	topology_print();
+
+	for (cpu = 0; cpu < n; cpu++) {
+		for (other = 0; other < n; other++) {
+			// Groups are nested: CPUs on the same core share the LLC, and
+			// CPUs sharing the LLC are on the same socket
+			for (level = 0; level < TOPO_LEVELS-1; level++) {
+				if (topology_group(cpu, level) == topology_group(other, level)) {
+					check_equal(topology_group(cpu, level+1), topology_group(other, level+1));
+				}
+			}
+		}
+	}
+
+	topology_exit();
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
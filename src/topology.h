@@ -0,0 +1,43 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+//==========================================================================//
+//                                                                          //
+//    Machine topology as seen through sysfs                                //
+//                                                                          //
+//    Every CPU belongs to one group per level: the hardware threads of     //
+//    the same core, the cores sharing the last-level cache, and the        //
+//    cores of the same socket. Groups are identified by integers that      //
+//    are unique per level.                                                 //
+//                                                                          //
+//==========================================================================//
+
+// Levels of the hierarchy, from nearest to farthest
+enum {
+	TOPO_CORE,
+	TOPO_LLC,
+	TOPO_SOCKET,
+	TOPO_LEVELS
+};
+
+// Read the topology of CPUs 0 to num_cpus-1
+// Returns 0 on success and -1 if sysfs is unavailable, in which case every
+// CPU is assumed to be a separate core, and all cores share a socket and
+// last-level cache
+int topology_init(int num_cpus);
+void topology_exit(void);
+
+// Group of CPU cpu at the given level
+// Two CPUs are close at a level if they belong to the same group
+int topology_group(int cpu, int level);
+
+static inline const char *topology_level_name(int level)
+{
+	static const char *names[TOPO_LEVELS] = { "core", "LLC", "socket" };
+
+	return names[level];
+}
+
+void topology_print(void);
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,249 @@
+// gcc -c tsc.c && gcc -Wall -Wextra -DTEST trace.c tsc.o -o trace && ./trace
+#ifndef NTRACE
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+PRIVATE struct trace_buffer *trace_buffer;
+
+// One buffer per worker, for dumping at exit
+static struct trace_buffer **buffers;
+static int num_buffers;
+
+// Ticks at trace_init (see tsc.h), time stamps are relative to this point
+static unsigned long long start_ticks;
+
+int trace_init(int num_workers)
+{
+	assert(num_workers > 0);
+
+	buffers = (struct trace_buffer **)calloc(num_workers, sizeof(struct trace_buffer *));
+	if (!buffers) {
+		fprintf(stderr, "Warning: trace_init failed\n");
+		return -1;
+	}
+
+	num_buffers = num_workers;
+	start_ticks = tsc_read();
+
+	return 0;
+}
+
+int trace_worker_init(int ID)
+{
+	assert(buffers != NULL);
+	assert(0 <= ID && ID < num_buffers);
+
+	// Let each worker allocate (and touch) its own buffer
+	trace_buffer = (struct trace_buffer *)malloc(sizeof(struct trace_buffer));
+	if (!trace_buffer) {
+		fprintf(stderr, "Warning: trace_worker_init failed\n");
+		exit(1);
+	}
+
+	trace_buffer->num_events = 0;
+	buffers[ID] = trace_buffer;
+
+	return 0;
+}
+
+static const char *event_names[TRACE_EVENT_TYPES] = {
+	[TRACE_TASK_START]     = "task",
+	[TRACE_TASK_END]       = "task",
+	[TRACE_REQ_SEND]       = "steal request",
+	[TRACE_REQ_FORWARD]    = "forward steal request",
+	[TRACE_REQ_DECLINE]    = "decline steal request",
+	[TRACE_LIFELINE_CLOSE] = "lifeline",
+	[TRACE_TASK_SEND]      = "send tasks",
+	[TRACE_TASK_RECV]      = "receive tasks",
+	[TRACE_LOOP_SPLIT]     = "split loop",
+	[TRACE_PARK]           = "parked",
+	[TRACE_WAKE]           = "parked"
+};
+
+static void dump_event(FILE *f, int ID, struct trace_event *e)
+{
+	const char *name = event_names[e->type];
+	double ts = (double)(long long)(e->ts - start_ticks) / tsc_ticks_per_usec;
+
+#define EVENT(ph, ...) \
+	fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"" ph "\",\"pid\":0,\"tid\":%d,\"ts\":%.3f" \
+			__VA_ARGS__ "}", name, ID, ts)
+
+	switch (e->type) {
+	case TRACE_TASK_START:
+	case TRACE_PARK:
+		EVENT("B");
+		break;
+	case TRACE_TASK_END:
+	case TRACE_WAKE:
+		EVENT("E");
+		break;
+	case TRACE_REQ_SEND:
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+				"\"args\":{\"victim\":%d}}", name, ID, ts, e->peer);
+		break;
+	case TRACE_REQ_FORWARD:
+	case TRACE_REQ_DECLINE:
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+				"\"args\":{\"thief\":%ld,\"to\":%d}}", name, ID, ts, e->value, e->peer);
+		if (e->type == TRACE_REQ_DECLINE && e->value == ID) {
+			// Waiting for tasks from our parent
+			fprintf(f, ",\n{\"name\":\"lifeline\",\"cat\":\"lifeline\",\"ph\":\"b\",\"id\":%d,"
+					"\"pid\":0,\"tid\":%d,\"ts\":%.3f}", ID, ID, ts);
+		}
+		break;
+	case TRACE_LIFELINE_CLOSE:
+		fprintf(f, ",\n{\"name\":\"lifeline\",\"cat\":\"lifeline\",\"ph\":\"e\",\"id\":%d,"
+				"\"pid\":0,\"tid\":%d,\"ts\":%.3f}", ID, ID, ts);
+		break;
+	case TRACE_TASK_SEND:
+	case TRACE_LOOP_SPLIT:
+		// Zero-length slice with an outgoing flow to the thief
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"dur\":0,\"pid\":0,\"tid\":%d,\"ts\":%.3f,"
+				"\"args\":{\"thief\":%d,\"%s\":%ld}}", name, ID, ts, e->peer,
+				e->type == TRACE_TASK_SEND ? "tasks" : "iterations", e->value);
+		fprintf(f, ",\n{\"name\":\"transfer\",\"cat\":\"transfer\",\"ph\":\"s\",\"id\":%lu,"
+				"\"pid\":0,\"tid\":%d,\"ts\":%.3f}", e->arg, ID, ts);
+		break;
+	case TRACE_TASK_RECV:
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"dur\":0,\"pid\":0,\"tid\":%d,\"ts\":%.3f}",
+				name, ID, ts);
+		fprintf(f, ",\n{\"name\":\"transfer\",\"cat\":\"transfer\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%lu,"
+				"\"pid\":0,\"tid\":%d,\"ts\":%.3f}", e->arg, ID, ts);
+		break;
+	default:
+		break;
+	}
+
+#undef EVENT
+}
+
+int trace_dump(const char *filename)
+{
+	unsigned long i, first;
+	FILE *f;
+	int ID;
+
+	assert(buffers != NULL);
+
+	if (!filename) filename = "trace.json";
+
+	f = fopen(filename, "w");
+	if (!f) {
+		fprintf(stderr, "Warning: could not open %s\n", filename);
+		return -1;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"tasking\"}}");
+
+	for (ID = 0; ID < num_buffers; ID++) {
+		struct trace_buffer *b = buffers[ID];
+		if (!b) continue;
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+				"\"args\":{\"name\":\"Worker %d\"}}", ID, ID);
+		if (b->num_events > TRACE_CAPACITY) {
+			fprintf(stderr, "Warning: worker %d lost %lu of %lu trace events\n", ID,
+					b->num_events - TRACE_CAPACITY, b->num_events);
+			first = b->num_events - TRACE_CAPACITY;
+		} else {
+			first = 0;
+		}
+		for (i = first; i < b->num_events; i++) {
+			dump_event(f, ID, &b->events[i & (TRACE_CAPACITY-1)]);
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	return 0;
+}
+
+void trace_exit(void)
+{
+	int ID;
+
+	for (ID = 0; ID < num_buffers; ID++) {
+		free(buffers[ID]);
+	}
+
+	free(buffers);
+	buffers = NULL;
+	num_buffers = 0;
+	trace_buffer = NULL;
+}
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include <string.h>
+#include "utest.h"
+
+// Number of occurrences of str in file
+static int count(const char *filename, const char *str)
+{
+	char line[512];
+	int n = 0;
+	FILE *f = fopen(filename, "r");
+
+	assert(f != NULL);
+
+	while (fgets(line, sizeof(line), f)) {
+		if (strstr(line, str)) n++;
+	}
+
+	fclose(f);
+
+	return n;
+}
+
+int main(void)
+{
+	UTEST_INIT;
+
+	const char *filename = "/tmp/trace_test.json";
+	int i;
+
+	check_equal(trace_init(2), 0);
+
+	check_equal(trace_worker_init(1), 0);
+	TRACE(REQ_SEND, 0, 0, 0);
+	TRACE(TASK_RECV, -1, 0xabc, 1);
+	TRACE(TASK_START, -1, 0xabc, 0);
+	TRACE(TASK_END, -1, 0xabc, 0);
+	check_equal(trace_buffer->num_events, 4);
+
+	check_equal(trace_worker_init(0), 0);
+	TRACE(TASK_SEND, 1, 0xabc, 1);
+	// Overflow the buffer
+	for (i = 0; i < TRACE_CAPACITY + 10; i++) {
+		TRACE(PARK, -1, 0, 0);
+		TRACE(WAKE, -1, 0, 0);
+	}
+	check_equal(trace_buffer->num_events, 2 * TRACE_CAPACITY + 21);
+
+	check_equal(trace_dump(filename), 0);
+	check_equal(count(filename, "\"thread_name\""), 2);
+	check_equal(count(filename, "\"ph\":\"s\""), 0); // Overwritten
+	check_equal(count(filename, "\"ph\":\"f\""), 1);
+	check_equal(count(filename, "\"parked\""), TRACE_CAPACITY);
+	check_equal(count(filename, "\"task\""), 2);
+
+	trace_exit();
+	remove(filename);
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
+
+#endif // NTRACE
@@ -0,0 +1,100 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+//==========================================================================//
+//                                                                          //
+//    Event tracing                                                         //
+//                                                                          //
+//    Every worker records scheduler events into a private ring buffer,     //
+//    overwriting its oldest events when the buffer is full. At exit, the   //
+//    buffers are written to a file in Chrome trace format, which can be    //
+//    loaded into chrome://tracing or ui.perfetto.dev.                      //
+//                                                                          //
+//    Compile with -DNTRACE to remove tracing altogether.                   //
+//                                                                          //
+//==========================================================================//
+
+enum {
+	TRACE_TASK_START,     // arg: task
+	TRACE_TASK_END,       // arg: task
+	TRACE_REQ_SEND,       // peer: victim
+	TRACE_REQ_FORWARD,    // peer: next victim, value: thief
+	TRACE_REQ_DECLINE,    // peer: parent, value: thief; opens a lifeline if we are the thief
+	TRACE_LIFELINE_CLOSE, // Tasks received after a failed steal request
+	TRACE_TASK_SEND,      // peer: thief, arg: task, value: number of tasks
+	TRACE_TASK_RECV,      // arg: task
+	TRACE_LOOP_SPLIT,     // peer: thief, arg: new task, value: number of iterations
+	TRACE_PARK,
+	TRACE_WAKE,
+	TRACE_EVENT_TYPES
+};
+
+#ifdef NTRACE
+
+#define TRACE_INIT(n)                  ((void)0)
+#define TRACE_WORKER_INIT(id)          ((void)0)
+#define TRACE(type, peer, arg, value)  ((void)0)
+#define TRACE_DUMP(filename)           ((void)0)
+#define TRACE_EXIT()                   ((void)0)
+
+#else
+
+#include "platform.h"
+#include "tsc.h"
+
+// Number of events per worker, must be a power of two
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY (1 << 15)
+#endif
+
+struct trace_event {
+	unsigned long long ts; // ticks (see tsc.h)
+	unsigned long arg;
+	long value;
+	int type;
+	int peer;
+};
+
+struct trace_buffer {
+	// Number of events recorded so far, including overwritten events
+	unsigned long num_events;
+	struct trace_event events[TRACE_CAPACITY];
+};
+
+extern PRIVATE struct trace_buffer *trace_buffer;
+
+// Must be called before workers start
+int trace_init(int num_workers);
+
+// Called by every worker
+int trace_worker_init(int ID);
+
+// Must be called after all workers have finished
+// Writes to "trace.json" if filename is NULL
+int trace_dump(const char *filename);
+
+void trace_exit(void);
+
+static inline void trace_event(int type, int peer, unsigned long arg, long value)
+{
+	struct trace_buffer *b = trace_buffer;
+	struct trace_event *e = &b->events[b->num_events++ & (TRACE_CAPACITY-1)];
+
+	e->ts = tsc_read();
+	e->arg = arg;
+	e->value = value;
+	e->type = type;
+	e->peer = peer;
+}
+
+#define TRACE_INIT(n)                  trace_init(n)
+#define TRACE_WORKER_INIT(id)          trace_worker_init(id)
+// Workers without a buffer (see trace_worker_init) don't record events
+#define TRACE(type, peer, arg, value) \
+	(trace_buffer ? trace_event(TRACE_##type, peer, (unsigned long)(arg), value) : (void)0)
+#define TRACE_DUMP(filename)           trace_dump(filename)
+#define TRACE_EXIT()                   trace_exit()
+
+#endif // NTRACE
+
+#endif // TRACE_H
@@ -0,0 +1,167 @@
+// gcc -Wall -Wextra -DTEST tsc.c -o tsc && ./tsc
+#include <stdio.h>
+#include <stdlib.h>
+#include "tsc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// Nanoseconds from clock_gettime until tsc_init
+double tsc_ticks_per_usec = 1000.0;
+bool tsc_enabled = false;
+bool tsc_rdtscp_supported = false;
+
+// Duration of a calibration round in nanoseconds
+#define TSC_CALIBRATION_NS 5000000ULL
+#define TSC_CALIBRATION_ROUNDS 5
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Invariant TSC: CPUID.80000007H:EDX[8]
+static bool tsc_invariant(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+		return false;
+
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+
+	return edx & (1 << 8);
+}
+
+// RDTSCP: CPUID.80000001H:EDX[27]
+static bool tsc_has_rdtscp(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return edx & (1 << 27);
+}
+
+// Reads the clock between two reads of the counter and returns the counter
+// value at the midpoint
+static unsigned long long tsc_clock_pair(unsigned long long *ns)
+{
+	unsigned long long a, b;
+
+	a = tsc_rdtsc();
+	*ns = tsc_clock_ns();
+	b = tsc_rdtsc();
+
+	return a + (b - a) / 2;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Ticks per microsecond, median of several rounds
+static double tsc_calibrate(void)
+{
+	double rates[TSC_CALIBRATION_ROUNDS];
+	unsigned long long t0, t1, ns0, ns1;
+	int i;
+
+	for (i = 0; i < TSC_CALIBRATION_ROUNDS; i++) {
+		t0 = tsc_clock_pair(&ns0);
+		do {
+			t1 = tsc_clock_pair(&ns1);
+		} while (ns1 - ns0 < TSC_CALIBRATION_NS);
+		rates[i] = (t1 - t0) / ((ns1 - ns0) / 1e3);
+	}
+
+	qsort(rates, TSC_CALIBRATION_ROUNDS, sizeof(double), double_cmp);
+
+	return rates[TSC_CALIBRATION_ROUNDS / 2];
+}
+
+int tsc_init(void)
+{
+	double rate;
+
+	tsc_rdtscp_supported = tsc_has_rdtscp();
+
+	if (!tsc_invariant()) {
+		fprintf(stderr, "Warning: no invariant TSC, timing with clock_gettime\n");
+		return -1;
+	}
+
+	rate = tsc_calibrate();
+	if (!(rate > 0)) {
+		fprintf(stderr, "Warning: tsc_calibrate failed, timing with clock_gettime\n");
+		return -1;
+	}
+
+	tsc_ticks_per_usec = rate;
+	tsc_enabled = true;
+
+	return 0;
+}
+
+#else
+
+int tsc_init(void)
+{
+	return -1;
+}
+
+#endif
+
+#ifdef TEST
+
+//==========================================================================//
+
+#include "utest.h"
+
+// Measures a busy wait of about usec microseconds
+static double tsc_measure(double usec, bool serialized)
+{
+	unsigned long long start, end, ns;
+
+	start = serialized ? tsc_read_serialized() : tsc_read();
+	ns = tsc_clock_ns();
+	while (tsc_clock_ns() - ns < usec * 1e3)
+		;
+	end = serialized ? tsc_read_serialized() : tsc_read();
+
+	return tsc_usec(end - start);
+}
+
+// Within 10 percent
+#define close_to(x, y) ((x) > 0.9 * (y) && (x) < 1.1 * (y))
+
+int main(void)
+{
+	UTEST_INIT;
+
+	// Before calibration
+	check_equal(tsc_enabled, false);
+	check_equal(close_to(tsc_measure(20000, false), 20000), true);
+	check_equal(close_to(tsc_measure(20000, true), 20000), true);
+
+	if (tsc_init() == 0) {
+		check_equal(tsc_enabled, true);
+		check_equal(tsc_ticks_per_usec > 0, true);
+		printf("TSC: %.3lf GHz, rdtscp %s\n", tsc_ticks_per_usec / 1e3,
+				tsc_rdtscp_supported ? "yes" : "no");
+		check_equal(close_to(tsc_measure(20000, false), 20000), true);
+		check_equal(close_to(tsc_measure(20000, true), 20000), true);
+	} else {
+		check_equal(tsc_enabled, false);
+		check_equal(tsc_ticks_per_usec, 1000.0);
+	}
+
+	UTEST_DONE;
+
+	return 0;
+}
+
+//==========================================================================//
+
+#endif // TEST
@@ -0,0 +1,102 @@
+#ifndef TSC_H
+#define TSC_H
+
+//==========================================================================//
+//                                                                          //
+//    Time stamp counter                                                    //
+//                                                                          //
+//    tsc_init calibrates the time stamp counter against                    //
+//    CLOCK_MONOTONIC_RAW, provided the processor reports an invariant      //
+//    TSC, which ticks at a constant rate regardless of frequency scaling   //
+//    and turbo. Otherwise, and before tsc_init, ticks are nanoseconds      //
+//    read from CLOCK_MONOTONIC_RAW.                                        //
+//                                                                          //
+//==========================================================================//
+
+#include <stdbool.h>
+#include <time.h>
+
+// Number of ticks per microsecond
+extern double tsc_ticks_per_usec;
+
+// Ticks are read from the time stamp counter (instead of clock_gettime)
+extern bool tsc_enabled;
+
+// Processor supports rdtscp
+extern bool tsc_rdtscp_supported;
+
+// Returns 0 if the time stamp counter is used, -1 if clock_gettime is used
+int tsc_init(void);
+
+static inline unsigned long long tsc_clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static inline unsigned long long tsc_rdtsc(void)
+{
+	unsigned int lo, hi;
+	// RDTSC copies contents of 64-bit TSC into EDX:EAX
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return (unsigned long long)hi << 32 | lo;
+}
+
+// Waits until all previous instructions have executed
+static inline unsigned long long tsc_rdtscp(void)
+{
+	unsigned int lo, hi, aux;
+	asm volatile ("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux) :: "memory");
+	return (unsigned long long)hi << 32 | lo;
+}
+
+static inline unsigned long long tsc_read(void)
+{
+	return tsc_enabled ? tsc_rdtsc() : tsc_clock_ns();
+}
+
+// Serialized variant for measuring short regions of code: reading the
+// counter neither happens before preceding instructions have completed, nor
+// after subsequent instructions have started
+static inline unsigned long long tsc_read_serialized(void)
+{
+	unsigned long long ticks;
+
+	if (!tsc_enabled)
+		return tsc_clock_ns();
+
+	if (tsc_rdtscp_supported) {
+		ticks = tsc_rdtscp();
+	} else {
+		asm volatile ("lfence" ::: "memory");
+		ticks = tsc_rdtsc();
+	}
+	asm volatile ("lfence" ::: "memory");
+
+	return ticks;
+}
+
+#else
+
+static inline unsigned long long tsc_read(void)
+{
+	return tsc_clock_ns();
+}
+
+static inline unsigned long long tsc_read_serialized(void)
+{
+	return tsc_clock_ns();
+}
+
+#endif
+
+// Converts ticks into microseconds
+static inline double tsc_usec(unsigned long long ticks)
+{
+	return ticks / tsc_ticks_per_usec;
+}
+
+#endif // TSC_H
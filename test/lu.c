@@ -329,13 +329,9 @@ static void bmod_loop(int k)
 {
 	long i, j;
 
-	ASYNC_FOR (i) {
-		if (A(i,k)) {
-			for (j = k + 1; j < NBD; j++) {
-				if (A(k,j)) {
-					ASYNC(bmod, (i, j, k));
-				}
-			}
+	ASYNC_FOR2 (i, j) {
+		if (A(i,k) && A(k,j)) {
+			bmod(i, j, k);
 		}
 	}
 }
@@ -355,7 +351,7 @@ static void par_lu_decompose(void)
 
 		TASKING_BARRIER();
 
-		ASYNC(bmod_loop, (k+1, NBD), (k));
+		ASYNC(bmod_loop, (k+1, NBD, k+1, NBD), (k));
 
 		TASKING_BARRIER();
 	}
@@ -363,39 +359,50 @@ static void par_lu_decompose(void)
 
 #else
 
+// Tasks declare the blocks they read and update, so that steps overlap: the
+// next step starts as soon as the blocks it needs are ready
 static void par_lu_decompose(void)
 {
 	int i, j, k;
 
 	for (k = 0; k < NBD; k++) {
-		lu0(k);
+		ASYNC_DEPS_PRIO(TASK_PRIORITY_MAX, (DEP_INOUT(A(k,k))), lu0, (k));
 
 		for (j = k + 1; j < NBD; j++) {
 			if (A(k,j)) {
-				ASYNC(fwd, (k, j));
+				ASYNC_DEPS_PRIO(TASK_PRIORITY_MAX, (DEP_IN(A(k,k)), DEP_INOUT(A(k,j))),
+						fwd, (k, j));
 			}
 		}
 
 		for (i = k + 1; i < NBD; i++) {
 			if (A(i,k)) {
-				ASYNC(bdiv, (k, i));
+				ASYNC_DEPS_PRIO(TASK_PRIORITY_MAX, (DEP_IN(A(k,k)), DEP_INOUT(A(i,k))),
+						bdiv, (k, i));
 			}
 		}
 
-		TASKING_BARRIER();
-
 		for (i = k + 1; i < NBD; i++) {
 			if (A(i,k)) {
 				for (j = k + 1; j < NBD; j++) {
 					if (A(k,j)) {
-						ASYNC(bmod, (i, j, k));
+						// Fill-in is allocated up front, so that later steps
+						// know which blocks are nonzero
+						if (!A(i,j)) {
+							A(i,j) = allocate_clean_block();
+						}
+						// Updates of the next row and column of blocks are on
+						// the critical path
+						ASYNC_DEPS_PRIO(i == k+1 || j == k+1 ? TASK_PRIORITY_MAX : 0,
+								(DEP_IN(A(i,k)), DEP_IN(A(k,j)), DEP_INOUT(A(i,j))),
+								bmod, (i, j, k));
 					}
 				}
 			}
 		}
-
-		TASKING_BARRIER();
 	}
+
+	TASKING_BARRIER();
 }
 
 #endif // LOOPTASKS for par_lu_decompose
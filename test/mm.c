@@ -230,24 +230,21 @@ void matmul(int i, int j)
 
 #ifdef LOOPTASKS
 
-void matmul_loop(int i)
+void matmul_loop(void)
 {
-	long j;
+	long i, j;
 
-	ASYNC_FOR (j) {
+	ASYNC_FOR2 (i, j) {
 		matmul(i, j);
 	}
 }
 
-DEFINE_ASYNC(matmul_loop, (int));
+DEFINE_ASYNC0(matmul_loop, ());
 
 void mm(void)
 {
-	int i;
-
-	for (i = 0; i < DIM; i++)
-		// Create a loop task for each matrix row
-		ASYNC(matmul_loop, (0, DIM), (i));
+	// Create a single loop task for the whole matrix, split into tiles
+	ASYNC0(matmul_loop, (0, DIM, 0, DIM), ());
 }
 
 #else
@@ -303,34 +300,24 @@ void block_matmul(int i, int j, int k)
 
 #ifdef LOOPTASKS
 
-void block_matmul_loop(int i, int k)
+void block_matmul_loop(int k)
 {
-	long j;
+	long i, j;
 
-	ASYNC_FOR (j) {
-#if 0
+	ASYNC_FOR2 (i, j) {
 		block_matmul(i, j, k);
-#else
-		block_matmul(j/i, j%i, k);
-#endif
 	}
 }
 
-DEFINE_ASYNC(block_matmul_loop, (int, int));
+DEFINE_ASYNC(block_matmul_loop, (int));
 
 void block_mm(void)
 {
-	int i, k;
+	int k;
 
 	for (k = 0; k < NBD; k++) {
-#if 0
-		for (i = 0; i < NBD; i++) {
-			// Create a loop task for all blocks in a row
-			ASYNC(block_matmul_loop, (0, NBD), (i, k));
-		}
-#else
-		ASYNC(block_matmul_loop, (0, NBD * NBD), (NBD, k));
-#endif
+		// Create a loop task for all blocks
+		ASYNC(block_matmul_loop, (0, NBD, 0, NBD), (k));
 		TASKING_BARRIER();
 	}
 }
@@ -114,6 +114,54 @@ int nqueens(int n, int j, char *a)
 	return count;
 }
 
+// Set by the first task that finds a solution
+static bool found;
+
+// Cancelled as soon as a solution has been found
+static tasking_token search;
+
+int nqueens_first(int, int, char *);
+
+DEFINE_FUTURE(int, nqueens_first, (int, int, char *));
+
+// Returns 1 if a solution has been found, stops searching as soon as any task
+// has found one
+int nqueens_first(int n, int j, char *a)
+{
+	int res = 0, i;
+	future children[n];
+
+	if (n == j) {
+		/* Good solution, keep the first one */
+		if (!__atomic_exchange_n(&found, true, __ATOMIC_SEQ_CST)) {
+			example_solution = malloc(n * sizeof(char));
+			memcpy(example_solution, a, n * sizeof(char));
+			tasking_cancel(&search);
+		}
+		return 1;
+	}
+
+	memset(children, 0, n * sizeof(future));
+
+	/* Try each possible position for queen <j> */
+	for (i = 0; i < n && !CANCELLED(); i++) {
+		char *b = alloca((j + 1) * sizeof(char));
+		memcpy(b, a, j * sizeof(char));
+		b[j] = (char)i;
+		if (ok(j + 1, b)) {
+			children[i] = FUTURE(nqueens_first, (n, j + 1, b));
+		}
+	}
+
+	/* Results in the order the children finish; once a solution has been
+	 * found, the remaining children are cancelled and resolve to zero */
+	while (AWAIT_ANY(children, n, int, &i) >= 0) {
+		res |= i;
+	}
+
+	return res;
+}
+
 #if 0
 int nqueens_spawn(int, int, char *);
 
@@ -190,8 +238,8 @@ int main(int argc, char *argv[])
 	double start, end;
 	int count = 0, n;
 
-	if (argc != 2) {
-		printf("Usage: %s <number of queens>\n", argv[0]);
+	if (argc != 2 && !(argc == 3 && strcmp(argv[2], "first") == 0)) {
+		printf("Usage: %s <number of queens> [first]\n", argv[0]);
 		exit(0);
 	}
 
@@ -204,9 +252,26 @@ int main(int argc, char *argv[])
 	TASKING_INIT(&argc, &argv);
 
 	start = Wtime_msec();
-	count = nqueens(n, 0, alloca(n * sizeof(char)));
+	if (argc == 3) {
+		// Stop at the first solution
+		tasking_token_init(&search);
+		WITH_TOKEN (&search) {
+			count = nqueens_first(n, 0, alloca(n * sizeof(char)));
+		}
+	} else {
+		count = nqueens(n, 0, alloca(n * sizeof(char)));
+	}
 	end = Wtime_msec();
-	verify_queens(n, count);
+
+	if (argc == 3) {
+		// There are solutions for every n except 2 and 3
+		if (count != (n == 2 || n == 3 ? 0 : 1) ||
+			(example_solution != NULL && !ok(n, example_solution))) {
+			printf("N-Queens failed: invalid solution\n");
+		}
+	} else {
+		verify_queens(n, count);
+	}
 
 	if (example_solution != NULL) {
 		int i;
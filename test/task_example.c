@@ -25,12 +25,12 @@ int main(int argc, char *argv[])
 	// ASYNC expands into:
 	//
 	// do {
-	//     Task *__task = RT_task_alloc();
+	//     Task *__task = RT_task_alloc(sizeof(__d));
 	//     struct puts_task_data __d;
 	//     __task->parent = current_task();
 	//     __task->fn = (void (*)(void *))puts_task_func;
 	//     __d = (typeof(__d)){ "Hello World!" };
-	//     memcpy(__task->data, &__d, sizeof(__d));
+	//     memcpy(task_data(__task), &__d, sizeof(__d));
 	//     RT_push(__task);
 	// } while (0);
 
@@ -42,13 +42,13 @@ int main(int argc, char *argv[])
 	// FUTURE expands into:
 	//
 	// future f = ({
-	//     Task *__task = RT_task_alloc();
+	//     Task *__task = RT_task_alloc(sizeof(__d));
 	//     struct sum_task_data __d;
 	//     future __f = sum_channel();
 	//     __task->parent = current_task();
 	//     __task->fn = (void (*)(void *))sum_task_func;
 	//     __d = (typeof(__d)){ __f, 1, 2 };
-	//     memcpy(__task->data, &__d, sizeof(__d));
+	//     memcpy(task_data(__task), &__d, sizeof(__d));
 	//     RT_push(__task);
 	//     __f;
 	// });
@@ -1,6 +1,5 @@
-#define EXPERIMENTAL
-
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "tasking.h"
@@ -76,6 +75,31 @@ DEFINE_ASYNC  (nrt1L, (int));
 DEFINE_ASYNC  (nrt2L, (int, int));
 DEFINE_ASYNC  (nrt3L, (int, int, int));
 
+// Splittable ASYNC procedures over two and three dimensions
+
+static char grid[16][40][24];
+
+void nrt1L2(int a1)
+{
+	long i, j;
+
+	ASYNC_FOR2 (i, j) {
+		grid[i][j][0] += a1;
+	}
+}
+
+void nrt0L3(void)
+{
+	long i, j, k;
+
+	ASYNC_FOR3 (i, j, k) {
+		grid[i][j][k]++;
+	}
+}
+
+DEFINE_ASYNC  (nrt1L2, (int));
+DEFINE_ASYNC0 (nrt0L3, ());
+
 // FUTURE functions (return values in the future)
 
 int wrt0(void)
@@ -117,11 +141,10 @@ long wrt0L(void)
 {
 	long sum = 0, i;
 
-	ASYNC_FOR (i) {
+	ASYNC_FOR_REDUCE (i, +, sum, 0) {
 		sum += array[i];
 	}
 
-	printf("wrt0L: %ld\n", REDUCE(+, sum));
 	return sum;
 }
 
@@ -129,16 +152,147 @@ long wrt1L(long array[])
 {
 	long sum = 0, i;
 
-	ASYNC_FOR (i) {
+	ASYNC_FOR_REDUCE (i, +, sum, 0) {
+		sum += array[i];
+	}
+
+	return sum;
+}
+
+// Tasks split off the loop start from the identity, not from init
+long wrt2L(long init)
+{
+	long sum = init, i;
+
+	ASYNC_FOR_REDUCE (i, +, sum, 0) {
 		sum += array[i];
 	}
 
-	printf("wrt1L: %ld\n", REDUCE(+, sum));
 	return sum;
 }
 
 DEFINE_FUTURE0 (long, wrt0L, ());
 DEFINE_FUTURE  (long, wrt1L, (long *));
+DEFINE_FUTURE  (long, wrt2L, (long));
+
+// Arguments that exceed the data area of a task are stored out of line
+
+typedef struct {
+	long v[32];
+} vec;
+
+long wrt1V(vec v)
+{
+	long sum = 0;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		sum += v.v[i];
+	}
+
+	return sum;
+}
+
+void nrt2VL(vec v, long *sum)
+{
+	long i;
+
+	ASYNC_FOR (i) {
+		__sync_fetch_and_add(sum, v.v[i]);
+	}
+}
+
+DEFINE_FUTURE (long, wrt1V, (vec));
+DEFINE_ASYNC  (nrt2VL, (vec, long *));
+
+// ASYNC procedures with dependencies
+
+void inc(int *x)
+{
+	(*x)++;
+}
+
+void check(int *x, int v)
+{
+	assert(*x == v);
+}
+
+void set(int *x, int v)
+{
+	*x = v;
+}
+
+DEFINE_ASYNC (inc, (int *));
+DEFINE_ASYNC (check, (int *, int));
+DEFINE_ASYNC (set, (int *, int));
+
+// Jobs for a separate pool of workers
+
+void pool_job(void *arg)
+{
+	vec *v = (vec *)arg;
+	long sum = 0;
+
+	future f = FUTURE (wrt1V, (*v));
+	ASYNC (nrt2VL, (0, 32), (*v, &sum));
+
+	assert(AWAIT(f, long) == 31 * 32 / 2);
+
+	TASKING_BARRIER();
+
+	assert(sum == 31 * 32 / 2);
+}
+
+// Order in which prioritized tasks run on a single worker
+static int prio_order[4], prio_count;
+
+void prio(int p)
+{
+	prio_order[prio_count++] = p;
+}
+
+DEFINE_ASYNC (prio, (int));
+
+void prio_job(void *arg __attribute__((unused)))
+{
+	ASYNC_PRIO (0, prio, (0));
+	ASYNC_PRIO (TASK_PRIORITY_MAX, prio, (TASK_PRIORITY_MAX));
+	ASYNC_PRIO (0, prio, (0));
+	ASYNC_PRIO (1, prio, (1));
+
+	TASKING_BARRIER();
+}
+
+// Threads that are not workers submit tasks and wait for their results
+
+static volatile int submitted_done;
+
+void *submit_thread(void *arg)
+{
+	tasking_pool *pool = (tasking_pool *)arg;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		future f = SUBMIT(pool, wrt2, (i, 1));
+		assert(AWAIT(f, int) == i + 1);
+	}
+
+	future f = SUBMIT0(pool, wrt0, ());
+	assert(AWAIT(f, int) == 0);
+
+	future fs[2] = { SUBMIT(pool, wrt1, (1)), SUBMIT0(pool, wrt0, ()) };
+	int r;
+
+	for (i = 0; i < 2; i++) {
+		int j = AWAIT_ANY(fs, 2, int, &r);
+		assert(j >= 0 && r == (j == 0 ? 1 : 0));
+	}
+	assert(AWAIT_ANY(fs, 2, int, &r) == -1);
+
+	__atomic_store_n(&submitted_done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
 
 int main(int argc, char *argv[])
 {
@@ -213,6 +367,180 @@ int main(int argc, char *argv[])
 
 	assert(AWAIT(f5, long) == N);
 	assert(AWAIT(f4, long) == N);
+	assert(AWAIT(FUTURE (wrt2L, (0, N), (42), 0), long) == N + 42);
+
+	TASKING_BARRIER();
+
+	vec v;
+	long sum = 0;
+
+	for (i = 0; i < 32; i++) {
+		v.v[i] = i;
+	}
+
+	future f6 = FUTURE (wrt1V, (v));
+	ASYNC (nrt2VL, (0, 32), (v, &sum));
+
+	assert(AWAIT(f6, long) == 31 * 32 / 2);
+
+	TASKING_BARRIER();
+
+	assert(sum == 31 * 32 / 2);
+
+	// Every iteration runs once, and counts as one executed task
+	tasking_stats *before = tasking_stats_snapshot(), *after;
+	int j, k;
+
+	ASYNC0 (nrt0L3, (0, 16, 0, 40, 0, 24), ());
+	TASKING_BARRIER();
+	ASYNC  (nrt1L2, (0, 16, 0, 40), (2));
+	TASKING_BARRIER();
+
+	after = tasking_stats_snapshot();
+	assert(before != NULL && after != NULL);
+	assert(after->total.tasks_executed - before->total.tasks_executed == 16 * 40 * 24 + 16 * 40);
+	free(before);
+	free(after);
+
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 40; j++) {
+			for (k = 0; k < 24; k++) {
+				assert(grid[i][j][k] == (k == 0 ? 3 : 1));
+			}
+		}
+	}
+
+	// Tasks with priorities (see prio_job for their order)
+	future f9 = FUTURE_PRIO (TASK_PRIORITY_MAX, wrt2, (5, 6));
+	future f10 = FUTURE0_PRIO (1, wrt0, ());
+	ASYNC_PRIO (TASK_PRIORITY_MAX, nrt2L, (0, 3), (1, 2));
+	ASYNC0_PRIO (0, nrt0, ());
+
+	assert(AWAIT(f10, int) == 0);
+	assert(AWAIT(f9, int) == 11);
+
+	TASKING_BARRIER();
+
+	// Results in the order the futures complete
+	future fs[4] = { FUTURE (wrt1, (1)), NULL, FUTURE (wrt2, (2, 3)), FUTURE0 (wrt0, ()) };
+	int r, n = 0;
+
+	while ((i = AWAIT_ANY(fs, 4, int, &r)) >= 0) {
+		assert(fs[i] == NULL);
+		assert(r == (i == 0 ? 1 : i == 2 ? 5 : 0));
+		n++;
+	}
+	assert(n == 3);
+
+	TASKING_BARRIER();
+
+	// Tasks run after the tasks they depend on
+	int x = 0;
+
+	ASYNC_DEPS ((DEP_INOUT(&x)), inc, (&x));
+	ASYNC_DEPS ((DEP_INOUT(&x)), inc, (&x));
+	ASYNC_DEPS ((DEP_IN(&x)), check, (&x, 2));
+	ASYNC_DEPS ((DEP_IN(&x)), check, (&x, 2));
+	ASYNC_DEPS ((DEP_OUT(&x)), set, (&x, 10));
+	ASYNC_DEPS_PRIO (TASK_PRIORITY_MAX, (DEP_IN(&x), DEP_IN(&sum)), check, (&x, 10));
+
+	TASKING_BARRIER();
+
+	assert(x == 10);
+
+	// Tasks with cancelled tokens are skipped, their futures resolve to zero
+	tasking_token outer, inner;
+
+	tasking_token_init(&outer);
+	WITH_TOKEN (&outer) {
+		tasking_token_init(&inner);
+		tasking_cancel(&outer);
+		ASYNC (nrt1, (2));
+		ASYNC (nrt1L, (0, 100), (3));
+		assert(AWAIT(FUTURE (wrt1, (7)), int) == 0);
+		assert(CANCELLED());
+	}
+	assert(!CANCELLED());
+
+	// Cancelling outer cancels inner
+	WITH_TOKEN (&inner) {
+		assert(AWAIT(FUTURE0 (wrt0L, (0, N), (), 0), long) == 0);
+	}
+
+	TASKING_BARRIER();
+
+	// Statistics can be collected at any barrier
+	tasking_stats *stats = tasking_stats_snapshot();
+	unsigned long executed = 0;
+
+	assert(stats != NULL && stats->num_workers > 0);
+	for (i = 0; i < stats->num_workers; i++) {
+		executed += stats->workers[i].tasks_executed;
+	}
+	assert(executed == stats->total.tasks_executed);
+	assert(stats->total.tasks_executed >= 4 + 4 * 3 + 4 + 6 + 3 * N + 1 + 32 + 2 + 3 + 1 + 3 + 6);
+	assert(stats->total.requests_steal_one + stats->total.requests_steal_half ==
+		   stats->total.requests_sent);
+	assert(stats->total.idle_blocked <= stats->total.idle_entered);
+	assert(stats->total.tasks_cancelled >= 4);
+	int workers = stats->num_workers;
+	free(stats);
+
+	// Pools run independently of the workers of TASKING_INIT
+	tasking_pool *pool = tasking_pool_create(2, NULL);
+
+	assert(pool != NULL);
+	tasking_pool_run(pool, pool_job, &v);
+	tasking_pool_run(pool, pool_job, &v);
+
+	// Injected tasks
+	future f7 = SUBMIT(NULL, wrt2, (3, 4));
+	future f8 = SUBMIT(pool, wrt3, (4, 5, 6));
+
+	assert(AWAIT(f8, int) == 15);
+	assert(AWAIT(f7, int) == 7);
+
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, submit_thread, pool);
+	pthread_join(thread, NULL);
+
+	// The master takes injected tasks while in TASKING_BARRIER
+	submitted_done = 0;
+	pthread_create(&thread, NULL, submit_thread, NULL);
+	while (!__atomic_load_n(&submitted_done, __ATOMIC_ACQUIRE)) {
+		TASKING_BARRIER();
+	}
+	pthread_join(thread, NULL);
+
+	// Parked workers wake up to run injected tasks, even if the master doesn't
+	// help
+	if (workers > 1) {
+		pthread_create(&thread, NULL, submit_thread, NULL);
+		pthread_join(thread, NULL);
+	}
+
+	TASKING_BARRIER();
+
+	tasking_pool_destroy(pool);
+
+	// A pool that never ran a job
+	pool = tasking_pool_create(2, NULL);
+
+	assert(pool != NULL);
+	tasking_pool_destroy(pool);
+
+	// Tasks of higher priority run first
+	pool = tasking_pool_create(1, NULL);
+
+	assert(pool != NULL);
+	tasking_pool_run(pool, prio_job, NULL);
+	tasking_pool_destroy(pool);
+
+	assert(prio_count == 4);
+	assert(prio_order[0] == TASK_PRIORITY_MAX);
+	assert(prio_order[1] == 1);
+	assert(prio_order[2] == 0 && prio_order[3] == 0);
 
 	TASKING_EXIT();
 